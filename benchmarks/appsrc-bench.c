@@ -0,0 +1,252 @@
+/*
+clear && gcc -O3 appsrc-bench.c -o appsrc-bench `pkg-config --cflags --libs gstreamer-1.0 gstreamer-audio-1.0` -lm && ./appsrc-bench
+*/
+
+/* Cost of feeding appsrc the way ../gstreamer-examples/basic-tutorial-8.c
+ * does, before and after it moved to a buffer pool:
+ *
+ *   alloc - what push_data used to do: gst_buffer_new_and_alloc for every
+ *           chunk, filled one sample at a time by the serial recurrence.
+ *   pool  - what it does now: a buffer from a GstBufferPool, filled by the
+ *           block generator of ../synth.h.
+ *
+ * For each chunk size, the buffers are pushed as fast as appsrc takes them
+ * for SECONDS, into appsrc ! fakesink with appsrc blocking while full and
+ * fakesink not syncing. It prints buffers per second and the calls to
+ * malloc, calloc and realloc per buffer in the whole process, GStreamer's
+ * streaming thread included, counted by the wrappers below. The two
+ * generators are also timed on their own.
+ */
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+#include <stdlib.h>
+
+#include "../synth.h"
+
+#define SECONDS 2
+#define SAMPLE_RATE 44100
+#define POOL_BUFFERS 32
+#define WARMUP_BUFFERS 1000
+#define GENERATOR_SAMPLES (64 * 1024 * 1024)
+
+static const gint chunk_sizes[] = { 1024, 4096, 16384 };
+
+// Every allocation in the process goes through these, since the program's
+// own definitions take precedence over the C library's for all the shared
+// libraries too.
+extern void* __libc_malloc (size_t size);
+extern void* __libc_calloc (size_t n, size_t size);
+extern void* __libc_realloc (void* mem, size_t size);
+
+static gint64 n_allocs;
+
+void*
+malloc (size_t size)
+{
+  __atomic_add_fetch (&n_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_malloc (size);
+}
+
+void*
+calloc (size_t n, size_t size)
+{
+  __atomic_add_fetch (&n_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_calloc (n, size);
+}
+
+void*
+realloc (void* mem, size_t size)
+{
+  __atomic_add_fetch (&n_allocs, 1, __ATOMIC_RELAXED);
+  return __libc_realloc (mem, size);
+}
+
+typedef struct _Generator
+{
+  gfloat a, b, c, d;
+  guint64 num_samples;
+  Synth* synth;
+} Generator;
+
+/* The loop push_data had. */
+static void
+generate_serial (gfloat* a, gfloat* b, gfloat freq, gint16* raw,
+    gint num_samples)
+{
+  for (gint i = 0; i < num_samples; i++) {
+    *a += *b;
+    *b -= *a / freq;
+    raw[i] = (gint16) (500 * *a);
+  }
+}
+
+static gfloat
+next_freq (Generator* gen)
+{
+  gen->c += gen->d;
+  gen->d -= gen->c / 1000;
+  return 1100 + 1000 * gen->d;
+}
+
+/* Fills and pushes one buffer of @chunk_size bytes, from @pool or freshly
+ * allocated if @pool is NULL. */
+static gboolean
+push_chunk (GstElement* appsrc, GstBufferPool* pool, Generator* gen,
+    gint chunk_size)
+{
+  gint num_samples = chunk_size / 2;
+  GstBuffer* buffer;
+  GstMapInfo map;
+  GstFlowReturn ret;
+
+  if (pool) {
+    if (gst_buffer_pool_acquire_buffer (pool, &buffer, NULL) != GST_FLOW_OK) {
+      return FALSE;
+    }
+  } else {
+    buffer = gst_buffer_new_and_alloc (chunk_size);
+  }
+
+  GST_BUFFER_TIMESTAMP (buffer) = gst_util_uint64_scale (gen->num_samples,
+      GST_SECOND, SAMPLE_RATE);
+  GST_BUFFER_DURATION (buffer) = gst_util_uint64_scale (num_samples,
+      GST_SECOND, SAMPLE_RATE);
+
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  if (pool) {
+    synth_fill_s16 (gen->synth, (gint16*) map.data, num_samples);
+  } else {
+    generate_serial (&gen->a, &gen->b, next_freq (gen), (gint16*) map.data,
+        num_samples);
+  }
+  gst_buffer_unmap (buffer, &map);
+  gen->num_samples += num_samples;
+
+  g_signal_emit_by_name (appsrc, "push-buffer", buffer, &ret);
+  gst_buffer_unref (buffer);
+  return ret == GST_FLOW_OK;
+}
+
+static void
+run (const gchar* label, gboolean use_pool, gint chunk_size)
+{
+  GstElement* pipeline = gst_parse_launch ("appsrc name=src block=true ! "
+      "fakesink sync=false enable-last-sample=false", NULL);
+  GstElement* appsrc = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  GstAudioInfo info;
+  GstBufferPool* pool = NULL;
+
+  gst_audio_info_set_format (&info, GST_AUDIO_FORMAT_S16, SAMPLE_RATE, 1,
+      NULL);
+  GstCaps* caps = gst_audio_info_to_caps (&info);
+  g_object_set (appsrc, "caps", caps, "format", GST_FORMAT_TIME, NULL);
+
+  if (use_pool) {
+    pool = gst_buffer_pool_new ();
+    GstStructure* config = gst_buffer_pool_get_config (pool);
+    gst_buffer_pool_config_set_params (config, caps, chunk_size,
+        POOL_BUFFERS, 0);
+    if (!gst_buffer_pool_set_config (pool, config) ||
+        !gst_buffer_pool_set_active (pool, TRUE)) {
+      g_printerr ("Buffer pool could not be set up\n");
+      exit (1);
+    }
+  }
+  gst_caps_unref (caps);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  Generator gen = { 0, 1, 0, 1, 0,
+    synth_new (SYNTH_PSYCHEDELIC, SAMPLE_RATE, 1) };
+
+  // Let the pool and appsrc's queue reach their steady size first.
+  for (gint i = 0; i < WARMUP_BUFFERS; ++i) {
+    push_chunk (appsrc, pool, &gen, chunk_size);
+  }
+
+  gint64 allocs = __atomic_load_n (&n_allocs, __ATOMIC_RELAXED);
+  gint64 start = g_get_monotonic_time ();
+  gint64 end = start + SECONDS * G_USEC_PER_SEC;
+  gint64 now = start;
+  guint64 pushed = 0;
+  while (now < end) {
+    if (!push_chunk (appsrc, pool, &gen, chunk_size)) {
+      g_printerr ("push-buffer failed\n");
+      exit (1);
+    }
+    pushed++;
+    // The clock is read every 64 buffers to keep it out of the measurement.
+    if (pushed % 64 == 0) {
+      now = g_get_monotonic_time ();
+    }
+  }
+  allocs = __atomic_load_n (&n_allocs, __ATOMIC_RELAXED) - allocs;
+
+  gdouble seconds = (now - start) / 1e6;
+  g_print ("%-5s %5d byte chunks: %9.0f buffers/s, %6.1fx real time, "
+      "%5.2f allocations/buffer\n", label, chunk_size, pushed / seconds,
+      pushed * (chunk_size / 2) / seconds / SAMPLE_RATE,
+      (gdouble) allocs / pushed);
+
+  g_signal_emit_by_name (appsrc, "end-of-stream", NULL);
+  GstBus* bus = gst_element_get_bus (pipeline);
+  gst_message_unref (gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+          GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+  gst_object_unref (bus);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (appsrc);
+  gst_object_unref (pipeline);
+  synth_free (gen.synth);
+  if (pool) {
+    gst_buffer_pool_set_active (pool, FALSE);
+    gst_object_unref (pool);
+  }
+}
+
+/* Nanoseconds per sample of the serial loop, or of ../synth.h if @block,
+ * into a 1024-byte chunk that stays in the cache. */
+static gdouble
+time_generator (gboolean block)
+{
+  gint16 raw[512];
+  Generator gen = { 0, 1, 0, 1, 0,
+    synth_new (SYNTH_PSYCHEDELIC, SAMPLE_RATE, 1) };
+  gint64 sink = 0;
+
+  gint64 start = g_get_monotonic_time ();
+  for (gint n = 0; n < GENERATOR_SAMPLES; n += G_N_ELEMENTS (raw)) {
+    if (block) {
+      synth_fill_s16 (gen.synth, raw, G_N_ELEMENTS (raw));
+    } else {
+      generate_serial (&gen.a, &gen.b, next_freq (&gen), raw,
+          G_N_ELEMENTS (raw));
+    }
+    sink += raw[n % G_N_ELEMENTS (raw)];
+  }
+  gint64 elapsed = g_get_monotonic_time () - start;
+  synth_free (gen.synth);
+
+  // Keeps the compiler from dropping the work.
+  if (sink == G_MININT64) {
+    g_print (" ");
+  }
+  return elapsed * 1e3 / GENERATOR_SAMPLES;
+}
+
+int
+main (int argc, char** argv)
+{
+  gst_init (&argc, &argv);
+
+  g_print ("Generator: serial %.2f ns/sample, block %.2f ns/sample\n",
+      time_generator (FALSE), time_generator (TRUE));
+
+  for (guint i = 0; i < G_N_ELEMENTS (chunk_sizes); ++i) {
+    run ("alloc", FALSE, chunk_sizes[i]);
+    run ("pool", TRUE, chunk_sizes[i]);
+  }
+
+  return 0;
+}
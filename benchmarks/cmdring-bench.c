@@ -0,0 +1,198 @@
+/*
+clear && gcc -O2 cmdring-bench.c -o cmdring-bench `pkg-config --cflags --libs gstreamer-1.0` && ./cmdring-bench
+*/
+
+/* Command round trip latency from the UI thread to the pipeline controller and
+ * back, at COMMANDS_PER_SECOND.
+ *
+ * Two ways of handing a switch command to another thread are compared:
+ *
+ *   bus     - what p1-2.c used to do: a GstStructure in an application
+ *             GstMessage posted to a GstBus, copied and matched by name on
+ *             the other side.
+ *   cmdring - a Cmd pushed to the CmdRing in ../cmdring.h, with the consumer
+ *             sleeping on a CmdWaiter.
+ *
+ * The consumer sends every command straight back on a second CmdRing, which
+ * the producer polls between commands, so both modes share the return path.
+ */
+
+#include <gst/gst.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../cmdring.h"
+
+#define COMMANDS_PER_SECOND 10000
+#define SECONDS 2
+#define N_COMMANDS (COMMANDS_PER_SECOND * SECONDS)
+
+static CmdRing request_ring;
+static CmdRing reply_ring;
+static CmdWaiter waiter;
+static GstBus* bus;
+
+static gint64 round_trip_ns[N_COMMANDS];
+static gint n_round_trips;
+
+static gint64
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+reply (const Cmd* cmd)
+{
+  // The producer drains the replies faster than they come in.
+  while (!cmd_ring_push (&reply_ring, cmd)) {
+    g_thread_yield ();
+  }
+}
+
+static gpointer
+ring_consumer (gpointer user_data)
+{
+  CmdRing* const rings[] = { &request_ring };
+
+  for (;;) {
+    Cmd cmd;
+
+    cmd_waiter_wait (&waiter, rings, 1);
+    while (cmd_ring_pop (&request_ring, &cmd)) {
+      if (cmd.type == CMD_QUIT) {
+        return NULL;
+      }
+      reply (&cmd);
+    }
+  }
+}
+
+static gpointer
+bus_consumer (gpointer user_data)
+{
+  for (;;) {
+    GstMessage* msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+        GST_MESSAGE_APPLICATION);
+    GstStructure* data = gst_structure_copy (gst_message_get_structure (msg));
+    gst_message_unref (msg);
+
+    gchar const*const name = gst_structure_get_name (data);
+    gboolean quit = !g_strcmp0 (name, "quit");
+
+    if (!g_strcmp0 (name, "gtk-button-clicked")) {
+      Cmd cmd = { .type = CMD_SWITCH_VISUALIZER };
+      gst_structure_get_int (data, "index", &cmd.index);
+      gst_structure_get_int64 (data, "sent", &cmd.sent_us);
+      reply (&cmd);
+    }
+    gst_structure_free (data);
+
+    if (quit) {
+      return NULL;
+    }
+  }
+}
+
+static void
+send_ring (gint index, gint64 sent_ns)
+{
+  Cmd cmd = {
+    .type = CMD_SWITCH_VISUALIZER,
+    .index = index,
+    .sent_us = sent_ns,
+  };
+  while (!cmd_ring_push (&request_ring, &cmd)) {
+    g_thread_yield ();
+  }
+  cmd_waiter_wake (&waiter);
+}
+
+static void
+send_bus (gint index, gint64 sent_ns)
+{
+  GstStructure* s = gst_structure_new ("gtk-button-clicked",
+      "index", G_TYPE_INT, index,
+      "sent", G_TYPE_INT64, sent_ns,
+      NULL);
+  gst_bus_post (bus, gst_message_new_application (NULL, s));
+}
+
+static void
+collect_replies (void)
+{
+  Cmd cmd;
+  gint64 now = now_ns ();
+
+  while (cmd_ring_pop (&reply_ring, &cmd)) {
+    round_trip_ns[n_round_trips++] = now - cmd.sent_us;
+  }
+}
+
+static gint
+compare_int64 (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64*) a, y = *(const gint64*) b;
+  return x < y ? -1 : x > y;
+}
+
+static void
+run (const gchar* label, GThreadFunc consumer,
+    void (*send) (gint index, gint64 sent_ns))
+{
+  cmd_ring_init (&request_ring);
+  cmd_ring_init (&reply_ring);
+  n_round_trips = 0;
+
+  GThread* thread = g_thread_new (label, consumer, NULL);
+
+  // Commands go out on a fixed schedule. The producer spins in between so it
+  // sees each reply as soon as it arrives.
+  gint64 period_ns = 1000000000 / COMMANDS_PER_SECOND;
+  gint64 next = now_ns ();
+  for (gint i = 0; i < N_COMMANDS; ++i) {
+    while (now_ns () < next) {
+      collect_replies ();
+    }
+    send (i % 4, now_ns ());
+    next += period_ns;
+  }
+  while (n_round_trips < N_COMMANDS) {
+    collect_replies ();
+  }
+
+  if (send == send_ring) {
+    Cmd quit = { .type = CMD_QUIT };
+    cmd_ring_push (&request_ring, &quit);
+    cmd_waiter_wake (&waiter);
+  } else {
+    gst_bus_post (bus, gst_message_new_application (NULL,
+            gst_structure_new_empty ("quit")));
+  }
+  g_thread_join (thread);
+
+  qsort (round_trip_ns, n_round_trips, sizeof round_trip_ns[0], compare_int64);
+  g_print ("%-8s %d commands at %d/s: round trip p50 %.2f us, p99 %.2f us, "
+      "max %.2f us\n", label, n_round_trips, COMMANDS_PER_SECOND,
+      round_trip_ns[n_round_trips / 2] / 1e3,
+      round_trip_ns[n_round_trips * 99 / 100] / 1e3,
+      round_trip_ns[n_round_trips - 1] / 1e3);
+}
+
+int
+main (int argc, char** argv)
+{
+  gst_init (&argc, &argv);
+
+  bus = gst_bus_new ();
+  cmd_waiter_init (&waiter);
+
+  run ("bus", bus_consumer, send_bus);
+  run ("cmdring", ring_consumer, send_ring);
+
+  cmd_waiter_clear (&waiter);
+  gst_object_unref (bus);
+  return 0;
+}
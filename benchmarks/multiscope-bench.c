@@ -0,0 +1,164 @@
+/*
+clear && gcc -O2 multiscope-bench.c -o multiscope-bench `pkg-config --cflags --libs gstreamer-1.0` && ./multiscope-bench
+*/
+
+/* How the multi-channel visualizer of ../multiscope.h scales across cores.
+ *
+ * A CHANNELS-channel source goes through one multiscope bin of FACTORY,
+ *
+ *   audiotestsrc ! CHANNELS channels ! multiscope ! fakesink sync=false
+ *
+ * as fast as it will go, for AUDIO_SECONDS of audio. Instead of JACK, which
+ * would pace it in real time, the source is a non-live audiotestsrc, so the
+ * run takes as long as the work does. Each run is a fresh process pinned to
+ * the first 1, 2, 4, ... MAX_CORES of the CPUs it may use, since GStreamer's
+ * streaming threads inherit the affinity of the process.
+ *
+ * For each core count it prints how many times faster than real time the
+ * pipeline ran, the speedup over one core and its efficiency (speedup per
+ * core; 100% is linear), and how busy the allowed cores were.
+ */
+
+#define _GNU_SOURCE
+#include <gst/gst.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include "../cputime.h"
+#include "../multiscope.h"
+
+#define CHANNELS 16
+#define FACTORY "wavescope"
+#define WIDTH 800
+#define HEIGHT 600
+#define RATE 44100
+#define SAMPLES_PER_BUFFER 1024
+#define AUDIO_SECONDS 20
+#define MAX_CORES 8
+
+/* Pins the process to the first @cores CPUs it may run on. */
+static gboolean
+pin (gint cores)
+{
+  cpu_set_t allowed, set;
+
+  if (sched_getaffinity (0, sizeof allowed, &allowed) != 0) {
+    return FALSE;
+  }
+  CPU_ZERO (&set);
+  for (gint cpu = 0, n = 0; cpu < CPU_SETSIZE && n < cores; ++cpu) {
+    if (CPU_ISSET (cpu, &allowed)) {
+      CPU_SET (cpu, &set);
+      n++;
+    }
+  }
+  return CPU_COUNT (&set) == cores &&
+      sched_setaffinity (0, sizeof set, &set) == 0;
+}
+
+/* The child process. Prints "<wall seconds> <cpu seconds>". */
+static int
+run_child (gint cores, int argc, char** argv)
+{
+  if (!pin (cores)) {
+    return 2;
+  }
+
+  gst_init (&argc, &argv);
+
+  gchar* description = g_strdup_printf ("audiotestsrc num-buffers=%d "
+      "samplesperbuffer=%d ! audio/x-raw,format=S16LE,layout=interleaved,"
+      "rate=%d,channels=%d,channel-mask=(bitmask)0 ! identity name=in ! "
+      "fakesink name=sink sync=false enable-last-sample=false",
+      AUDIO_SECONDS * RATE / SAMPLES_PER_BUFFER, SAMPLES_PER_BUFFER, RATE,
+      CHANNELS);
+  GstElement* pipeline = gst_parse_launch (description, NULL);
+  g_free (description);
+  GstElement* scope = multiscope_new (FACTORY, CHANNELS, WIDTH, HEIGHT);
+  if (!pipeline || !scope) {
+    return 1;
+  }
+
+  // Put the multiscope between "in" and "sink".
+  GstElement* in = gst_bin_get_by_name (GST_BIN (pipeline), "in");
+  GstElement* sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  gst_element_unlink (in, sink);
+  gst_bin_add (GST_BIN (pipeline), scope);
+  if (!gst_element_link_many (in, scope, sink, NULL)) {
+    return 1;
+  }
+  gst_object_unref (in);
+  gst_object_unref (sink);
+
+  gint64 cpu = process_cpu_us ();
+  gint64 start = g_get_monotonic_time ();
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  GstBus* bus = gst_element_get_bus (pipeline);
+  GstMessage* msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  gboolean ok = GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS;
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+
+  gint64 elapsed = g_get_monotonic_time () - start;
+  cpu = process_cpu_us () - cpu;
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+  if (!ok) {
+    return 1;
+  }
+
+  g_print ("%f %f\n", elapsed / 1e6, cpu / 1e6);
+  return 0;
+}
+
+int
+main (int argc, char** argv)
+{
+  if (argc > 2 && !g_strcmp0 (argv[1], "--child")) {
+    return run_child (atoi (argv[2]), argc, argv);
+  }
+
+  cpu_set_t allowed;
+  sched_getaffinity (0, sizeof allowed, &allowed);
+  gint available = CPU_COUNT (&allowed);
+
+  g_print ("%d channels of %s in %dx%d, %d s of audio, %d CPUs available\n",
+      CHANNELS, FACTORY, WIDTH, HEIGHT, AUDIO_SECONDS, available);
+
+  gdouble one_core = 0;
+  for (gint cores = 1; cores <= MIN (MAX_CORES, available); cores *= 2) {
+    gchar* count = g_strdup_printf ("%d", cores);
+    gchar* child_argv[] = { argv[0], "--child", count, NULL };
+    gchar* out = NULL;
+    gint status = 0;
+    gdouble wall, cpu;
+
+    gboolean spawned = g_spawn_sync (NULL, child_argv, NULL,
+        G_SPAWN_SEARCH_PATH, NULL, NULL, &out, NULL, &status, NULL);
+    g_free (count);
+
+    if (!spawned || !g_spawn_check_exit_status (status, NULL) ||
+        sscanf (out, "%lf %lf", &wall, &cpu) != 2) {
+      g_print ("%2d cores: failed\n", cores);
+      g_free (out);
+      continue;
+    }
+    g_free (out);
+
+    gdouble speed = AUDIO_SECONDS / wall;
+    if (cores == 1) {
+      one_core = speed;
+    }
+    gdouble speedup = one_core > 0 ? speed / one_core : 0;
+    g_print ("%2d cores: %6.2fx real time, speedup %5.2f, efficiency %3.0f%%, "
+        "cores %3.0f%% busy\n", cores, speed, speedup,
+        100 * speedup / cores, 100 * cpu / wall / cores);
+  }
+
+  return 0;
+}
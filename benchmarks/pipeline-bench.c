@@ -0,0 +1,344 @@
+/*
+clear && gcc -O2 -march=native pipeline-bench.c ../visualizers/protoscope.c ../visualizers/protospectrum.c -o pipeline-bench `pkg-config --cflags --libs gstreamer-1.0 gstreamer-base-1.0 gstreamer-pbutils-1.0 gstreamer-fft-1.0` -lm && ./pipeline-bench > results.json
+*/
+
+/* Headless benchmark of the visualizer pipeline of p1-2.c:
+ *
+ *   src -> q1 -> audioconvert -> <scope> -> capsfilter -> videoconvert -> q2
+ *       -> fakesink
+ *
+ * with audiotestsrc (or a decoded file, --input) in place of jackaudiosrc and
+ * a fakesink in place of gtksink, so it runs without a display or a JACK
+ * server. The pipeline runs as fast as it can (sync=false), or in real time
+ * with --live, like p1-2.c with its live source. With --live, q1 also leaks
+ * downstream, as it always does in p1-2.c.
+ *
+ * --budget-ms N configures q1 and q2 the way p1-2.c does when built with
+ * -DLATENCY_BUDGET_MS=N (see ../latency-budget.h), and adds the number of
+ * buffers each dropped. Compare --live runs with and without it to see what
+ * a budget costs in dropped frames and buys in latency.
+ *
+ * For each visualizer and each size in @sizes it reports, as one JSON
+ * document on stdout:
+ *
+ *   fps        - frames that reached the sink per wall clock second.
+ *   elements   - the time spent in each element's chain function, not
+ *                counting the elements it pushed into in the same thread.
+ *   latency_ms - p50/p99/max from the audio leaving q1 to the scope output,
+ *                from there to the sink, and in total, as measured by
+ *                ../latency.h.
+ *
+ * Progress and errors go to stderr.
+ */
+
+#include <gst/gst.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../visualizers/protoscope.h"
+
+// Keep every frame of a run in the latency stats.
+#define LATENCY_WINDOW (1 << 16)
+#include "../latency.h"
+#include "../latency-budget.h"
+
+#define SAMPLE_RATE 44100
+#define SAMPLES_PER_BUFFER 1024
+#define FRAMERATE 60
+
+static const gchar* stock_scopes[] = {
+  "spacescope", "spectrascope", "synaescope", "wavescope",
+};
+
+static const gchar* proto_scopes[] = {
+  "protospacescope", "protospectrascope", "protosynaescope", "protowavescope",
+};
+
+static const gint sizes[][2] = {
+  { 640, 480 },
+  { 800, 600 },
+  { 1280, 720 },
+  { 1920, 1080 },
+};
+
+// The timed elements, from upstream to downstream. Each one but the queues
+// calls the next one's chain function from its own.
+static const gchar* element_names[] = {
+  "q1", "conv_before", "scope", "scope_filter", "conv_after", "q2", "sink",
+};
+
+static gchar* input;
+static gint seconds = 10;
+static gboolean with_proto;
+static gboolean live;
+static gint budget_ms;
+
+static GOptionEntry entries[] = {
+  { "input", 'i', 0, G_OPTION_ARG_FILENAME, &input,
+    "Decode audio from FILE instead of audiotestsrc", "FILE" },
+  { "seconds", 's', 0, G_OPTION_ARG_INT, &seconds,
+    "Seconds of test audio per run (default 10)", "N" },
+  { "proto", 'p', 0, G_OPTION_ARG_NONE, &with_proto,
+    "Also run the in-tree visualizers", NULL },
+  { "live", 'l', 0, G_OPTION_ARG_NONE, &live,
+    "Run in real time with a live test source and a synchronizing sink",
+    NULL },
+  { "budget-ms", 'b', 0, G_OPTION_ARG_INT, &budget_ms,
+    "Configure the queues for a latency budget of N ms", "N" },
+  { NULL }
+};
+
+static gint64
+now_ns (void)
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (gint64) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Wraps the chain function of a sink pad to add up the time spent in it. */
+typedef struct
+{
+  GstPadChainFunction chain;
+
+  // Time spent in @chain, including everything it pushed downstream in the
+  // same thread. Only the thread pushing into the pad writes it.
+  gint64 ns;
+} ChainTimer;
+
+static GQuark timer_quark;
+
+static GstFlowReturn
+timed_chain (GstPad* pad, GstObject* parent, GstBuffer* buffer)
+{
+  ChainTimer* timer = g_object_get_qdata (G_OBJECT (pad), timer_quark);
+  gint64 start = now_ns ();
+  GstFlowReturn ret = timer->chain (pad, parent, buffer);
+  timer->ns += now_ns () - start;
+  return ret;
+}
+
+static ChainTimer*
+time_chain (GstElement* element)
+{
+  GstPad* pad = gst_element_get_static_pad (element, "sink");
+  ChainTimer* timer = g_new0 (ChainTimer, 1);
+
+  timer->chain = GST_PAD_CHAINFUNC (pad);
+  g_object_set_qdata_full (G_OBJECT (pad), timer_quark, timer, g_free);
+  gst_pad_set_chain_function (pad, timed_chain);
+  gst_object_unref (pad);
+  return timer;
+}
+
+static GstPadProbeReturn
+count_frame_cb (GstPad* pad, GstPadProbeInfo* info, gint* frames)
+{
+  ++*frames;
+  return GST_PAD_PROBE_OK;
+}
+
+static GstElement*
+make_pipeline (const gchar* scope, gint width, gint height, GError** err)
+{
+  gchar* src;
+
+  if (input) {
+    gchar* location = g_strescape (input, NULL);
+    src = g_strdup_printf ("filesrc location=\"%s\" ! decodebin ! "
+        "audioconvert ! audioresample", location);
+    g_free (location);
+  } else {
+    src = g_strdup_printf ("audiotestsrc num-buffers=%d samplesperbuffer=%d "
+        "wave=pink-noise is-live=%s", seconds * SAMPLE_RATE / SAMPLES_PER_BUFFER,
+        SAMPLES_PER_BUFFER, live ? "true" : "false");
+  }
+
+  gchar* desc = g_strdup_printf ("%s ! audio/x-raw,rate=%d,channels=2 ! "
+      "queue name=q1 leaky=%s ! audioconvert name=conv_before ! "
+      "%s name=scope ! capsfilter name=scope_filter "
+      "caps=video/x-raw,width=%d,height=%d,framerate=%d/1 ! "
+      "videoconvert name=conv_after ! queue name=q2 ! "
+      "fakesink name=sink sync=%s",
+      src, SAMPLE_RATE, live ? "downstream" : "no", scope, width, height,
+      FRAMERATE, live ? "true" : "false");
+  GstElement* pipeline = gst_parse_launch (desc, err);
+
+  g_free (desc);
+  g_free (src);
+  return pipeline;
+}
+
+/* Run @scope at @width x @height and print its JSON object. Returns FALSE if
+ * the run failed; nothing is printed then.
+ */
+static gboolean
+run_one (const gchar* scope, gint width, gint height, gboolean first)
+{
+  GError* err = NULL;
+  GstElement* pipeline = make_pipeline (scope, width, height, &err);
+
+  if (!pipeline) {
+    g_printerr ("%s: %s\n", scope, err->message);
+    g_clear_error (&err);
+    return FALSE;
+  }
+
+  gint frames = 0;
+  ChainTimer* timers[G_N_ELEMENTS (element_names)];
+  for (guint i = 0; i < G_N_ELEMENTS (element_names); ++i) {
+    GstElement* element = gst_bin_get_by_name (GST_BIN (pipeline),
+        element_names[i]);
+    timers[i] = time_chain (element);
+    gst_object_unref (element);
+  }
+
+  GstElement* q1 = gst_bin_get_by_name (GST_BIN (pipeline), "q1");
+  GstElement* scope_filter = gst_bin_get_by_name (GST_BIN (pipeline),
+      "scope_filter");
+  GstElement* sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  GstPad* audio_pad = gst_element_get_static_pad (q1, "src");
+  GstPad* scope_pad = gst_element_get_static_pad (scope_filter, "sink");
+  GstPad* sink_pad = gst_element_get_static_pad (sink, "sink");
+
+  LatencyProbe* latency = latency_probe_new (audio_pad, scope_pad, sink_pad);
+  gst_pad_add_probe (sink_pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) count_frame_cb, &frames, NULL);
+
+  LatencyBudgetQueue q1_counts, q2_counts;
+  if (budget_ms > 0) {
+    GstElement* q2 = gst_bin_get_by_name (GST_BIN (pipeline), "q2");
+    latency_budget_apply (q1, q2, budget_ms, &q1_counts, &q2_counts);
+    gst_object_unref (q2);
+  }
+
+  gst_object_unref (sink_pad);
+  gst_object_unref (scope_pad);
+  gst_object_unref (audio_pad);
+  gst_object_unref (sink);
+  gst_object_unref (scope_filter);
+  gst_object_unref (q1);
+
+  g_printerr ("%s %dx%d...\n", scope, width, height);
+
+  gint64 wall = now_ns ();
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  GstBus* bus = gst_element_get_bus (pipeline);
+  GstMessage* msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  wall = now_ns () - wall;
+
+  gboolean ok = GST_MESSAGE_TYPE (msg) != GST_MESSAGE_ERROR;
+  if (!ok) {
+    gchar* dbg = NULL;
+    gst_message_parse_error (msg, &err, &dbg);
+    g_printerr ("%s: %s\n", scope, err->message);
+    g_clear_error (&err);
+    g_free (dbg);
+  }
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+
+  // Going to NULL flushes the queues, so count the drops before that.
+  gint q1_drops = 0, q2_drops = 0;
+  if (budget_ms > 0) {
+    q1_drops = latency_budget_drops (&q1_counts);
+    q2_drops = latency_budget_drops (&q2_counts);
+  }
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+
+  if (ok) {
+    g_print ("%s    {\n", first ? "" : ",\n");
+    g_print ("      \"scope\": \"%s\", \"width\": %d, \"height\": %d,\n",
+        scope, width, height);
+    g_print ("      \"frames\": %d, \"seconds\": %.3f, \"fps\": %.1f,\n",
+        frames, wall / 1e9, frames * 1e9 / wall);
+
+    g_print ("      \"elements\": {");
+    for (guint i = 0; i < G_N_ELEMENTS (element_names); ++i) {
+      // Queues hand buffers to another thread, everything else calls into
+      // the next element.
+      gboolean queue = g_str_has_prefix (element_names[i], "q");
+      gint64 self_ns = timers[i]->ns;
+      if (!queue && i + 1 < G_N_ELEMENTS (element_names)) {
+        self_ns -= timers[i + 1]->ns;
+      }
+      g_print ("%s\n        \"%s\": { \"ms\": %.3f, \"us_per_frame\": %.2f }",
+          i ? "," : "", element_names[i], self_ns / 1e6,
+          frames ? self_ns / 1e3 / frames : 0.0);
+    }
+    g_print ("\n      },\n");
+
+    if (budget_ms > 0) {
+      g_print ("      \"drops\": { \"q1\": %d, \"q2\": %d },\n", q1_drops,
+          q2_drops);
+    }
+
+    g_print ("      \"latency_ms\": {");
+    for (guint i = 0; i < LATENCY_N_SEGMENTS; ++i) {
+      LatencyStats stats;
+      g_print ("%s\n        \"%s\": ", i ? "," : "", latency_segment_names[i]);
+      if (latency_probe_get_stats (latency, i, &stats)) {
+        g_print ("{ \"p50\": %.3f, \"p99\": %.3f, \"max\": %.3f }",
+            stats.p50_ms, stats.p99_ms, stats.max_ms);
+      } else {
+        g_print ("null");
+      }
+    }
+    g_print ("\n      }\n    }");
+  }
+
+  gst_object_unref (pipeline);
+  latency_probe_free (latency);
+  return ok;
+}
+
+int main(int argc, char *argv[]) {
+  GError* err = NULL;
+  GOptionContext* context = g_option_context_new ("- headless visualizer "
+      "pipeline benchmark");
+  g_option_context_add_main_entries (context, entries, NULL);
+  g_option_context_add_group (context, gst_init_get_option_group ());
+  if (!g_option_context_parse (context, &argc, &argv, &err)) {
+    g_printerr ("%s\n", err->message);
+    return -1;
+  }
+  g_option_context_free (context);
+
+  if (with_proto && !proto_scope_register ()) {
+    g_printerr ("Could not register the in-tree scopes.\n");
+    return -1;
+  }
+
+  timer_quark = g_quark_from_static_string ("pipeline-bench-chain-timer");
+
+  g_print ("{\n  \"input\": ");
+  if (input) {
+    gchar* escaped = g_strescape (input, NULL);
+    g_print ("\"%s\"", escaped);
+    g_free (escaped);
+  } else {
+    g_print ("\"audiotestsrc\", \"seconds_of_audio\": %d", seconds);
+  }
+  g_print (",\n  \"live\": %s, \"budget_ms\": %d,", live ? "true" : "false",
+      budget_ms);
+  g_print ("\n  \"sample_rate\": %d, \"framerate\": %d,\n  \"results\": [\n",
+      SAMPLE_RATE, FRAMERATE);
+
+  gboolean first = TRUE;
+  for (guint s = 0; s < G_N_ELEMENTS (sizes); ++s) {
+    for (guint i = 0; i < G_N_ELEMENTS (stock_scopes); ++i) {
+      if (run_one (stock_scopes[i], sizes[s][0], sizes[s][1], first)) {
+        first = FALSE;
+      }
+      if (with_proto &&
+          run_one (proto_scopes[i], sizes[s][0], sizes[s][1], first)) {
+        first = FALSE;
+      }
+    }
+  }
+
+  g_print ("\n  ]\n}\n");
+  return 0;
+}
@@ -0,0 +1,343 @@
+/*
+clear && gcc -O2 producer-bench.c -o producer-bench `pkg-config --cflags --libs gstreamer-1.0 gstreamer-audio-1.0` && ./producer-bench
+*/
+
+/* How steadily appsrc is fed while the main loop is busy, with the two ways
+ * ../gstreamer-examples/basic-tutorial-8.c has fed it:
+ *
+ *   idle   - an idle source on the main loop, added by need-data and removed
+ *            by enough-data, pushing one chunk per call.
+ *   thread - the producer thread: one chunk per chunk duration by the
+ *            pipeline clock, PRODUCER_LEAD_MS ahead, gated by the lock-free
+ *            watermark flag.
+ *   fifo   - the producer thread with SCHED_FIFO priority FIFO_PRIORITY,
+ *            when allowed.
+ *
+ * Each runs for SECONDS into appsrc ! fakesink sync=true, once with an idle
+ * main loop and once with a busy one, where a timeout burns BUSY_MS of every
+ * BUSY_PERIOD_MS the way a heavy GTK redraw would (gtk_main runs the same
+ * default GMainContext). appsrc holds QUEUE_CHUNKS chunks, about what an
+ * application that cares about latency would allow.
+ *
+ * For every buffer it records, on the pipeline clock, how far ahead of its
+ * timestamp it was pushed, and how far ahead it reached the sink. It prints
+ *
+ *   push ahead - p50 and the p1-p99 spread (the jitter) of the push times
+ *                against the timestamps.
+ *   late       - buffers that reached the sink after their timestamp, so
+ *                a real audio sink would have played silence.
+ */
+
+#define _GNU_SOURCE
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SECONDS 5
+#define SAMPLE_RATE 44100
+#define CHUNK_SIZE 1024
+#define QUEUE_CHUNKS 4
+#define PRODUCER_LEAD_MS 20
+#define FIFO_PRIORITY 10
+#define BUSY_MS 40
+#define BUSY_PERIOD_MS 50
+
+#define CHUNK_SAMPLES (CHUNK_SIZE / 2)
+#define MAX_BUFFERS (SECONDS * SAMPLE_RATE / CHUNK_SAMPLES + 64)
+
+typedef enum
+{
+  MODE_IDLE,
+  MODE_THREAD,
+  MODE_FIFO,
+} Mode;
+
+static const gchar* const mode_names[] = { "idle", "thread", "fifo" };
+
+typedef struct _Run
+{
+  Mode mode;
+  GstElement* pipeline;
+  GstElement* appsrc;
+  GMainLoop* loop;
+
+  guint64 num_samples;
+  gfloat a, b;
+
+  guint sourceid;
+  gint feeding;
+  gint stopping;
+
+  // Nanoseconds each buffer was ahead of its timestamp when pushed and when
+  // it reached the sink.
+  gint64 push_ahead[MAX_BUFFERS];
+  gint64 sink_ahead[MAX_BUFFERS];
+  gint n_pushed;
+  gint n_sunk;
+} Run;
+
+/* Running time of the pipeline now, or -1 before it is playing. */
+static gint64
+running_time (GstElement* pipeline)
+{
+  GstClock* clock = gst_element_get_clock (pipeline);
+  if (!clock) {
+    return -1;
+  }
+  gint64 t = gst_clock_get_time (clock) - gst_element_get_base_time (pipeline);
+  gst_object_unref (clock);
+  return t;
+}
+
+static gboolean
+push_chunk (Run* run)
+{
+  if (run->n_pushed >= MAX_BUFFERS) {
+    return FALSE;
+  }
+
+  GstBuffer* buffer = gst_buffer_new_and_alloc (CHUNK_SIZE);
+  GstClockTime pts = gst_util_uint64_scale (run->num_samples, GST_SECOND,
+      SAMPLE_RATE);
+  GST_BUFFER_TIMESTAMP (buffer) = pts;
+  GST_BUFFER_DURATION (buffer) = gst_util_uint64_scale (CHUNK_SAMPLES,
+      GST_SECOND, SAMPLE_RATE);
+
+  GstMapInfo map;
+  gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+  gint16* raw = (gint16*) map.data;
+  for (gint i = 0; i < CHUNK_SAMPLES; i++) {
+    run->a += run->b;
+    run->b -= run->a / 1100;
+    raw[i] = (gint16) (500 * run->a);
+  }
+  gst_buffer_unmap (buffer, &map);
+  run->num_samples += CHUNK_SAMPLES;
+
+  gint64 now = running_time (run->pipeline);
+  run->push_ahead[run->n_pushed++] = now < 0 ? G_MAXINT64 : (gint64) pts - now;
+
+  GstFlowReturn ret;
+  g_signal_emit_by_name (run->appsrc, "push-buffer", buffer, &ret);
+  gst_buffer_unref (buffer);
+  return ret == GST_FLOW_OK;
+}
+
+static gboolean
+idle_push (Run* run)
+{
+  if (!push_chunk (run)) {
+    run->sourceid = 0;
+    return G_SOURCE_REMOVE;
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+/* The producer thread of basic-tutorial-8.c. */
+static gpointer
+producer_thread (Run* run)
+{
+  if (run->mode == MODE_FIFO) {
+    struct sched_param param = {.sched_priority = FIFO_PRIORITY };
+    pthread_setschedparam (pthread_self (), SCHED_FIFO, &param);
+  }
+
+  gulong chunk_us = (gulong) CHUNK_SAMPLES * G_USEC_PER_SEC / SAMPLE_RATE;
+  GstClockTime lead = PRODUCER_LEAD_MS * GST_MSECOND;
+
+  while (!g_atomic_int_get (&run->stopping)) {
+    if (!g_atomic_int_get (&run->feeding)) {
+      g_usleep (chunk_us);
+      continue;
+    }
+
+    GstClock* clock = gst_element_get_clock (run->pipeline);
+    if (clock) {
+      GstClockTime pts = gst_util_uint64_scale (run->num_samples, GST_SECOND,
+          SAMPLE_RATE);
+      GstClockID id = gst_clock_new_single_shot_id (clock,
+          gst_element_get_base_time (run->pipeline) +
+          (pts > lead ? pts - lead : 0));
+      gst_clock_id_wait (id, NULL);
+      gst_clock_id_unref (id);
+      gst_object_unref (clock);
+    }
+
+    if (!push_chunk (run)) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+static void
+need_data_cb (GstElement* appsrc, guint size, Run* run)
+{
+  if (run->mode != MODE_IDLE) {
+    g_atomic_int_set (&run->feeding, TRUE);
+  } else if (!run->sourceid) {
+    // need-data comes from the streaming thread, so the idle source is added
+    // to the main loop from there, as in the tutorial.
+    run->sourceid = g_idle_add ((GSourceFunc) idle_push, run);
+  }
+}
+
+static void
+enough_data_cb (GstElement* appsrc, Run* run)
+{
+  if (run->mode != MODE_IDLE) {
+    g_atomic_int_set (&run->feeding, FALSE);
+  } else if (run->sourceid) {
+    g_source_remove (run->sourceid);
+    run->sourceid = 0;
+  }
+}
+
+static GstPadProbeReturn
+sink_probe_cb (GstPad* pad, GstPadProbeInfo* info, Run* run)
+{
+  GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  gint64 now = running_time (run->pipeline);
+
+  if (run->n_sunk < MAX_BUFFERS && now >= 0) {
+    run->sink_ahead[run->n_sunk++] = (gint64) GST_BUFFER_PTS (buffer) - now;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+static gboolean
+busy_cb (gpointer user_data)
+{
+  gint64 end = g_get_monotonic_time () + BUSY_MS * 1000;
+  while (g_get_monotonic_time () < end) {
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+quit_cb (GMainLoop* loop)
+{
+  g_main_loop_quit (loop);
+  return G_SOURCE_REMOVE;
+}
+
+static gint
+compare_gint64 (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64*) a, y = *(const gint64*) b;
+  return x < y ? -1 : x > y;
+}
+
+static void
+run_mode (Mode mode, gboolean busy)
+{
+  Run* run = g_new0 (Run, 1);
+  run->mode = mode;
+  run->b = 1;
+
+  run->pipeline = gst_parse_launch ("appsrc name=src ! fakesink name=sink "
+      "sync=true enable-last-sample=false", NULL);
+  run->appsrc = gst_bin_get_by_name (GST_BIN (run->pipeline), "src");
+
+  GstAudioInfo info;
+  gst_audio_info_set_format (&info, GST_AUDIO_FORMAT_S16, SAMPLE_RATE, 1,
+      NULL);
+  GstCaps* caps = gst_audio_info_to_caps (&info);
+  g_object_set (run->appsrc, "caps", caps, "format", GST_FORMAT_TIME,
+      "max-bytes", (guint64) QUEUE_CHUNKS * CHUNK_SIZE, NULL);
+  gst_caps_unref (caps);
+  g_signal_connect (run->appsrc, "need-data", G_CALLBACK (need_data_cb), run);
+  g_signal_connect (run->appsrc, "enough-data", G_CALLBACK (enough_data_cb),
+      run);
+
+  GstElement* sink = gst_bin_get_by_name (GST_BIN (run->pipeline), "sink");
+  GstPad* pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) sink_probe_cb, run, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (sink);
+
+  GThread* thread = NULL;
+  if (mode != MODE_IDLE) {
+    thread = g_thread_new ("producer", (GThreadFunc) producer_thread, run);
+  }
+
+  run->loop = g_main_loop_new (NULL, FALSE);
+  guint busy_id = busy ? g_timeout_add (BUSY_PERIOD_MS, busy_cb, NULL) : 0;
+  g_timeout_add_seconds (SECONDS, (GSourceFunc) quit_cb, run->loop);
+
+  gst_element_set_state (run->pipeline, GST_STATE_PLAYING);
+  g_main_loop_run (run->loop);
+
+  g_atomic_int_set (&run->stopping, TRUE);
+  if (thread) {
+    g_thread_join (thread);
+  }
+  if (busy_id) {
+    g_source_remove (busy_id);
+  }
+  if (run->sourceid) {
+    g_source_remove (run->sourceid);
+  }
+  gst_element_set_state (run->pipeline, GST_STATE_NULL);
+
+  // Buffers pushed before the pipeline was playing have no push time.
+  gint n = 0;
+  for (gint i = 0; i < run->n_pushed; ++i) {
+    if (run->push_ahead[i] != G_MAXINT64) {
+      run->push_ahead[n++] = run->push_ahead[i];
+    }
+  }
+  gint late = 0;
+  for (gint i = 0; i < run->n_sunk; ++i) {
+    late += run->sink_ahead[i] < 0;
+  }
+
+  qsort (run->push_ahead, n, sizeof (gint64), compare_gint64);
+  if (n > 0) {
+    g_print ("%-6s %s main loop: %4d buffers, push ahead p50 %6.2f ms, "
+        "jitter (p1-p99) %6.2f ms, %4d late at the sink\n", mode_names[mode],
+        busy ? "busy" : "idle", n, run->push_ahead[n / 2] / 1e6,
+        (run->push_ahead[n * 99 / 100] - run->push_ahead[n / 100]) / 1e6,
+        late);
+  } else {
+    g_print ("%-6s %s main loop: nothing pushed while playing\n",
+        mode_names[mode], busy ? "busy" : "idle");
+  }
+
+  g_main_loop_unref (run->loop);
+  gst_object_unref (run->appsrc);
+  gst_object_unref (run->pipeline);
+  g_free (run);
+}
+
+int
+main (int argc, char** argv)
+{
+  gst_init (&argc, &argv);
+
+  struct sched_param param = {.sched_priority = FIFO_PRIORITY };
+  gboolean fifo = pthread_setschedparam (pthread_self (), SCHED_FIFO,
+      &param) == 0;
+  if (fifo) {
+    // Only checking; the main thread goes back to normal scheduling.
+    param.sched_priority = 0;
+    pthread_setschedparam (pthread_self (), SCHED_OTHER, &param);
+  } else {
+    g_print ("SCHED_FIFO not allowed, skipping the fifo runs\n");
+  }
+
+  for (gint busy = 0; busy <= 1; ++busy) {
+    for (Mode mode = MODE_IDLE; mode <= MODE_FIFO; ++mode) {
+      if (mode == MODE_FIFO && !fifo) {
+        continue;
+      }
+      run_mode (mode, busy);
+    }
+  }
+
+  return 0;
+}
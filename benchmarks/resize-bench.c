@@ -0,0 +1,219 @@
+/*
+clear && gcc -O2 resize-bench.c -o resize-bench `pkg-config --cflags --libs gstreamer-1.0` && ./resize-bench
+*/
+
+/* CPU cost of rendering the visualizers at the size of the window, as p1-2.c
+ * now does, and of renegotiating that size while the window is resized.
+ *
+ * First each stock visualizer renders live audio in real time,
+ *
+ *   audiotestsrc is-live=true ! audioconvert ! <scope>
+ *       ! video/x-raw,width=W,height=H,framerate=60/1 ! videoconvert
+ *       ! fakesink sync=true
+ *
+ * for SECONDS at each size in sizes[], and once at the size the element
+ * picks by itself (what p1-2.c rendered before). It prints the process CPU
+ * time as a percentage of one core, and the frames per second that reached
+ * the sink.
+ *
+ * Then a drag-resize from 800x600 to 1600x1200 is replayed on wavescope:
+ * DRAG_STEPS sizes, one per 60 Hz frame. Without debouncing every step
+ * renegotiates; with it only the last does, DEBOUNCE_MS after the drag
+ * stops. It prints the renegotiations the sink saw and the CPU time over the
+ * whole run.
+ */
+
+#include <gst/gst.h>
+
+#include "../cputime.h"
+
+#define SECONDS 3
+#define DRAG_STEPS 60
+#define DEBOUNCE_MS 200
+
+static const gchar* const scopes[] = {
+  "spacescope", "spectrascope", "synaescope", "wavescope",
+};
+
+// Sizes in device pixels; the last three are what a HiDPI (scale 2) screen
+// asks for at 960x540, 1280x720 and 1920x1080.
+static const gint sizes[][2] = {
+  { 320, 240 }, { 800, 600 }, { 1280, 720 }, { 1920, 1080 },
+  { 2560, 1440 }, { 3840, 2160 },
+};
+
+static gint frames;
+static gint negotiations;
+
+static GstPadProbeReturn
+sink_probe_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+    g_atomic_int_inc (&frames);
+  } else if (GST_EVENT_TYPE (GST_PAD_PROBE_INFO_EVENT (info)) ==
+      GST_EVENT_CAPS) {
+    g_atomic_int_inc (&negotiations);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* Renders into a W x H capsfilter named "size", or at the scope's own size
+ * if @width is 0. Returns the pipeline, PLAYING, or NULL.
+ */
+static GstElement*
+start (const gchar* scope, gint width, gint height)
+{
+  gchar* description = g_strdup_printf ("audiotestsrc is-live=true ! "
+      "audioconvert ! %s ! capsfilter name=size ! videoconvert ! "
+      "fakesink name=sink sync=true enable-last-sample=false", scope);
+  GstElement* pipeline = gst_parse_launch (description, NULL);
+  g_free (description);
+  if (!pipeline) {
+    return NULL;
+  }
+
+  GstCaps* caps = gst_caps_new_simple ("video/x-raw", "framerate",
+      GST_TYPE_FRACTION, 60, 1, NULL);
+  if (width > 0) {
+    gst_caps_set_simple (caps, "width", G_TYPE_INT, width, "height",
+        G_TYPE_INT, height, NULL);
+  }
+  GstElement* filter = gst_bin_get_by_name (GST_BIN (pipeline), "size");
+  g_object_set (filter, "caps", caps, NULL);
+  gst_object_unref (filter);
+  gst_caps_unref (caps);
+
+  GstElement* sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  GstPad* pad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER |
+      GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, sink_probe_cb, NULL, NULL);
+  gst_object_unref (pad);
+  gst_object_unref (sink);
+
+  if (gst_element_set_state (pipeline, GST_STATE_PLAYING) ==
+      GST_STATE_CHANGE_FAILURE) {
+    gst_object_unref (pipeline);
+    return NULL;
+  }
+  // Leave startup and the first negotiation out of the measurement.
+  g_usleep (G_USEC_PER_SEC / 2);
+  return pipeline;
+}
+
+static gboolean
+stop (GstElement* pipeline)
+{
+  GstBus* bus = gst_element_get_bus (pipeline);
+  GstMessage* error = gst_bus_pop_filtered (bus, GST_MESSAGE_ERROR);
+  gst_object_unref (bus);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+  if (error) {
+    gst_message_unref (error);
+    return FALSE;
+  }
+  return TRUE;
+}
+
+static void
+measure_size (const gchar* scope, gint width, gint height)
+{
+  GstElement* pipeline = start (scope, width, height);
+  if (!pipeline) {
+    g_print ("  %14s", "failed");
+    return;
+  }
+
+  gint first = g_atomic_int_get (&frames);
+  gint64 cpu = process_cpu_us ();
+  gint64 wall = g_get_monotonic_time ();
+  g_usleep (SECONDS * G_USEC_PER_SEC);
+  cpu = process_cpu_us () - cpu;
+  wall = g_get_monotonic_time () - wall;
+  gint shown = g_atomic_int_get (&frames) - first;
+
+  if (!stop (pipeline)) {
+    g_print ("  %14s", "error");
+    return;
+  }
+  g_print ("  %5.1f%% %3.0f fps", 100.0 * cpu / wall, shown * 1e6 / wall);
+}
+
+/* Replays the drag on wavescope, renegotiating every step or, if @debounce,
+ * only once it stopped.
+ */
+static void
+measure_drag (gboolean debounce)
+{
+  GstElement* pipeline = start ("wavescope", 800, 600);
+  if (!pipeline) {
+    g_print ("wavescope failed to start\n");
+    return;
+  }
+  GstElement* filter = gst_bin_get_by_name (GST_BIN (pipeline), "size");
+
+  gint before = g_atomic_int_get (&negotiations);
+  gint64 cpu = process_cpu_us ();
+  gint64 wall = g_get_monotonic_time ();
+
+  for (gint step = 1; step <= DRAG_STEPS; ++step) {
+    if (!debounce || step == DRAG_STEPS) {
+      if (debounce) {
+        g_usleep (DEBOUNCE_MS * 1000);
+      }
+      GstCaps* caps = gst_caps_new_simple ("video/x-raw",
+          "width", G_TYPE_INT, 800 + 800 * step / DRAG_STEPS,
+          "height", G_TYPE_INT, 600 + 600 * step / DRAG_STEPS,
+          "framerate", GST_TYPE_FRACTION, 60, 1, NULL);
+      g_object_set (filter, "caps", caps, NULL);
+      gst_caps_unref (caps);
+    }
+    g_usleep (G_USEC_PER_SEC / 60);
+  }
+  // Let the last size settle the same time in both runs.
+  g_usleep (debounce ? G_USEC_PER_SEC : G_USEC_PER_SEC + DEBOUNCE_MS * 1000);
+
+  cpu = process_cpu_us () - cpu;
+  wall = g_get_monotonic_time () - wall;
+  gint renegotiated = g_atomic_int_get (&negotiations) - before;
+
+  gst_object_unref (filter);
+  gboolean ok = stop (pipeline);
+  g_print ("  %-11s %2d renegotiations, %5.1f%% CPU over %.1f s%s\n",
+      debounce ? "debounced" : "every step", renegotiated,
+      100.0 * cpu / wall, wall / 1e6, ok ? "" : " (error)");
+}
+
+int
+main (int argc, char** argv)
+{
+  gst_init (&argc, &argv);
+
+  g_print ("Rendering live audio at 60 fps, CPU as %% of one core:\n"
+      "         ");
+  for (guint j = 0; j < G_N_ELEMENTS (scopes); ++j) {
+    g_print ("  %14s", scopes[j]);
+  }
+  g_print ("\n");
+  for (guint i = 0; i <= G_N_ELEMENTS (sizes); ++i) {
+    gint width = i < G_N_ELEMENTS (sizes) ? sizes[i][0] : 0;
+    gint height = i < G_N_ELEMENTS (sizes) ? sizes[i][1] : 0;
+
+    if (width > 0) {
+      g_print ("%4dx%-4d", width, height);
+    } else {
+      g_print ("own size ");
+    }
+    for (guint j = 0; j < G_N_ELEMENTS (scopes); ++j) {
+      measure_size (scopes[j], width, height);
+    }
+    g_print ("\n");
+  }
+
+  g_print ("Drag-resize 800x600 -> 1600x1200 in %d steps at 60 Hz:\n",
+      DRAG_STEPS);
+  measure_drag (FALSE);
+  measure_drag (TRUE);
+
+  return 0;
+}
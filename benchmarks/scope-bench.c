@@ -0,0 +1,118 @@
+/*
+clear && gcc -O2 -march=native scope-bench.c ../visualizers/protoscope.c ../visualizers/protospectrum.c -o scope-bench `pkg-config --cflags --libs gstreamer-1.0 gstreamer-base-1.0 gstreamer-pbutils-1.0 gstreamer-fft-1.0` -lm && ./scope-bench
+*/
+
+/* Compare the stock audiovisualizer elements with the in-tree ones from
+ * visualizers/protoscope.c. Each scope renders SECONDS_OF_AUDIO seconds of
+ * pink noise at FRAMERATE fps, as fast as it can, into a fakesink. The
+ * pipeline has no queues, so everything runs in one streaming thread and
+ * frames per CPU second is frames/sec per core.
+ */
+
+#include <gst/gst.h>
+
+#include "../cputime.h"
+#include "../visualizers/protoscope.h"
+
+#define SECONDS_OF_AUDIO 10
+#define SAMPLE_RATE 44100
+#define SAMPLES_PER_BUFFER 1024
+#define FRAMERATE 60
+
+static const gchar* scope_names[] = {
+  "spacescope", "protospacescope",
+  "spectrascope", "protospectrascope",
+  "synaescope", "protosynaescope",
+  "wavescope", "protowavescope",
+};
+
+static const gint sizes[][2] = {
+  { 800, 600 },
+  { 1920, 1080 },
+};
+
+static GstPadProbeReturn
+count_frame_cb (GstPad* pad, GstPadProbeInfo* info, gint* frames)
+{
+  ++*frames;
+  return GST_PAD_PROBE_OK;
+}
+
+/* Render through @scope at @width x @height and print one row of results. */
+static void
+run_one (const gchar* scope, gint width, gint height)
+{
+  GError* err = NULL;
+  gint frames = 0;
+
+  gchar* desc = g_strdup_printf ("audiotestsrc num-buffers=%d "
+      "samplesperbuffer=%d wave=pink-noise ! "
+      "audio/x-raw,rate=%d,channels=2 ! audioconvert ! %s ! "
+      "video/x-raw,width=%d,height=%d,framerate=%d/1 ! "
+      "fakesink name=sink sync=false",
+      SECONDS_OF_AUDIO * SAMPLE_RATE / SAMPLES_PER_BUFFER, SAMPLES_PER_BUFFER,
+      SAMPLE_RATE, scope, width, height, FRAMERATE);
+  GstElement* pipeline = gst_parse_launch (desc, &err);
+  g_free (desc);
+
+  if (!pipeline) {
+    g_printerr ("%s: %s\n", scope, err->message);
+    g_clear_error (&err);
+    return;
+  }
+
+  GstElement* sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  GstPad* sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) count_frame_cb, &frames, NULL);
+  gst_object_unref (sinkpad);
+  gst_object_unref (sink);
+
+  gint64 wall = g_get_monotonic_time ();
+  gint64 cpu = process_cpu_us ();
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  GstBus* bus = gst_element_get_bus (pipeline);
+  GstMessage* msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+  wall = g_get_monotonic_time () - wall;
+  cpu = process_cpu_us () - cpu;
+
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    gchar* dbg = NULL;
+    gst_message_parse_error (msg, &err, &dbg);
+    g_printerr ("%s: %s\n", scope, err->message);
+    g_clear_error (&err);
+    g_free (dbg);
+  } else {
+    g_print ("%-18s %4dx%-4d %6d %10.1f %10.1f\n", scope, width, height, frames,
+        frames * 1e6 / wall, cpu > 0 ? frames * 1e6 / cpu : 0.0);
+  }
+
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+}
+
+int main(int argc, char *argv[]) {
+  gst_init (&argc, &argv);
+
+  if (!proto_scope_register ()) {
+    g_printerr ("Could not register the in-tree scopes.\n");
+    return -1;
+  }
+
+  g_print ("%-18s %9s %6s %10s %10s\n", "scope", "size", "frames", "fps",
+      "fps/core");
+
+  for (guint s = 0; s < G_N_ELEMENTS (sizes); ++s) {
+    for (guint i = 0; i < G_N_ELEMENTS (scope_names); ++i) {
+      run_one (scope_names[i], sizes[s][0], sizes[s][1]);
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,210 @@
+/*
+clear && gcc -O2 shmring-bench.c -o shmring-bench `pkg-config --cflags --libs glib-2.0` && ./shmring-bench
+*/
+
+/* Throughput of the shared-memory ring in ../shmring.h, with one writer and
+ * 1 to MAX_READERS reader processes, for each slot size in @slot_sizes.
+ *
+ * The writer fills slots at a fixed rate for SECONDS, copying from a source
+ * buffer the way s0-0.c copies from a GstBuffer. Each reader is a separate
+ * process that maps the ring like s0-consumer.c and sums every byte of each
+ * slot in place, so it touches all of the data without copying it. Readers
+ * that fall behind lose slots, as they would in s0-0; the writer never waits
+ * for them.
+ *
+ * The rate starts at TARGET_MB_PER_S and doubles until a reader loses slots.
+ * Each run prints the rate the writer reached, and for each reader the rate of
+ * data it read and validated and the fraction of slots it lost. A setup meets
+ * the target if its first run loses nothing.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include "../shmring.h"
+
+#define RING_PATH "/dev/shm/gstproto-shmring-bench.ring"
+#define RING_SLOTS 256
+#define SECONDS 1
+#define MAX_READERS 4
+#define TARGET_MB_PER_S 100
+#define MAX_MB_PER_S 12800
+
+// A reader that has seen nothing new for this long assumes the writer is
+// done.
+#define IDLE_US (200 * 1000)
+
+static const guint32 slot_sizes[] = { 4096, 16384, 65536 };
+
+/* A reader process. Prints "<bytes> <seconds> <lapped> <torn> <checksum>". */
+static void
+reader (void)
+{
+  ShmRing* ring = shm_ring_open (RING_PATH);
+  if (!ring) {
+    _exit (1);
+  }
+
+  guint64 seq = shm_ring_head (ring);
+  guint64 bytes = 0, lapped = 0, sum = 0;
+  gint torn = 0;
+  gint64 first = 0, last = g_get_monotonic_time ();
+
+  for (;;) {
+    const ShmRingSlot* slot;
+    guint64 stamp;
+    ShmRingRead r = shm_ring_read_begin (ring, seq, &slot, &stamp);
+
+    if (r == SHM_RING_READ_OK) {
+      guint32 size = MIN (slot->size, ring->header->slot_size);
+      const guint64* words = (const guint64*) slot->data;
+      guint64 s = 0;
+      for (guint32 i = 0; i < size / 8; ++i) {
+        s += words[i];
+      }
+
+      if (shm_ring_read_end (ring, slot, stamp)) {
+        bytes += size;
+        sum += s;
+      } else {
+        torn++;
+      }
+      seq++;
+      last = g_get_monotonic_time ();
+      if (!first) {
+        first = last;
+      }
+    } else if (r == SHM_RING_READ_LAPPED) {
+      guint64 head = shm_ring_head (ring);
+      lapped += head - seq;
+      seq = head;
+      last = g_get_monotonic_time ();
+    } else if (g_get_monotonic_time () - last > IDLE_US) {
+      break;
+    }
+  }
+
+  printf ("%" G_GUINT64_FORMAT " %f %" G_GUINT64_FORMAT " %d %" G_GUINT64_FORMAT
+      "\n", bytes, first ? (last - first) / 1e6 : 0.0, lapped, torn, sum);
+  fflush (stdout);
+  shm_ring_close (ring);
+  _exit (0);
+}
+
+/* One run at @mb_per_s. Returns TRUE if no reader lost a slot. */
+static gboolean
+run (guint32 slot_size, gint n_readers, gint mb_per_s)
+{
+  ShmRing* ring = shm_ring_create (RING_PATH, RING_SLOTS, slot_size, 44100, 2,
+      2);
+  if (!ring) {
+    g_printerr ("Could not create %s: %s\n", RING_PATH, g_strerror (errno));
+    exit (1);
+  }
+
+  int fds[2];
+  if (pipe (fds) != 0) {
+    exit (1);
+  }
+
+  // The children must not inherit anything still buffered for stdout.
+  fflush (stdout);
+
+  pid_t pids[MAX_READERS];
+  for (gint i = 0; i < n_readers; ++i) {
+    pids[i] = fork ();
+    if (pids[i] == 0) {
+      close (fds[0]);
+      dup2 (fds[1], STDOUT_FILENO);
+      reader ();
+    }
+  }
+  close (fds[1]);
+
+  // Let the readers map the ring before anything is written.
+  g_usleep (100 * 1000);
+
+  guint8* source = g_malloc (slot_size);
+  for (guint32 i = 0; i < slot_size; ++i) {
+    source[i] = i;
+  }
+
+  // Write whenever the writer is behind schedule, and otherwise give the
+  // readers the CPU.
+  guint64 written = 0, slots = 0;
+  gint64 start = g_get_monotonic_time ();
+  gint64 end = start + SECONDS * G_USEC_PER_SEC;
+  gint64 now = start;
+  while (now < end) {
+    if (written < (guint64) mb_per_s * (now - start)) {
+      memcpy (shm_ring_write_begin (ring), source, slot_size);
+      shm_ring_write_commit (ring, slot_size, written);
+      written += slot_size;
+      slots++;
+    } else {
+      sched_yield ();
+    }
+    now = g_get_monotonic_time ();
+  }
+  gdouble write_mb_s = written / 1e6 / ((now - start) / 1e6);
+
+  g_print ("%6u byte slots, %d reader%s, %5d MB/s: wrote %8.1f MB/s\n",
+      slot_size, n_readers, n_readers == 1 ? " " : "s", mb_per_s, write_mb_s);
+
+  gboolean lossless = TRUE;
+
+  FILE* results = fdopen (fds[0], "r");
+  for (gint i = 0; i < n_readers; ++i) {
+    guint64 bytes, lapped, sum;
+    gdouble seconds;
+    gint torn;
+    if (fscanf (results, "%" G_GUINT64_FORMAT " %lf %" G_GUINT64_FORMAT
+            " %d %" G_GUINT64_FORMAT, &bytes, &seconds, &lapped, &torn,
+            &sum) != 5) {
+      g_print ("    reader %d: failed\n", i);
+      lossless = FALSE;
+      continue;
+    }
+    gdouble mb_s = seconds > 0 ? bytes / 1e6 / seconds : 0;
+    g_print ("    reader %d: read %8.1f MB/s, lost %.3f%% (%" G_GUINT64_FORMAT
+        " lapped, %d torn)\n", i, mb_s, 100.0 * (lapped + torn) / slots,
+        lapped, torn);
+    lossless = lossless && lapped + torn == 0;
+  }
+  fclose (results);
+
+  for (gint i = 0; i < n_readers; ++i) {
+    waitpid (pids[i], NULL, 0);
+  }
+
+  g_free (source);
+  shm_ring_close (ring);
+  return lossless;
+}
+
+int
+main (int argc, char** argv)
+{
+  g_print ("Target: %d MB/s per reader\n", TARGET_MB_PER_S);
+
+  for (guint s = 0; s < G_N_ELEMENTS (slot_sizes); ++s) {
+    for (gint n = 1; n <= MAX_READERS; n *= 2) {
+      gint rate = TARGET_MB_PER_S;
+      gboolean met = run (slot_sizes[s], n, rate);
+      while (met && rate < MAX_MB_PER_S && run (slot_sizes[s], n, rate * 2)) {
+        rate *= 2;
+      }
+      if (met) {
+        g_print ("  => lossless up to %d MB/s\n", rate);
+      } else {
+        g_print ("  => below the %d MB/s target\n", TARGET_MB_PER_S);
+      }
+    }
+  }
+
+  g_unlink (RING_PATH);
+  return 0;
+}
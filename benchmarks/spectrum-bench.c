@@ -0,0 +1,111 @@
+/*
+clear && gcc -O2 -march=native spectrum-bench.c ../visualizers/protospectrum.c -o spectrum-bench `pkg-config --cflags --libs gstreamer-1.0 gstreamer-base-1.0 gstreamer-audio-1.0 gstreamer-fft-1.0` -lm && ./spectrum-bench
+*/
+
+/* How much of one core protospectrum needs for a live 48 kHz stereo stream.
+ *
+ * SECONDS_OF_AUDIO seconds of F32 audio in jackaudiosrc-sized buffers (256
+ * samples) are pushed as fast as possible, once through a plain pipeline and
+ * once with protospectrum (2048-point windows, 75% overlap) in it. The extra
+ * CPU time divided by the length of the audio is the share of one core it
+ * would take in real time. The target is under 2%.
+ */
+
+#include <gst/gst.h>
+
+#include "../cputime.h"
+#include "../visualizers/protospectrum.h"
+
+#define SECONDS_OF_AUDIO 60
+#define SAMPLE_RATE 48000
+#define SAMPLES_PER_BUFFER 256
+
+static GstPadProbeReturn
+count_meta_cb (GstPad* pad, GstPadProbeInfo* info, gint* spectra)
+{
+  if (gst_buffer_get_proto_spectrum_meta (GST_PAD_PROBE_INFO_BUFFER (info))) {
+    ++*spectra;
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* Run the audio through @analysis (may be empty) and return the CPU time it
+ * took, in microseconds. */
+static gint64
+run_one (const gchar* analysis, gint* spectra)
+{
+  GError* err = NULL;
+
+  gchar* desc = g_strdup_printf ("audiotestsrc num-buffers=%d "
+      "samplesperbuffer=%d wave=pink-noise ! "
+      "audio/x-raw,format=F32LE,rate=%d,channels=2 ! %s "
+      "fakesink name=sink sync=false",
+      SECONDS_OF_AUDIO * SAMPLE_RATE / SAMPLES_PER_BUFFER, SAMPLES_PER_BUFFER,
+      SAMPLE_RATE, analysis);
+  GstElement* pipeline = gst_parse_launch (desc, &err);
+  g_free (desc);
+
+  if (!pipeline) {
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    return -1;
+  }
+
+  GstElement* sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  GstPad* sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) count_meta_cb, spectra, NULL);
+  gst_object_unref (sinkpad);
+  gst_object_unref (sink);
+
+  gint64 cpu = process_cpu_us ();
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  GstBus* bus = gst_element_get_bus (pipeline);
+  GstMessage* msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+  cpu = process_cpu_us () - cpu;
+
+  if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_ERROR) {
+    gchar* dbg = NULL;
+    gst_message_parse_error (msg, &err, &dbg);
+    g_printerr ("%s\n", err->message);
+    g_clear_error (&err);
+    g_free (dbg);
+    cpu = -1;
+  }
+
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+
+  return cpu;
+}
+
+int main(int argc, char *argv[]) {
+  gint spectra = 0, none = 0;
+
+  gst_init (&argc, &argv);
+  proto_spectrum_register ();
+
+  gint64 base = run_one ("", &none);
+  gint64 with = run_one ("protospectrum size=2048 overlap=0.75 !", &spectra);
+
+  if (base < 0 || with < 0) {
+    return -1;
+  }
+
+  gdouble share = 100.0 * (with - base) / (SECONDS_OF_AUDIO * 1e6);
+
+  g_print ("%d s of %d Hz stereo, 2048-point windows, 75%% overlap\n",
+      SECONDS_OF_AUDIO, SAMPLE_RATE);
+  g_print ("buffers with spectra: %d\n", spectra);
+  g_print ("CPU without analysis: %.1f ms\n", base / 1e3);
+  g_print ("CPU with analysis:    %.1f ms\n", with / 1e3);
+  g_print ("share of one core:    %.2f%% (target < 2%%)\n", share);
+
+  return 0;
+}
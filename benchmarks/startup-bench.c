@@ -0,0 +1,152 @@
+/*
+clear && gcc -O2 startup-bench.c -o startup-bench `pkg-config --cflags --libs gstreamer-1.0` && ./startup-bench
+*/
+
+/* Cold start time of a visualizer pipeline, with the normal plugin registry
+ * and with the fast startup mode of ../faststart.h (run fast-startup-setup
+ * from this directory first, or the fast runs are skipped).
+ *
+ * Every run is a fresh process, so gst_init pays for loading the registry each
+ * time. The child builds a headless version of the p1-2.c pipeline,
+ *
+ *   audiotestsrc -> audioconvert -> wavescope -> videoconvert -> fakesink
+ *
+ * and exits as soon as the first frame reaches the sink. It reports, from the
+ * start of main:
+ *
+ *   gst_init    - when gst_init returned.
+ *   first frame - when the first frame reached the sink.
+ *
+ * The parent adds the time from spawning the child to its exit, which also
+ * counts loading the program and its libraries. Runs after the first find
+ * the files in the page cache, as an application started again would.
+ */
+
+#include <gst/gst.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+
+#include "../faststart.h"
+
+#define RUNS 20
+
+static gint64 main_start_us;
+static gint64 first_frame_us;
+static GMainLoop* loop;
+
+static GstPadProbeReturn
+first_frame_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+  first_frame_us = g_get_monotonic_time ();
+  g_main_loop_quit (loop);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* The child process. Prints "<gst_init us> <first frame us>". */
+static int
+run_child (gboolean fast, int argc, char** argv)
+{
+  if (fast && !fast_startup_use ()) {
+    return 2;
+  }
+
+  gst_init (&argc, &argv);
+  gint64 init_us = g_get_monotonic_time ();
+
+  GstElement* pipeline = gst_parse_launch ("audiotestsrc ! audioconvert ! "
+      "wavescope ! videoconvert ! fakesink name=sink", NULL);
+  if (!pipeline) {
+    return 1;
+  }
+
+  GstElement* sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+  GstPad* sinkpad = gst_element_get_static_pad (sink, "sink");
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER, first_frame_cb, NULL,
+      NULL);
+  gst_object_unref (sinkpad);
+  gst_object_unref (sink);
+
+  loop = g_main_loop_new (NULL, FALSE);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+  g_main_loop_run (loop);
+
+  g_print ("%" G_GINT64_FORMAT " %" G_GINT64_FORMAT "\n",
+      init_us - main_start_us, first_frame_us - main_start_us);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+  g_main_loop_unref (loop);
+  return 0;
+}
+
+static gint
+compare_int64 (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64*) a, y = *(const gint64*) b;
+  return x < y ? -1 : x > y;
+}
+
+static void
+print_stat (const gchar* name, gint64* us, gint n)
+{
+  qsort (us, n, sizeof us[0], compare_int64);
+  g_print ("  %-14s median %7.2f ms, min %7.2f ms, max %7.2f ms\n", name,
+      us[n / 2] / 1e3, us[0] / 1e3, us[n - 1] / 1e3);
+}
+
+/* Run RUNS children in one mode and print the times. */
+static void
+run (const gchar* self, gboolean fast)
+{
+  gint64 init_us[RUNS], frame_us[RUNS], total_us[RUNS];
+  gint n = 0;
+
+  for (gint i = 0; i < RUNS; ++i) {
+    gchar* argv[] = { (gchar*) self, "--child", fast ? "--fast" : NULL, NULL };
+    gchar* out = NULL;
+    gint status = 0;
+
+    gint64 start = g_get_monotonic_time ();
+    gboolean spawned = g_spawn_sync (NULL, argv, NULL, G_SPAWN_SEARCH_PATH,
+        NULL, NULL, &out, NULL, &status, NULL);
+    gint64 total = g_get_monotonic_time () - start;
+
+    if (spawned && WIFEXITED (status) && WEXITSTATUS (status) == 2) {
+      g_print ("%s: fast startup isn't set up, run fast-startup-setup\n",
+          fast ? "fast" : "normal");
+      g_free (out);
+      return;
+    }
+    if (spawned && g_spawn_check_exit_status (status, NULL) &&
+        sscanf (out, "%" G_GINT64_FORMAT " %" G_GINT64_FORMAT, &init_us[n],
+            &frame_us[n]) == 2) {
+      total_us[n++] = total;
+    }
+    g_free (out);
+  }
+
+  if (!n) {
+    g_print ("%s: every run failed\n", fast ? "fast" : "normal");
+    return;
+  }
+
+  g_print ("%s registry, %d runs:\n", fast ? "fast" : "normal", n);
+  print_stat ("gst_init", init_us, n);
+  print_stat ("first frame", frame_us, n);
+  print_stat ("spawn to exit", total_us, n);
+}
+
+int
+main (int argc, char** argv)
+{
+  main_start_us = g_get_monotonic_time ();
+
+  if (argc > 1 && !g_strcmp0 (argv[1], "--child")) {
+    return run_child (argc > 2 && !g_strcmp0 (argv[2], "--fast"), argc, argv);
+  }
+
+  run (argv[0], FALSE);
+  run (argv[0], TRUE);
+  return 0;
+}
@@ -0,0 +1,146 @@
+/*
+clear && gcc -O3 synth-bench.c -o synth-bench `pkg-config --cflags --libs gstreamer-1.0 gstreamer-audio-1.0` -lm && ./synth-bench
+*/
+
+/* Speed of the synthetic source in ../synth.h.
+ *
+ * First each waveform is generated on its own, as interleaved S16 at
+ * SAMPLE_RATE, for 1 to 16 channels, and the speed is printed as a multiple
+ * of real time.
+ *
+ * Then it feeds a test pipeline the way a benchmark would,
+ *
+ *   appsrc (F32, n channels) ! audioconvert ! S16LE ! fakesink sync=false
+ *
+ * with AUDIO_SECONDS of sine pushed at SPEEDUP times real time: buffer i is
+ * pushed once SPEEDUP times less wall time than its timestamp has passed. It
+ * prints the speed reached and whether it kept up.
+ */
+
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+
+#include "../synth.h"
+
+#define SAMPLE_RATE 44100
+#define GENERATE_SECONDS 20
+#define AUDIO_SECONDS 30
+#define SPEEDUP 10
+#define CHUNK_FRAMES 1024
+
+static const guint channel_counts[] = { 1, 2, 8, 16 };
+
+static const gchar* const wave_names[] = {
+  "psychedelic", "sine", "square", "noise",
+};
+
+static gdouble
+generate (SynthWave wave, guint channels)
+{
+  Synth* synth = synth_new (wave, SAMPLE_RATE, channels);
+  gint16* samples = g_new (gint16, CHUNK_FRAMES * channels);
+
+  gint64 start = g_get_monotonic_time ();
+  for (gint n = 0; n < GENERATE_SECONDS * SAMPLE_RATE; n += CHUNK_FRAMES) {
+    synth_fill_s16 (synth, samples, CHUNK_FRAMES);
+  }
+  gint64 elapsed = g_get_monotonic_time () - start;
+
+  g_free (samples);
+  synth_free (synth);
+  return GENERATE_SECONDS * 1e6 / elapsed;
+}
+
+static void
+feed (guint channels)
+{
+  GstElement* pipeline = gst_parse_launch ("appsrc name=src block=true ! "
+      "audioconvert ! audio/x-raw,format=S16LE ! "
+      "fakesink sync=false enable-last-sample=false", NULL);
+  GstElement* appsrc = gst_bin_get_by_name (GST_BIN (pipeline), "src");
+  GstAudioInfo info;
+
+  gst_audio_info_set_format (&info, GST_AUDIO_FORMAT_F32, SAMPLE_RATE,
+      channels, NULL);
+  GstCaps* caps = gst_audio_info_to_caps (&info);
+  g_object_set (appsrc, "caps", caps, "format", GST_FORMAT_TIME, NULL);
+  gst_caps_unref (caps);
+
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  Synth* synth = synth_new (SYNTH_SINE, SAMPLE_RATE, channels);
+  gsize size = CHUNK_FRAMES * channels * sizeof (gfloat);
+  guint64 frames = 0;
+
+  gint64 start = g_get_monotonic_time ();
+  while (frames < (guint64) AUDIO_SECONDS * SAMPLE_RATE) {
+    GstClockTime pts = gst_util_uint64_scale (frames, GST_SECOND,
+        SAMPLE_RATE);
+
+    // Hold back while ahead of SPEEDUP times real time.
+    gint64 due = start + pts / GST_USECOND / SPEEDUP;
+    gint64 now = g_get_monotonic_time ();
+    if (now < due) {
+      g_usleep (due - now);
+    }
+
+    GstBuffer* buffer = gst_buffer_new_allocate (NULL, size, NULL);
+    GstMapInfo map;
+    gst_buffer_map (buffer, &map, GST_MAP_WRITE);
+    synth_fill_f32 (synth, (gfloat*) map.data, CHUNK_FRAMES);
+    gst_buffer_unmap (buffer, &map);
+    GST_BUFFER_PTS (buffer) = pts;
+    GST_BUFFER_DURATION (buffer) = gst_util_uint64_scale (CHUNK_FRAMES,
+        GST_SECOND, SAMPLE_RATE);
+
+    GstFlowReturn ret;
+    g_signal_emit_by_name (appsrc, "push-buffer", buffer, &ret);
+    gst_buffer_unref (buffer);
+    if (ret != GST_FLOW_OK) {
+      g_printerr ("push-buffer failed: %s\n", gst_flow_get_name (ret));
+      break;
+    }
+    frames += CHUNK_FRAMES;
+  }
+
+  // Time until the sink has everything.
+  g_signal_emit_by_name (appsrc, "end-of-stream", NULL);
+  GstBus* bus = gst_element_get_bus (pipeline);
+  gst_message_unref (gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+          GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+  gst_object_unref (bus);
+  gdouble seconds = (g_get_monotonic_time () - start) / 1e6;
+
+  gdouble speed = (gdouble) frames / SAMPLE_RATE / seconds;
+  g_print ("%2u channels: %.1fx real time, %s\n", channels, speed,
+      speed >= SPEEDUP * 0.99 ? "kept up" : "fell behind");
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (appsrc);
+  gst_object_unref (pipeline);
+  synth_free (synth);
+}
+
+int
+main (int argc, char** argv)
+{
+  gst_init (&argc, &argv);
+
+  g_print ("Generating S16 at %d Hz, times real time:\n", SAMPLE_RATE);
+  for (SynthWave wave = SYNTH_PSYCHEDELIC; wave <= SYNTH_NOISE; ++wave) {
+    g_print ("  %-12s", wave_names[wave]);
+    for (guint i = 0; i < G_N_ELEMENTS (channel_counts); ++i) {
+      g_print ("  %2u ch %7.0fx", channel_counts[i],
+          generate (wave, channel_counts[i]));
+    }
+    g_print ("\n");
+  }
+
+  g_print ("Feeding appsrc ! audioconvert ! fakesink at %dx real time:\n",
+      SPEEDUP);
+  for (guint i = 0; i < G_N_ELEMENTS (channel_counts); ++i) {
+    feed (channel_counts[i]);
+  }
+
+  return 0;
+}
@@ -0,0 +1,164 @@
+/*
+clear && gcc -O2 trace-bench.c ../tracers/prototrace.c -o trace-bench `pkg-config --cflags --libs gstreamer-1.0` && ./trace-bench
+*/
+
+/* Overhead of the prototrace tracer of ../tracers/prototrace.c, which must
+ * stay under 2%.
+ *
+ * Two pipelines run as fast as they will go, non-live, each in a fresh
+ * process with and without the tracer, REPEATS times in turn:
+ *
+ *   scope - roughly what p1-2.c does, over AUDIO_SECONDS of audio:
+ *             audiotestsrc ! audioconvert ! queue ! wavescope ! 800x600
+ *             ! videoconvert ! queue ! fakesink
+ *   chain - the worst case, pushes that do no work: CHAIN_BUFFERS small
+ *           buffers through CHAIN_LENGTH identity elements into a fakesink.
+ *
+ * For each it prints the median process CPU time of both, the overhead, and
+ * for the chain the tracer's cost per push.
+ */
+
+#include <gst/gst.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../cputime.h"
+#include "../tracers/prototrace.h"
+
+#define REPEATS 5
+#define AUDIO_SECONDS 20
+#define CHAIN_BUFFERS 200000
+#define CHAIN_LENGTH 8
+#define BUDGET_PERCENT 2.0
+
+static gchar*
+describe (const gchar* pipeline)
+{
+  if (!g_strcmp0 (pipeline, "scope")) {
+    return g_strdup_printf ("audiotestsrc num-buffers=%d samplesperbuffer=1024"
+        " ! audioconvert ! queue ! wavescope ! video/x-raw,width=800,"
+        "height=600,framerate=60/1 ! videoconvert ! queue ! "
+        "fakesink sync=false enable-last-sample=false",
+        AUDIO_SECONDS * 44100 / 1024);
+  }
+
+  GString* description = g_string_new (NULL);
+  g_string_append_printf (description, "fakesrc num-buffers=%d sizetype=fixed "
+      "sizemax=64", CHAIN_BUFFERS);
+  for (gint i = 0; i < CHAIN_LENGTH; ++i) {
+    g_string_append (description, " ! identity");
+  }
+  g_string_append (description, " ! fakesink sync=false "
+      "enable-last-sample=false");
+  return g_string_free (description, FALSE);
+}
+
+/* The child process. Prints the CPU seconds the run took. */
+static int
+run_child (const gchar* pipeline, gboolean traced, int argc, char** argv)
+{
+  gst_init (&argc, &argv);
+  if (traced) {
+    proto_trace_start ("/dev/null");
+  }
+
+  gchar* description = describe (pipeline);
+  GstElement* bin = gst_parse_launch (description, NULL);
+  g_free (description);
+  if (!bin) {
+    return 1;
+  }
+
+  gint64 cpu = process_cpu_us ();
+
+  gst_element_set_state (bin, GST_STATE_PLAYING);
+  GstBus* bus = gst_element_get_bus (bin);
+  GstMessage* msg = gst_bus_timed_pop_filtered (bus, GST_CLOCK_TIME_NONE,
+      GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+  gboolean ok = GST_MESSAGE_TYPE (msg) == GST_MESSAGE_EOS;
+  gst_message_unref (msg);
+  gst_object_unref (bus);
+
+  cpu = process_cpu_us () - cpu;
+  gst_element_set_state (bin, GST_STATE_NULL);
+  gst_object_unref (bin);
+  if (!ok) {
+    return 1;
+  }
+
+  // Outside the measurement, but the dump has to work too.
+  if (traced && !proto_trace_dump ("/dev/null")) {
+    return 1;
+  }
+
+  g_print ("%f\n", cpu / 1e6);
+  return 0;
+}
+
+static gdouble
+spawn (char* self, const gchar* pipeline, gboolean traced)
+{
+  gchar* child_argv[] = { self, "--child", (gchar*) pipeline,
+    traced ? "traced" : "plain", NULL };
+  gchar* out = NULL;
+  gint status = 0;
+  gdouble cpu = -1;
+
+  if (!g_spawn_sync (NULL, child_argv, NULL, G_SPAWN_SEARCH_PATH, NULL, NULL,
+          &out, NULL, &status, NULL) ||
+      !g_spawn_check_exit_status (status, NULL) ||
+      sscanf (out, "%lf", &cpu) != 1) {
+    cpu = -1;
+  }
+  g_free (out);
+  return cpu;
+}
+
+static gint
+compare_doubles (gconstpointer a, gconstpointer b)
+{
+  gdouble x = *(const gdouble*) a, y = *(const gdouble*) b;
+  return x < y ? -1 : x > y;
+}
+
+static void
+measure (char* self, const gchar* pipeline, guint64 pushes)
+{
+  gdouble plain[REPEATS], traced[REPEATS];
+
+  for (gint i = 0; i < REPEATS; ++i) {
+    plain[i] = spawn (self, pipeline, FALSE);
+    traced[i] = spawn (self, pipeline, TRUE);
+    if (plain[i] < 0 || traced[i] < 0) {
+      g_print ("%-5s failed\n", pipeline);
+      return;
+    }
+  }
+  qsort (plain, REPEATS, sizeof (gdouble), compare_doubles);
+  qsort (traced, REPEATS, sizeof (gdouble), compare_doubles);
+
+  gdouble base = plain[REPEATS / 2];
+  gdouble with = traced[REPEATS / 2];
+  gdouble overhead = 100 * (with - base) / base;
+  g_print ("%-5s %7.3f s CPU, traced %7.3f s: %+5.2f%% (%s)", pipeline, base,
+      with, overhead, overhead < BUDGET_PERCENT ? "within budget" : "OVER");
+  if (pushes > 0) {
+    g_print (", %.0f ns per push", (with - base) * 1e9 / pushes);
+  }
+  g_print ("\n");
+}
+
+int
+main (int argc, char** argv)
+{
+  if (argc > 3 && !g_strcmp0 (argv[1], "--child")) {
+    return run_child (argv[2], !g_strcmp0 (argv[3], "traced"), argc, argv);
+  }
+
+  g_print ("Median of %d runs each, budget %.0f%%:\n", REPEATS,
+      BUDGET_PERCENT);
+  measure (argv[0], "scope", 0);
+  measure (argv[0], "chain", (guint64) CHAIN_BUFFERS * (CHAIN_LENGTH + 1));
+
+  return 0;
+}
@@ -0,0 +1,185 @@
+/* Fixed-capacity single-producer/single-consumer command ring, used to hand
+ * typed commands from one thread (e.g. the GTK main thread) to the pipeline
+ * controller thread without allocating and without going through the GstBus.
+ *
+ * Pushing and popping are lock-free. A consumer that runs out of work sleeps
+ * on a CmdWaiter; the producer only takes the waiter's mutex when the consumer
+ * is actually asleep.
+ */
+
+#ifndef CMDRING_H
+#define CMDRING_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+// Number of slots. Must be a power of two.
+#define CMD_RING_CAPACITY 64
+
+typedef enum
+{
+  // Show visualizer @index.
+  CMD_SWITCH_VISUALIZER,
+
+  // Stop the controller and quit the application.
+  CMD_QUIT,
+
+  // Stop the controller only. Sent once the application is already quitting.
+  CMD_STOP,
+
+  // A visualizer swap finished. @element is the visualizer that was swapped
+  // out, if it is still to be taken down and out of the pipeline.
+  CMD_SWAP_DONE,
+
+  // The video widget changed size. Render @width x @height device pixels.
+  CMD_RESIZE,
+
+  // The frame-rate governor changed its mind. Render @fps frames per second.
+  CMD_SET_FRAMERATE,
+} CmdType;
+
+typedef struct _Cmd
+{
+  CmdType type;
+  gint index;
+  gpointer element;
+
+  // Render size and frame rate.
+  gint width;
+  gint height;
+  gint fps;
+
+  // g_get_monotonic_time () when the command was pushed, or any other
+  // timestamp the producer wants carried along.
+  gint64 sent_us;
+} Cmd;
+
+typedef struct _CmdRing
+{
+  Cmd slots[CMD_RING_CAPACITY];
+
+  // Free-running counters. @head is only written by the producer and @tail
+  // only by the consumer.
+  guint head;
+  guint tail;
+} CmdRing;
+
+/* Wakes a consumer that sleeps on one or more rings. */
+typedef struct _CmdWaiter
+{
+  GMutex lock;
+  GCond cond;
+  gint sleeping;
+} CmdWaiter;
+
+static inline void
+cmd_ring_init (CmdRing * ring)
+{
+  ring->head = 0;
+  ring->tail = 0;
+}
+
+/* Producer side. Copies @cmd into the ring. Returns FALSE if the ring is
+ * full, in which case the command is not queued.
+ */
+static inline gboolean
+cmd_ring_push (CmdRing * ring, const Cmd * cmd)
+{
+  guint head = ring->head;
+
+  if (head - (guint) g_atomic_int_get (&ring->tail) == CMD_RING_CAPACITY)
+    return FALSE;
+
+  ring->slots[head & (CMD_RING_CAPACITY - 1)] = *cmd;
+
+  // Publishes the slot.
+  g_atomic_int_set (&ring->head, head + 1);
+  return TRUE;
+}
+
+/* Consumer side. Copies the oldest command into @cmd. Returns FALSE if the
+ * ring is empty.
+ */
+static inline gboolean
+cmd_ring_pop (CmdRing * ring, Cmd * cmd)
+{
+  guint tail = ring->tail;
+
+  if ((guint) g_atomic_int_get (&ring->head) == tail)
+    return FALSE;
+
+  *cmd = ring->slots[tail & (CMD_RING_CAPACITY - 1)];
+
+  // Hands the slot back to the producer.
+  g_atomic_int_set (&ring->tail, tail + 1);
+  return TRUE;
+}
+
+static inline gboolean
+cmd_ring_is_empty (CmdRing * ring)
+{
+  return (guint) g_atomic_int_get (&ring->head) ==
+      (guint) g_atomic_int_get (&ring->tail);
+}
+
+static inline void
+cmd_waiter_init (CmdWaiter * waiter)
+{
+  g_mutex_init (&waiter->lock);
+  g_cond_init (&waiter->cond);
+  waiter->sleeping = 0;
+}
+
+static inline void
+cmd_waiter_clear (CmdWaiter * waiter)
+{
+  g_mutex_clear (&waiter->lock);
+  g_cond_clear (&waiter->cond);
+}
+
+/* Producer side, after cmd_ring_push. */
+static inline void
+cmd_waiter_wake (CmdWaiter * waiter)
+{
+  if (!g_atomic_int_get (&waiter->sleeping))
+    return;
+
+  g_mutex_lock (&waiter->lock);
+  g_cond_signal (&waiter->cond);
+  g_mutex_unlock (&waiter->lock);
+}
+
+/* Consumer side. Blocks until at least one of the @n_rings @rings has a
+ * command.
+ */
+static inline void
+cmd_waiter_wait (CmdWaiter * waiter, CmdRing * const *rings, guint n_rings)
+{
+  g_mutex_lock (&waiter->lock);
+
+  // Announce that we are about to sleep before the last look at the rings. A
+  // producer that pushes after this sees @sleeping and signals; one that
+  // pushed before is seen below.
+  g_atomic_int_set (&waiter->sleeping, 1);
+
+  for (;;) {
+    guint i;
+
+    for (i = 0; i < n_rings; i++) {
+      if (!cmd_ring_is_empty (rings[i]))
+        break;
+    }
+    if (i < n_rings)
+      break;
+
+    g_cond_wait (&waiter->cond, &waiter->lock);
+  }
+
+  g_atomic_int_set (&waiter->sleeping, 0);
+  g_mutex_unlock (&waiter->lock);
+}
+
+G_END_DECLS
+
+#endif /* CMDRING_H */
@@ -0,0 +1,25 @@
+/* Process CPU time, for the prototypes and benchmarks that report what
+ * something costs.
+ */
+
+#ifndef CPUTIME_H
+#define CPUTIME_H
+
+#include <glib.h>
+#include <sys/resource.h>
+
+G_BEGIN_DECLS
+
+/* Process CPU time (user + system, all threads), in microseconds. */
+static inline gint64
+process_cpu_us (void)
+{
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  return (gint64) (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) *
+      G_USEC_PER_SEC + usage.ru_utime.tv_usec + usage.ru_stime.tv_usec;
+}
+
+G_END_DECLS
+
+#endif /* CPUTIME_H */
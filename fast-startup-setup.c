@@ -0,0 +1,114 @@
+/*
+clear && gcc -g fast-startup-setup.c -o fast-startup-setup `pkg-config --cflags --libs gstreamer-1.0` && ./fast-startup-setup
+*/
+
+/* Prepares the fast startup mode of faststart.h, for the prototypes built
+ * with -DFAST_STARTUP. Run it from the directory the prototypes are started
+ * from, and again after installing or updating GStreamer plugins.
+ *
+ * It finds the plugin of each of @fast_startup_factories through the normal
+ * registry, links it into FAST_STARTUP_PLUGIN_DIR, and then builds
+ * FAST_STARTUP_REGISTRY in a child process that sees only that directory.
+ * Factories that aren't installed are skipped.
+ */
+
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+#include <unistd.h>
+
+#include "faststart.h"
+
+/* Link the plugin that provides @factory_name into the plugin directory.
+ * Returns FALSE if there is no such factory or it isn't in a plugin file.
+ */
+static gboolean
+link_plugin (const gchar* factory_name)
+{
+  GstElementFactory* factory = gst_element_factory_find (factory_name);
+  if (!factory) {
+    g_print ("  %-16s not installed, skipped\n", factory_name);
+    return FALSE;
+  }
+
+  GstPlugin* plugin = gst_plugin_feature_get_plugin (GST_PLUGIN_FEATURE (factory));
+  gst_object_unref (factory);
+  if (!plugin || !gst_plugin_get_filename (plugin)) {
+    g_print ("  %-16s built in, skipped\n", factory_name);
+    if (plugin) {
+      gst_object_unref (plugin);
+    }
+    return FALSE;
+  }
+
+  const gchar* filename = gst_plugin_get_filename (plugin);
+  gchar* base = g_path_get_basename (filename);
+  gchar* link = g_build_filename (FAST_STARTUP_PLUGIN_DIR, base, NULL);
+
+  // Several factories share a plugin; relinking it is harmless.
+  g_unlink (link);
+  gboolean ok = symlink (filename, link) == 0;
+  g_print ("  %-16s %s%s\n", factory_name, filename, ok ? "" : " (link failed)");
+
+  g_free (link);
+  g_free (base);
+  gst_object_unref (plugin);
+  return ok;
+}
+
+/* Child process: load the private plugin directory only, which writes its
+ * registry cache.
+ */
+static int
+build_registry (int argc, char** argv)
+{
+  fast_startup_setenv ();
+  gst_init (&argc, &argv);
+
+  GList* plugins = gst_registry_get_plugin_list (gst_registry_get ());
+  g_print ("Registry %s: %u plugins\n", FAST_STARTUP_REGISTRY,
+      g_list_length (plugins));
+  gst_plugin_list_free (plugins);
+  return 0;
+}
+
+int
+main (int argc, char** argv)
+{
+  if (argc > 1 && !g_strcmp0 (argv[1], "--build-registry")) {
+    return build_registry (argc, argv);
+  }
+
+  gst_init (&argc, &argv);
+
+  if (g_mkdir_with_parents (FAST_STARTUP_PLUGIN_DIR, 0755) != 0) {
+    g_printerr ("Could not create %s\n", FAST_STARTUP_PLUGIN_DIR);
+    return 1;
+  }
+
+  g_print ("Linking plugins into %s:\n", FAST_STARTUP_PLUGIN_DIR);
+  guint linked = 0;
+  for (guint i = 0; i < G_N_ELEMENTS (fast_startup_factories); ++i) {
+    linked += link_plugin (fast_startup_factories[i]);
+  }
+  if (!linked) {
+    g_printerr ("No plugins found\n");
+    return 1;
+  }
+
+  // Start the cache over, so it holds only the linked plugins.
+  g_unlink (FAST_STARTUP_REGISTRY);
+
+  gchar* child_argv[] = { argv[0], "--build-registry", NULL };
+  gint status = 0;
+  GError* err = NULL;
+  if (!g_spawn_sync (NULL, child_argv, NULL,
+          G_SPAWN_SEARCH_PATH | G_SPAWN_CHILD_INHERITS_STDIN, NULL, NULL,
+          NULL, NULL, &status, &err) ||
+      !g_spawn_check_exit_status (status, &err)) {
+    g_printerr ("Could not build the registry: %s\n", err->message);
+    g_clear_error (&err);
+    return 1;
+  }
+
+  return 0;
+}
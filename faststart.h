@@ -0,0 +1,72 @@
+/* Fast cold start. gst_init normally checks every plugin on the system
+ * against the registry cache (and rescans any that changed) before the
+ * application gets to run. With fast_startup_use, it only looks at a private
+ * plugin directory that holds links to the few plugins the prototypes need,
+ * with a registry cache of its own that covers just those.
+ *
+ * fast-startup-setup.c creates the directory and the cache:
+ *
+ *   FAST_STARTUP_DIR/plugins/      links to the plugins of
+ *                                  @fast_startup_factories
+ *   FAST_STARTUP_DIR/registry.bin  the registry cache for them
+ *
+ * FAST_STARTUP_DIR is relative to the working directory, like button.css.
+ */
+
+#ifndef FASTSTART_H
+#define FASTSTART_H
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+#ifndef FAST_STARTUP_DIR
+#define FAST_STARTUP_DIR "gst-fast-startup"
+#endif
+
+#define FAST_STARTUP_PLUGIN_DIR FAST_STARTUP_DIR G_DIR_SEPARATOR_S "plugins"
+#define FAST_STARTUP_REGISTRY FAST_STARTUP_DIR G_DIR_SEPARATOR_S "registry.bin"
+
+// Every element factory the prototypes create, under any build option. The
+// in-tree visualizers are registered by the application itself.
+static const gchar *const fast_startup_factories[] = {
+  "jackaudiosrc", "audiotestsrc", "jackaudiosink", "autoaudiosink",
+  "audioconvert", "audioresample", "videoconvert", "gtksink", "appsink",
+  "fakesink", "spacescope", "spectrascope", "synaescope", "wavescope",
+  "textoverlay", "queue", "tee", "capsfilter", "valve", "output-selector",
+  "input-selector", "compositor", "deinterleave",
+};
+
+/* Points GStreamer at the private plugin directory and registry cache,
+ * whether they exist or not. Must be called before gst_init.
+ */
+static inline void
+fast_startup_setenv (void)
+{
+  // An empty system path means no system plugin directories at all.
+  g_setenv ("GST_PLUGIN_SYSTEM_PATH_1_0", "", TRUE);
+  g_setenv ("GST_PLUGIN_PATH_1_0", FAST_STARTUP_PLUGIN_DIR, TRUE);
+  g_setenv ("GST_REGISTRY_1_0", FAST_STARTUP_REGISTRY, TRUE);
+
+  // If one of the plugins changed, load it in-process instead of starting
+  // the gst-plugin-scanner helper for it.
+  g_setenv ("GST_REGISTRY_FORK", "no", TRUE);
+}
+
+/* Like fast_startup_setenv, but returns FALSE, and changes nothing, if
+ * fast-startup-setup hasn't been run.
+ */
+static inline gboolean
+fast_startup_use (void)
+{
+  if (!g_file_test (FAST_STARTUP_PLUGIN_DIR, G_FILE_TEST_IS_DIR) ||
+      !g_file_test (FAST_STARTUP_REGISTRY, G_FILE_TEST_IS_REGULAR))
+    return FALSE;
+
+  fast_startup_setenv ();
+  return TRUE;
+}
+
+G_END_DECLS
+
+#endif /* FASTSTART_H */
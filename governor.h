@@ -0,0 +1,222 @@
+/* Frame-rate governor for the visualizers. Picks the frame rate they should
+ * render at from what the window is doing:
+ *
+ *   visible   - the refresh rate of the monitor the window is on. Frames
+ *               faster than that are never seen.
+ *   throttled - visible, but the system is short of CPU: the rate is halved,
+ *               down to min_fps, while the "some" CPU pressure of Linux PSI
+ *               (/proc/pressure/cpu, avg10) stays above
+ *               GOVERNOR_PRESSURE_HIGH, and doubled back up while it stays
+ *               below GOVERNOR_PRESSURE_LOW. Without PSI this never happens.
+ *   hidden    - the window is minimized, withdrawn or fully covered:
+ *               hidden_fps, which keeps the pipeline running at almost no
+ *               cost.
+ *
+ * The governor only decides; the caller applies the rate. It also charges
+ * the process CPU time to the state it was spent in, so governor_report can
+ * show what each state costs. Main thread only.
+ */
+
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+#include <gtk/gtk.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "cputime.h"
+
+G_BEGIN_DECLS
+
+// CPU pressure (percent of time some task waited for a CPU, over the last 10
+// seconds) above which the rate is stepped down, and below which it is
+// stepped back up.
+#define GOVERNOR_PRESSURE_HIGH 25.0
+#define GOVERNOR_PRESSURE_LOW 5.0
+
+// avg10 lags by seconds, so leave this long between steps.
+#define GOVERNOR_HOLD_US (10 * G_USEC_PER_SEC)
+
+// Used when the monitor doesn't say.
+#define GOVERNOR_DEFAULT_REFRESH 60
+
+typedef enum
+{
+  GOVERNOR_VISIBLE,
+  GOVERNOR_THROTTLED,
+  GOVERNOR_HIDDEN,
+  GOVERNOR_N_STATES
+} GovernorState;
+
+static const gchar *const governor_state_names[GOVERNOR_N_STATES] = {
+  "visible", "throttled", "hidden",
+};
+
+typedef struct _Governor
+{
+  gint hidden_fps;
+  gint min_fps;
+
+  // The monitor's refresh rate, and the rate while visible: the refresh rate,
+  // or less under CPU pressure.
+  gint refresh_fps;
+  gint visible_fps;
+
+  // Why the window is hidden, if it is.
+  gboolean iconified;
+  gboolean obscured;
+
+  GovernorState state;
+  gint fps;
+  gint64 last_step_us;
+
+  // Process CPU and wall time spent in each state, in microseconds, charged
+  // up to @last_cpu_us and @last_wall_us.
+  gint64 cpu_us[GOVERNOR_N_STATES];
+  gint64 wall_us[GOVERNOR_N_STATES];
+  gint64 last_cpu_us;
+  gint64 last_wall_us;
+} Governor;
+
+/* Charge the time since the last call to the current state. */
+static inline void
+governor_account (Governor * gov)
+{
+  gint64 cpu = process_cpu_us ();
+  gint64 wall = g_get_monotonic_time ();
+
+  gov->cpu_us[gov->state] += cpu - gov->last_cpu_us;
+  gov->wall_us[gov->state] += wall - gov->last_wall_us;
+  gov->last_cpu_us = cpu;
+  gov->last_wall_us = wall;
+}
+
+/* Work out the state and rate again. Returns TRUE if the rate changed. */
+static inline gboolean
+governor_update (Governor * gov)
+{
+  GovernorState state;
+  gint fps;
+
+  if (gov->iconified || gov->obscured) {
+    state = GOVERNOR_HIDDEN;
+    fps = gov->hidden_fps;
+  } else {
+    state = gov->visible_fps < gov->refresh_fps ? GOVERNOR_THROTTLED :
+        GOVERNOR_VISIBLE;
+    fps = gov->visible_fps;
+  }
+
+  if (state != gov->state) {
+    governor_account (gov);
+    gov->state = state;
+  }
+  if (fps == gov->fps)
+    return FALSE;
+  gov->fps = fps;
+  return TRUE;
+}
+
+static inline void
+governor_init (Governor * gov, gint hidden_fps, gint min_fps)
+{
+  memset (gov, 0, sizeof *gov);
+  gov->hidden_fps = hidden_fps;
+  gov->min_fps = min_fps;
+  gov->refresh_fps = gov->visible_fps = GOVERNOR_DEFAULT_REFRESH;
+  gov->last_cpu_us = process_cpu_us ();
+  gov->last_wall_us = g_get_monotonic_time ();
+  governor_update (gov);
+}
+
+/* The "some avg10" figure of /proc/pressure/cpu, or -1 without PSI. */
+static inline gdouble
+governor_cpu_pressure (void)
+{
+  FILE *file = fopen ("/proc/pressure/cpu", "r");
+  gdouble avg10 = -1;
+
+  if (!file)
+    return -1;
+  if (fscanf (file, "some avg10=%lf", &avg10) != 1)
+    avg10 = -1;
+  fclose (file);
+  return avg10;
+}
+
+/* The window was minimized or restored, or (un)mapped. */
+static inline gboolean
+governor_set_iconified (Governor * gov, gboolean iconified)
+{
+  gov->iconified = iconified;
+  return governor_update (gov);
+}
+
+/* The window became fully covered, or not. */
+static inline gboolean
+governor_set_obscured (Governor * gov, gboolean obscured)
+{
+  gov->obscured = obscured;
+  return governor_update (gov);
+}
+
+/* Periodic check of the monitor @window is on and of the CPU pressure.
+ * Returns TRUE if the rate changed.
+ */
+static inline gboolean
+governor_tick (Governor * gov, GtkWidget * window)
+{
+  GdkWindow *gdk_window = gtk_widget_get_window (window);
+  gint64 now = g_get_monotonic_time ();
+  gdouble pressure = governor_cpu_pressure ();
+
+  if (gdk_window) {
+    GdkMonitor *monitor =
+        gdk_display_get_monitor_at_window (gdk_window_get_display
+        (gdk_window), gdk_window);
+    // In millihertz, 0 if unknown.
+    gint refresh = monitor ? (gdk_monitor_get_refresh_rate (monitor) +
+        500) / 1000 : 0;
+
+    if (refresh > 0 && refresh != gov->refresh_fps) {
+      gboolean throttled = gov->visible_fps < gov->refresh_fps;
+
+      gov->refresh_fps = refresh;
+      gov->visible_fps = throttled ? MIN (gov->visible_fps, refresh) : refresh;
+    }
+  }
+
+  // Pressure only matters to the visible rate.
+  if (pressure >= 0 && gov->state != GOVERNOR_HIDDEN &&
+      now - gov->last_step_us >= GOVERNOR_HOLD_US) {
+    if (pressure > GOVERNOR_PRESSURE_HIGH && gov->visible_fps > gov->min_fps) {
+      gov->visible_fps = MAX (gov->visible_fps / 2, gov->min_fps);
+      gov->last_step_us = now;
+    } else if (pressure < GOVERNOR_PRESSURE_LOW &&
+        gov->visible_fps < gov->refresh_fps) {
+      gov->visible_fps = MIN (gov->visible_fps * 2, gov->refresh_fps);
+      gov->last_step_us = now;
+    }
+  }
+
+  return governor_update (gov);
+}
+
+/* Print the CPU used in each state so far, as a percentage of one core. */
+static inline void
+governor_report (Governor * gov)
+{
+  governor_account (gov);
+  g_print ("Frame rate %d fps (%s). CPU by state:", gov->fps,
+      governor_state_names[gov->state]);
+  for (gint i = 0; i < GOVERNOR_N_STATES; i++) {
+    if (gov->wall_us[i] > 0)
+      g_print (" %s %.1f%% over %.0f s", governor_state_names[i],
+          100.0 * gov->cpu_us[i] / gov->wall_us[i], gov->wall_us[i] / 1e6);
+  }
+  g_print ("\n");
+}
+
+G_END_DECLS
+
+#endif /* GOVERNOR_H */
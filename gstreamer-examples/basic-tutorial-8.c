@@ -1,13 +1,42 @@
 /*
-clear && gcc basic-tutorial-8.c -o basic-tutorial-8 `pkg-config --cflags --libs gstreamer-1.0 gstreamer-audio-1.0` && ./basic-tutorial-8
+clear && gcc -O3 basic-tutorial-8.c -o basic-tutorial-8 `pkg-config --cflags --libs gstreamer-1.0 gstreamer-audio-1.0` -lm && ./basic-tutorial-8
 */
 
+/* Build options:
+ *   -DPRODUCER_PRIORITY=n  Run the producer thread with SCHED_FIFO priority n. Needs CAP_SYS_NICE
+ *                          or an rtprio limit (ulimit -r) of at least n.
+ *   -DPRODUCER_CPU=n       Pin the producer thread to CPU n.
+ *   -DPRODUCER_LEAD_MS=n   How far ahead of the pipeline clock buffers are pushed (default 50).
+ *   -DSOURCE_WAVE=w        Waveform from ../synth.h: SYNTH_PSYCHEDELIC (default), SYNTH_SINE,
+ *                          SYNTH_SQUARE or SYNTH_NOISE.
+ */
+
+#define _GNU_SOURCE
 #include <gst/gst.h>
 #include <gst/audio/audio.h>
+#include <pthread.h>
+#include <sched.h>
 #include <string.h>
 
+#include "../synth.h"
+
+#ifndef CHUNK_SIZE
 #define CHUNK_SIZE 1024   /* Amount of bytes we are sending in each buffer */
+#endif
 #define SAMPLE_RATE 44100 /* Samples per second we are sending */
+#define POOL_BUFFERS 32   /* Buffers allocated up front; the pool grows if downstream holds more */
+
+#ifndef PRODUCER_LEAD_MS
+#define PRODUCER_LEAD_MS 50
+#endif
+
+#if CHUNK_SIZE % 2
+#error "CHUNK_SIZE must hold whole samples"
+#endif
+
+#ifndef SOURCE_WAVE
+#define SOURCE_WAVE SYNTH_PSYCHEDELIC
+#endif
 
 /* Structure to contain all our information, so we can pass it to callbacks */
 typedef struct _CustomData {
@@ -16,51 +45,42 @@ typedef struct _CustomData {
   GstElement *app_queue, *app_sink;
 
   guint64 num_samples;   /* Number of samples generated so far (for timestamp generation) */
-  gfloat a, b, c, d;     /* For waveform generation */
+  Synth *synth;          /* For waveform generation */
+
+  GstBufferPool *pool;   /* Buffers for the app_source, reused once downstream is done with them */
 
-  guint sourceid;        /* To control the GSource */
+  GThread *push_thread;  /* Produces buffers for the app_source, paced by the pipeline clock */
+  gint feeding;          /* Watermark flag: set by need-data, cleared by enough-data (atomic) */
+  gint stopping;         /* Tells push_thread to exit (atomic) */
 
   GMainLoop *main_loop;  /* GLib's Main Loop */
 } CustomData;
 
-/* This method is called by the idle GSource in the mainloop, to feed CHUNK_SIZE bytes into appsrc.
- * The idle handler is added to the mainloop when appsrc requests us to start sending data (need-data signal)
- * and is removed when appsrc has enough data (enough-data signal).
- */
+/* Feed CHUNK_SIZE bytes into appsrc, in a buffer from the pool */
 static gboolean push_data (CustomData *data) {
   GstBuffer *buffer;
   GstFlowReturn ret;
-  int i;
   GstMapInfo map;
-  gint16 *raw;
   gint num_samples = CHUNK_SIZE / 2; /* Because each sample is 16 bits */
-  gfloat freq;
 
-  /* Create a new empty buffer */
-  buffer = gst_buffer_new_and_alloc (CHUNK_SIZE);
+  /* Take a free buffer from the pool */
+  if (gst_buffer_pool_acquire_buffer (data->pool, &buffer, NULL) != GST_FLOW_OK)
+    return FALSE;
 
   /* Set its timestamp and duration */
   GST_BUFFER_TIMESTAMP (buffer) = gst_util_uint64_scale (data->num_samples, GST_SECOND, SAMPLE_RATE);
   GST_BUFFER_DURATION (buffer) = gst_util_uint64_scale (num_samples, GST_SECOND, SAMPLE_RATE);
 
-  /* Generate some psychodelic waveforms */
+  /* Generate the samples */
   gst_buffer_map (buffer, &map, GST_MAP_WRITE);
-  raw = (gint16 *)map.data;
-  data->c += data->d;
-  data->d -= data->c / 1000;
-  freq = 1100 + 1000 * data->d;
-  for (i = 0; i < num_samples; i++) {
-    data->a += data->b;
-    data->b -= data->a / freq;
-    raw[i] = (gint16)(500 * data->a);
-  }
+  synth_fill_s16 (data->synth, (gint16 *)map.data, num_samples);
   gst_buffer_unmap (buffer, &map);
   data->num_samples += num_samples;
 
   /* Push the buffer into the appsrc */
   g_signal_emit_by_name (data->app_source, "push-buffer", buffer, &ret);
 
-  /* Free the buffer now that we are done with it */
+  /* Drop our reference; the buffer goes back to the pool once downstream is done with it */
   gst_buffer_unref (buffer);
 
   if (ret != GST_FLOW_OK) {
@@ -71,23 +91,77 @@ static gboolean push_data (CustomData *data) {
   return TRUE;
 }
 
-/* This signal callback triggers when appsrc needs data. Here, we add an idle handler
- * to the mainloop to start pushing data into the appsrc */
+/* Give the calling thread the scheduling the build options ask for */
+static void setup_producer_thread (void) {
+#ifdef PRODUCER_PRIORITY
+  struct sched_param param = { .sched_priority = PRODUCER_PRIORITY };
+  int err = pthread_setschedparam (pthread_self (), SCHED_FIFO, &param);
+  if (err != 0)
+    g_printerr ("Could not use SCHED_FIFO priority %d: %s\n", PRODUCER_PRIORITY, g_strerror (err));
+#endif
+#ifdef PRODUCER_CPU
+  cpu_set_t cpus;
+  CPU_ZERO (&cpus);
+  CPU_SET (PRODUCER_CPU, &cpus);
+  if (pthread_setaffinity_np (pthread_self (), sizeof (cpus), &cpus) != 0)
+    g_printerr ("Could not pin the producer to CPU %d\n", PRODUCER_CPU);
+#endif
+}
+
+/* Sleep until PRODUCER_LEAD_MS before the next buffer is due, by the pipeline clock.
+ * Until the pipeline is playing there is no clock to go by, and the buffers for preroll
+ * are pushed right away. */
+static void wait_for_next_chunk (CustomData *data) {
+  GstClock *clock = gst_element_get_clock (data->pipeline);
+  GstClockTime pts, lead = PRODUCER_LEAD_MS * GST_MSECOND;
+  GstClockID id;
+
+  if (!clock)
+    return;
+
+  pts = gst_util_uint64_scale (data->num_samples, GST_SECOND, SAMPLE_RATE);
+  id = gst_clock_new_single_shot_id (clock,
+      gst_element_get_base_time (data->pipeline) + (pts > lead ? pts - lead : 0));
+  gst_clock_id_wait (id, NULL);
+  gst_clock_id_unref (id);
+  gst_object_unref (clock);
+}
+
+/* The push thread produces one buffer per chunk of pipeline clock time, whatever the main
+ * loop is doing. It checks the watermark flag without taking a lock; while appsrc has
+ * enough data it only polls the flag once per chunk duration. */
+static gpointer push_thread (CustomData *data) {
+  gulong chunk_us = (gulong) (CHUNK_SIZE / 2) * G_USEC_PER_SEC / SAMPLE_RATE;
+
+  setup_producer_thread ();
+
+  while (!g_atomic_int_get (&data->stopping)) {
+    if (!g_atomic_int_get (&data->feeding)) {
+      g_usleep (chunk_us);
+      continue;
+    }
+
+    wait_for_next_chunk (data);
+
+    if (!push_data (data)) {
+      /* We got some error, stop sending data until appsrc asks again */
+      g_atomic_int_set (&data->feeding, FALSE);
+    }
+  }
+  return NULL;
+}
+
+/* This signal callback triggers when appsrc needs data. Here, we raise the watermark flag */
 static void start_feed (GstElement *source, guint size, CustomData *data) {
-  if (data->sourceid == 0) {
+  if (g_atomic_int_compare_and_exchange (&data->feeding, FALSE, TRUE))
     g_print ("Start feeding\n");
-    data->sourceid = g_idle_add ((GSourceFunc) push_data, data);
-  }
 }
 
 /* This callback triggers when appsrc has enough data and we can stop sending.
- * We remove the idle handler from the mainloop */
+ * The push thread sees the cleared flag before its next buffer */
 static void stop_feed (GstElement *source, CustomData *data) {
-  if (data->sourceid != 0) {
+  if (g_atomic_int_compare_and_exchange (&data->feeding, TRUE, FALSE))
     g_print ("Stop feeding\n");
-    g_source_remove (data->sourceid);
-    data->sourceid = 0;
-  }
 }
 
 /* The appsink has received a buffer */
@@ -127,12 +201,12 @@ int main(int argc, char *argv[]) {
   GstPad *queue_audio_pad, *queue_video_pad, *queue_app_pad;
   GstAudioInfo info;
   GstCaps *audio_caps;
+  GstStructure *pool_config;
   GstBus *bus;
 
   /* Initialize custom data structure */
   memset (&data, 0, sizeof (data));
-  data.b = 1; /* For waveform generation */
-  data.d = 1;
+  data.synth = synth_new (SOURCE_WAVE, SAMPLE_RATE, 1); /* For waveform generation */
 
   /* Initialize GStreamer */
   gst_init (&argc, &argv);
@@ -187,6 +261,15 @@ int main(int argc, char *argv[]) {
   g_signal_connect (data.app_source, "need-data", G_CALLBACK (start_feed), &data);
   g_signal_connect (data.app_source, "enough-data", G_CALLBACK (stop_feed), &data);
 
+  /* Create the buffer pool the push thread fills buffers from */
+  data.pool = gst_buffer_pool_new ();
+  pool_config = gst_buffer_pool_get_config (data.pool);
+  gst_buffer_pool_config_set_params (pool_config, audio_caps, CHUNK_SIZE, POOL_BUFFERS, 0);
+  if (!gst_buffer_pool_set_config (data.pool, pool_config) || !gst_buffer_pool_set_active (data.pool, TRUE)) {
+    g_printerr ("Buffer pool could not be set up.\n");
+    return -1;
+  }
+
   /* Configure appsink */
   g_object_set (data.app_sink, "emit-signals", TRUE, "caps", audio_caps, NULL);
   g_signal_connect (data.app_sink, "new-sample", G_CALLBACK (new_sample), &data);
@@ -232,6 +315,9 @@ int main(int argc, char *argv[]) {
   g_signal_connect (G_OBJECT (bus), "message::error", (GCallback)error_cb, &data);
   gst_object_unref (bus);
 
+  /* Start the push thread; it waits for need-data */
+  data.push_thread = g_thread_new ("push", (GThreadFunc) push_thread, &data);
+
   /* Start playing the pipeline */
   gst_element_set_state (data.pipeline, GST_STATE_PLAYING);
 
@@ -239,6 +325,10 @@ int main(int argc, char *argv[]) {
   data.main_loop = g_main_loop_new (NULL, FALSE);
   g_main_loop_run (data.main_loop);
 
+  /* Stop the push thread */
+  g_atomic_int_set (&data.stopping, TRUE);
+  g_thread_join (data.push_thread);
+
   /* Release the request pads from the Tee, and unref them */
   gst_element_release_request_pad (data.tee, tee_audio_pad);
   gst_element_release_request_pad (data.tee, tee_video_pad);
@@ -250,5 +340,8 @@ int main(int argc, char *argv[]) {
   /* Free resources */
   gst_element_set_state (data.pipeline, GST_STATE_NULL);
   gst_object_unref (data.pipeline);
+  gst_buffer_pool_set_active (data.pool, FALSE);
+  gst_object_unref (data.pool);
+  synth_free (data.synth);
   return 0;
 }
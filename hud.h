@@ -0,0 +1,255 @@
+/* Performance HUD for the video area: a label to lay over the video with a
+ * GtkOverlay, showing
+ *
+ *   - the frames per second reaching the video sink, and the frames dropped
+ *     on the way there: by the queue in front of the sink (when it leaks) and
+ *     by the sink itself (as its QoS messages say),
+ *   - the last and the longest swap stall,
+ *   - the fill levels of the audio and video queues, in buffers and time,
+ *   - the audio-to-sink latency of latency.h, p50 and p99.
+ *
+ * The streaming threads only bump counters and store values with atomics,
+ * never a lock, so all the HUD adds to the paths it measures is a few atomic
+ * operations per buffer. Queue levels come from those too: the timestamps of
+ * the last buffer into and out of each queue give the time it holds, and the
+ * buffer duration the number of buffers. (Counting buffers in and out would
+ * drift for good the first time a leaky queue drops one.) The rest happens
+ * in the main thread in hud_update, every HUD_INTERVAL_MS.
+ */
+
+#ifndef HUD_H
+#define HUD_H
+
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+#include <string.h>
+
+G_BEGIN_DECLS
+
+// 4 updates a second.
+#define HUD_INTERVAL_MS 250
+
+static const gchar hud_css[] =
+    "label#hud { font-family: monospace; color: white;"
+    " background-color: rgba(0, 0, 0, 0.6); padding: 4px 8px; }";
+
+// One queue, as seen from its pads. Written by streaming threads, with
+// atomics.
+typedef struct
+{
+  // Buffers that went in.
+  gint in;
+
+  // End (PTS + duration) of the last buffer in and of the last buffer out,
+  // and the duration of the last buffer in. @out_end starts at the PTS of
+  // the first buffer in.
+  guint64 in_end;
+  guint64 out_end;
+  guint64 duration;
+} HudQueue;
+
+typedef struct _Hud
+{
+  GtkWidget *label;
+
+  // Written by streaming threads, with atomics: the queues, the frames into
+  // the sink, and the swap stalls in microseconds (-1 for none yet).
+  HudQueue audio_queue;
+  HudQueue video_queue;
+  gint frames_shown;
+  gint64 stall_last_us;
+  gint64 stall_max_us;
+
+  // The rest is main thread only.
+  GstElement *sink;
+
+  // Frames the sink dropped so far, from its QoS messages.
+  guint64 sink_dropped;
+
+  gboolean have_latency;
+  gdouble latency_p50_ms;
+  gdouble latency_p99_ms;
+
+  gint last_shown;
+  gint64 last_us;
+} Hud;
+
+static inline GstPadProbeReturn
+hud_count_cb (GstPad * pad, GstPadProbeInfo * info, gint * count)
+{
+  g_atomic_int_inc (count);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Create the label, blank until hud_watch. */
+static inline void
+hud_init (Hud * hud)
+{
+  GtkCssProvider *provider = gtk_css_provider_new ();
+
+  memset (hud, 0, sizeof *hud);
+  hud->stall_last_us = hud->stall_max_us = -1;
+
+  hud->label = gtk_label_new (NULL);
+  gtk_widget_set_name (hud->label, "hud");
+  gtk_widget_set_halign (hud->label, GTK_ALIGN_START);
+  gtk_widget_set_valign (hud->label, GTK_ALIGN_START);
+  g_object_set (hud->label, "margin", 8, NULL);
+
+  gtk_css_provider_load_from_data (provider, hud_css, -1, NULL);
+  gtk_style_context_add_provider (gtk_widget_get_style_context (hud->label),
+      GTK_STYLE_PROVIDER (provider), GTK_STYLE_PROVIDER_PRIORITY_APPLICATION);
+  g_object_unref (provider);
+}
+
+static inline GstPadProbeReturn
+hud_queue_in_cb (GstPad * pad, GstPadProbeInfo * info, HudQueue * queue)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  guint64 start = 0;
+
+  g_atomic_int_inc (&queue->in);
+  if (GST_BUFFER_PTS_IS_VALID (buffer) &&
+      GST_BUFFER_DURATION_IS_VALID (buffer)) {
+    __atomic_compare_exchange_n (&queue->out_end, &start,
+        GST_BUFFER_PTS (buffer), FALSE, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+    __atomic_store_n (&queue->in_end, GST_BUFFER_PTS (buffer) +
+        GST_BUFFER_DURATION (buffer), __ATOMIC_RELAXED);
+    __atomic_store_n (&queue->duration, GST_BUFFER_DURATION (buffer),
+        __ATOMIC_RELAXED);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+static inline GstPadProbeReturn
+hud_queue_out_cb (GstPad * pad, GstPadProbeInfo * info, HudQueue * queue)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  if (GST_BUFFER_PTS_IS_VALID (buffer) && GST_BUFFER_DURATION_IS_VALID (buffer))
+    __atomic_store_n (&queue->out_end, GST_BUFFER_PTS (buffer) +
+        GST_BUFFER_DURATION (buffer), __ATOMIC_RELAXED);
+  return GST_PAD_PROBE_OK;
+}
+
+static inline void
+hud_add_probe (GstElement * element, const gchar * pad_name,
+    GstPadProbeCallback callback, gpointer user_data)
+{
+  GstPad *pad = gst_element_get_static_pad (element, pad_name);
+
+  gst_pad_add_probe (pad, GST_PAD_PROBE_TYPE_BUFFER, callback, user_data,
+      NULL);
+  gst_object_unref (pad);
+}
+
+/* Start counting. @video_queue must feed @sink directly. */
+static inline void
+hud_watch (Hud * hud, GstElement * audio_queue, GstElement * video_queue,
+    GstElement * sink)
+{
+  hud->sink = sink;
+
+  hud_add_probe (audio_queue, "sink", (GstPadProbeCallback) hud_queue_in_cb,
+      &hud->audio_queue);
+  hud_add_probe (audio_queue, "src", (GstPadProbeCallback) hud_queue_out_cb,
+      &hud->audio_queue);
+  hud_add_probe (video_queue, "sink", (GstPadProbeCallback) hud_queue_in_cb,
+      &hud->video_queue);
+  hud_add_probe (video_queue, "src", (GstPadProbeCallback) hud_queue_out_cb,
+      &hud->video_queue);
+  hud_add_probe (sink, "sink", (GstPadProbeCallback) hud_count_cb,
+      &hud->frames_shown);
+  hud->last_us = g_get_monotonic_time ();
+}
+
+/* A swap stall ended. Any thread. */
+static inline void
+hud_set_stall (Hud * hud, gint64 last_us, gint64 max_us)
+{
+  __atomic_store_n (&hud->stall_last_us, last_us, __ATOMIC_RELAXED);
+  __atomic_store_n (&hud->stall_max_us, max_us, __ATOMIC_RELAXED);
+}
+
+/* Pass the QoS messages of the bus; the sink's say how much it dropped. */
+static inline void
+hud_qos (Hud * hud, GstMessage * msg)
+{
+  GstFormat format;
+  guint64 processed, dropped;
+
+  if (GST_MESSAGE_SRC (msg) != GST_OBJECT (hud->sink))
+    return;
+  gst_message_parse_qos_stats (msg, &format, &processed, &dropped);
+  if (format == GST_FORMAT_BUFFERS && dropped != G_MAXUINT64)
+    hud->sink_dropped = dropped;
+}
+
+static inline void
+hud_set_latency (Hud * hud, gdouble p50_ms, gdouble p99_ms)
+{
+  hud->have_latency = TRUE;
+  hud->latency_p50_ms = p50_ms;
+  hud->latency_p99_ms = p99_ms;
+}
+
+/* What @queue holds: returns buffers, and the time in @time. */
+static inline guint
+hud_queue_level (HudQueue * queue, guint64 * time)
+{
+  guint64 in_end = __atomic_load_n (&queue->in_end, __ATOMIC_RELAXED);
+  guint64 out_end = __atomic_load_n (&queue->out_end, __ATOMIC_RELAXED);
+  guint64 duration = __atomic_load_n (&queue->duration, __ATOMIC_RELAXED);
+
+  *time = in_end > out_end ? in_end - out_end : 0;
+  return duration > 0 ? (*time + duration / 2) / duration : 0;
+}
+
+/* Show the figures since the last update. Main thread. */
+static inline void
+hud_update (Hud * hud)
+{
+  gint64 now = g_get_monotonic_time ();
+  gint shown = g_atomic_int_get (&hud->frames_shown);
+  gint queued = g_atomic_int_get (&hud->video_queue.in);
+  gint64 stall_last = __atomic_load_n (&hud->stall_last_us, __ATOMIC_RELAXED);
+  gint64 stall_max = __atomic_load_n (&hud->stall_max_us, __ATOMIC_RELAXED);
+  guint64 q1_time = 0, q2_time = 0;
+  GString *text;
+
+  if (!hud->sink)
+    return;
+
+  // After the counters: a frame counted into the video queue and not into
+  // the sink is either still queued or was dropped.
+  guint q1_buffers = hud_queue_level (&hud->audio_queue, &q1_time);
+  guint q2_buffers = hud_queue_level (&hud->video_queue, &q2_time);
+  guint64 dropped = MAX (queued - shown - (gint) q2_buffers, 0) +
+      hud->sink_dropped;
+
+  text = g_string_new (NULL);
+  g_string_append_printf (text, "%5.1f fps, %" G_GUINT64_FORMAT " dropped\n",
+      (shown - hud->last_shown) * 1e6 / MAX (now - hud->last_us, 1), dropped);
+  if (stall_last >= 0)
+    g_string_append_printf (text, "stall %.1f ms (max %.1f ms)\n",
+        stall_last / 1e3, stall_max / 1e3);
+  else
+    g_string_append (text, "stall -\n");
+  g_string_append_printf (text, "q1 %u buf %.1f ms, q2 %u buf %.1f ms\n",
+      q1_buffers, q1_time / 1e6, q2_buffers, q2_time / 1e6);
+  if (hud->have_latency)
+    g_string_append_printf (text, "latency %.1f ms (p99 %.1f ms)",
+        hud->latency_p50_ms, hud->latency_p99_ms);
+  else
+    g_string_append (text, "latency -");
+
+  gtk_label_set_text (GTK_LABEL (hud->label), text->str);
+  g_string_free (text, TRUE);
+
+  hud->last_shown = shown;
+  hud->last_us = now;
+}
+
+G_END_DECLS
+
+#endif /* HUD_H */
@@ -0,0 +1,110 @@
+/* Latency budget for the two queues of the visualizer path (q1 before the
+ * visualizer, q2 after it).
+ *
+ * With default properties a queue holds up to 1 s (or 200 buffers / 10 MB).
+ * p1-2.c always makes q1 leak downstream, so the audio tee never waits on
+ * the visualizers, but leaves q2 to block the visualizer when it is full. A
+ * visualizer or sink that falls behind a live source then adds up to a
+ * second of lag per queue before q1 starts dropping audio.
+ * latency_budget_apply gives each queue half of @budget_ms and makes q2 leak
+ * downstream too: when full it throws away its oldest frame instead of
+ * blocking. The audio queue drops audio that is too old to be worth drawing,
+ * and the video queue drops stale frames, so what reaches the sink stays
+ * within the budget of the audio.
+ *
+ * The trade-off is lag against dropped frames. A tight budget bounds the lag
+ * but drops frames (visible stutter) as soon as rendering or the display
+ * falls behind for a moment; a loose one rides out hiccups and lags instead.
+ * At the rates of benchmarks/pipeline-bench (1024-sample buffers at 44.1 kHz,
+ * 23.2 ms each, and 60 fps, 16.7 ms a frame) the queues work out to:
+ *
+ *   budget     q1 holds     q2 holds     added lag    a stall longer than
+ *                                        at most      this drops
+ *   none       43 buffers   60 frames    2000 ms     1000 ms, in q1
+ *   200 ms      4 buffers    6 frames     200 ms      100 ms
+ *   100 ms      2 buffers    3 frames     100 ms       50 ms
+ *    50 ms      1 buffer     1 frame       50 ms       25 ms
+ *
+ * With no budget, a sink stall fills q2 first, and q1 only drops once the
+ * visualizer has been held up for 1000 ms more. These follow from the queue
+ * sizes; they are not measurements. Run benchmarks/pipeline-bench --live
+ * --budget-ms N against a run without --budget-ms for the latency
+ * percentiles and drop counts on a given machine and visualizer.
+ */
+
+#ifndef LATENCY_BUDGET_H
+#define LATENCY_BUDGET_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+typedef struct
+{
+  // Buffers that went into and came out of the queue.
+  gint in;
+  gint out;
+
+  GstElement *queue;
+} LatencyBudgetQueue;
+
+static inline GstPadProbeReturn
+latency_budget_count_cb (GstPad * pad, GstPadProbeInfo * info, gint * count)
+{
+  g_atomic_int_inc (count);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Give @queue @share_ns of the budget and start counting its drops in
+ * @counts.
+ */
+static inline void
+latency_budget_apply_queue (GstElement * queue, guint64 share_ns,
+    LatencyBudgetQueue * counts)
+{
+  g_object_set (queue, "max-size-buffers", 0, "max-size-bytes", 0,
+      "max-size-time", share_ns, "leaky", 2 /* downstream */ , NULL);
+
+  counts->in = counts->out = 0;
+  counts->queue = queue;
+
+  GstPad *sinkpad = gst_element_get_static_pad (queue, "sink");
+  GstPad *srcpad = gst_element_get_static_pad (queue, "src");
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) latency_budget_count_cb, &counts->in, NULL);
+  gst_pad_add_probe (srcpad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) latency_budget_count_cb, &counts->out, NULL);
+  gst_object_unref (srcpad);
+  gst_object_unref (sinkpad);
+}
+
+/* Configure @audio_queue and @video_queue for @budget_ms of latency. The
+ * counts must outlive the pipeline's dataflow.
+ */
+static inline void
+latency_budget_apply (GstElement * audio_queue, GstElement * video_queue,
+    guint budget_ms, LatencyBudgetQueue * audio_counts,
+    LatencyBudgetQueue * video_counts)
+{
+  guint64 share_ns = (guint64) budget_ms * GST_MSECOND / 2;
+
+  latency_budget_apply_queue (audio_queue, share_ns, audio_counts);
+  latency_budget_apply_queue (video_queue, share_ns, video_counts);
+}
+
+/* Buffers the queue has thrown away so far: everything that went in and
+ * neither came out nor is still queued.
+ */
+static inline gint
+latency_budget_drops (LatencyBudgetQueue * counts)
+{
+  guint level = 0;
+
+  g_object_get (counts->queue, "current-level-buffers", &level, NULL);
+  return MAX (0, g_atomic_int_get (&counts->in) -
+      g_atomic_int_get (&counts->out) - (gint) level);
+}
+
+G_END_DECLS
+
+#endif /* LATENCY_BUDGET_H */
@@ -0,0 +1,358 @@
+/* Audio-to-photon latency instrumentation for the visualizer pipelines.
+ *
+ * A LatencyProbe watches three pads:
+ *
+ *   audio - where audio enters the visualizer path (q1's src pad, @blockpad
+ *           in p1-2.c). Each buffer is stamped with the wall clock time and
+ *           the end of the audio it carries.
+ *   scope - the visualizer output. A frame at PTS t is drawn from the audio
+ *           up to t plus one frame, so it is matched with the stamp of the
+ *           audio buffer that ends there.
+ *   sink  - the video sink's sink pad. For a synchronizing GstBaseSink the
+ *           time the buffer will wait for its render time is added, which
+ *           gives the moment the frame is handed to the display (the display
+ *           itself adds its own delay on top).
+ *
+ * Over the last LATENCY_WINDOW frames it keeps the latency from audio to
+ * scope output, from scope output to sink and from audio to sink. Every
+ * LATENCY_REPORT_MS milliseconds it posts a "latency-stats" element message
+ * from the sink with p50, p99 and max of each (doubles, in milliseconds):
+ *
+ *   audio-to-scope-p50, audio-to-scope-p99, audio-to-scope-max,
+ *   scope-to-sink-p50, ..., audio-to-sink-max
+ *
+ * and, if an overlay element was given, shows the audio-to-sink figures in
+ * its "text" property. Nothing here needs a display, so it works the same
+ * with a fakesink.
+ */
+
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <gst/gst.h>
+#include <gst/base/gstbasesink.h>
+#include <stdlib.h>
+#include <string.h>
+
+G_BEGIN_DECLS
+
+// Audio buffers and frames remembered for matching. They only need to cover
+// the buffers in flight between the audio pad and the sink.
+#define LATENCY_AUDIO_STAMPS 1024
+#define LATENCY_FRAME_STAMPS 256
+
+#ifndef LATENCY_WINDOW
+#define LATENCY_WINDOW 600
+#endif
+
+#ifndef LATENCY_REPORT_MS
+#define LATENCY_REPORT_MS 1000
+#endif
+
+typedef enum
+{
+  LATENCY_AUDIO_TO_SCOPE,
+  LATENCY_SCOPE_TO_SINK,
+  LATENCY_AUDIO_TO_SINK,
+  LATENCY_N_SEGMENTS
+} LatencySegment;
+
+static const gchar *const latency_segment_names[LATENCY_N_SEGMENTS] = {
+  "audio-to-scope", "scope-to-sink", "audio-to-sink",
+};
+
+typedef struct
+{
+  gdouble p50_ms;
+  gdouble p99_ms;
+  gdouble max_ms;
+} LatencyStats;
+
+typedef struct
+{
+  GstClockTime end;
+  gint64 wall_us;
+} LatencyAudioStamp;
+
+typedef struct
+{
+  GstClockTime pts;
+  gint64 audio_us;
+  gint64 scope_us;
+} LatencyFrameStamp;
+
+typedef struct _LatencyProbe
+{
+  GMutex lock;
+
+  // Rings, written at @audio_head and @frame_head.
+  LatencyAudioStamp audio[LATENCY_AUDIO_STAMPS];
+  guint audio_head;
+  guint audio_len;
+  LatencyFrameStamp frames[LATENCY_FRAME_STAMPS];
+  guint frame_head;
+  guint frame_len;
+
+  // Latency of the last @window_len frames, in microseconds.
+  gint64 window[LATENCY_N_SEGMENTS][LATENCY_WINDOW];
+  guint window_head;
+  guint window_len;
+
+  gint64 last_report_us;
+  GstElement *overlay;
+} LatencyProbe;
+
+static inline gint64
+latency_percentile (gint64 * sorted, guint n, guint percent)
+{
+  return sorted[MIN (n - 1, n * percent / 100)];
+}
+
+static inline int
+latency_compare (const void *a, const void *b)
+{
+  gint64 x = *(const gint64 *) a, y = *(const gint64 *) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Compute the stats of @segment over the current window. Returns FALSE if no
+ * frame has been matched yet.
+ */
+static inline gboolean
+latency_probe_get_stats (LatencyProbe * probe, LatencySegment segment,
+    LatencyStats * stats)
+{
+  gint64 *sorted = g_new (gint64, LATENCY_WINDOW);
+  guint n;
+
+  g_mutex_lock (&probe->lock);
+  n = probe->window_len;
+  memcpy (sorted, probe->window[segment], n * sizeof sorted[0]);
+  g_mutex_unlock (&probe->lock);
+
+  if (n) {
+    qsort (sorted, n, sizeof sorted[0], latency_compare);
+    stats->p50_ms = latency_percentile (sorted, n, 50) / 1e3;
+    stats->p99_ms = latency_percentile (sorted, n, 99) / 1e3;
+    stats->max_ms = sorted[n - 1] / 1e3;
+  }
+
+  g_free (sorted);
+  return n > 0;
+}
+
+static inline GstPadProbeReturn
+latency_audio_cb (GstPad * pad, GstPadProbeInfo * info, LatencyProbe * probe)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer) ||
+      !GST_BUFFER_DURATION_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+
+  g_mutex_lock (&probe->lock);
+  probe->audio[probe->audio_head].end =
+      GST_BUFFER_PTS (buffer) + GST_BUFFER_DURATION (buffer);
+  probe->audio[probe->audio_head].wall_us = g_get_monotonic_time ();
+  probe->audio_head = (probe->audio_head + 1) % LATENCY_AUDIO_STAMPS;
+  probe->audio_len = MIN (probe->audio_len + 1, LATENCY_AUDIO_STAMPS);
+  g_mutex_unlock (&probe->lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static inline GstPadProbeReturn
+latency_scope_cb (GstPad * pad, GstPadProbeInfo * info, LatencyProbe * probe)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  gint64 now = g_get_monotonic_time ();
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+
+  GstClockTime needed = GST_BUFFER_PTS (buffer);
+  if (GST_BUFFER_DURATION_IS_VALID (buffer))
+    needed += GST_BUFFER_DURATION (buffer);
+
+  g_mutex_lock (&probe->lock);
+
+  // The audio stamps are in time order. Find the oldest buffer that reaches
+  // @needed, walking back from the newest.
+  gint64 audio_us = -1;
+  for (guint i = 1; i <= probe->audio_len; i++) {
+    LatencyAudioStamp *stamp = &probe->audio[(probe->audio_head +
+            LATENCY_AUDIO_STAMPS - i) % LATENCY_AUDIO_STAMPS];
+    if (stamp->end < needed)
+      break;
+    audio_us = stamp->wall_us;
+  }
+
+  if (audio_us >= 0) {
+    LatencyFrameStamp *frame = &probe->frames[probe->frame_head];
+    frame->pts = GST_BUFFER_PTS (buffer);
+    frame->audio_us = audio_us;
+    frame->scope_us = now;
+    probe->frame_head = (probe->frame_head + 1) % LATENCY_FRAME_STAMPS;
+    probe->frame_len = MIN (probe->frame_len + 1, LATENCY_FRAME_STAMPS);
+  }
+
+  g_mutex_unlock (&probe->lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* How long a synchronizing sink will hold @buffer before rendering it, in
+ * microseconds.
+ */
+static inline gint64
+latency_render_wait_us (GstPad * pad, GstBuffer * buffer)
+{
+  GstElement *element = GST_ELEMENT (GST_PAD_PARENT (pad));
+  gint64 wait = 0;
+
+  if (!GST_IS_BASE_SINK (element) ||
+      !gst_base_sink_get_sync (GST_BASE_SINK (element)))
+    return 0;
+
+  GstClock *clock = gst_element_get_clock (element);
+  GstEvent *event = gst_pad_get_sticky_event (pad, GST_EVENT_SEGMENT, 0);
+
+  if (clock && event) {
+    const GstSegment *segment;
+    gst_event_parse_segment (event, &segment);
+
+    GstClockTime running = gst_segment_to_running_time (segment,
+        GST_FORMAT_TIME, GST_BUFFER_PTS (buffer));
+    if (GST_CLOCK_TIME_IS_VALID (running)) {
+      GstBaseSink *sink = GST_BASE_SINK (element);
+      GstClockTime render = gst_element_get_base_time (element) + running +
+          gst_base_sink_get_latency (sink) +
+          gst_base_sink_get_render_delay (sink);
+      GstClockTimeDiff diff = GST_CLOCK_DIFF (gst_clock_get_time (clock),
+          render);
+      wait = MAX (diff, 0) / GST_USECOND;
+    }
+  }
+
+  if (event)
+    gst_event_unref (event);
+  if (clock)
+    gst_object_unref (clock);
+  return wait;
+}
+
+static inline void
+latency_probe_report (LatencyProbe * probe, GstElement * element)
+{
+  GstStructure *s = gst_structure_new_empty ("latency-stats");
+  LatencyStats stats[LATENCY_N_SEGMENTS];
+
+  for (guint i = 0; i < LATENCY_N_SEGMENTS; i++) {
+    if (!latency_probe_get_stats (probe, i, &stats[i])) {
+      gst_structure_free (s);
+      return;
+    }
+
+    gchar *p50 = g_strdup_printf ("%s-p50", latency_segment_names[i]);
+    gchar *p99 = g_strdup_printf ("%s-p99", latency_segment_names[i]);
+    gchar *max = g_strdup_printf ("%s-max", latency_segment_names[i]);
+    gst_structure_set (s, p50, G_TYPE_DOUBLE, stats[i].p50_ms,
+        p99, G_TYPE_DOUBLE, stats[i].p99_ms,
+        max, G_TYPE_DOUBLE, stats[i].max_ms, NULL);
+    g_free (p50);
+    g_free (p99);
+    g_free (max);
+  }
+
+  if (probe->overlay) {
+    gchar *text = g_strdup_printf ("audio to sink: p50 %.1f ms, "
+        "p99 %.1f ms, max %.1f ms", stats[LATENCY_AUDIO_TO_SINK].p50_ms,
+        stats[LATENCY_AUDIO_TO_SINK].p99_ms,
+        stats[LATENCY_AUDIO_TO_SINK].max_ms);
+    g_object_set (probe->overlay, "text", text, NULL);
+    g_free (text);
+  }
+
+  gst_element_post_message (element,
+      gst_message_new_element (GST_OBJECT (element), s));
+}
+
+static inline GstPadProbeReturn
+latency_sink_cb (GstPad * pad, GstPadProbeInfo * info, LatencyProbe * probe)
+{
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER (info);
+  gint64 now = g_get_monotonic_time ();
+
+  if (!GST_BUFFER_PTS_IS_VALID (buffer))
+    return GST_PAD_PROBE_OK;
+
+  gint64 shown = now + latency_render_wait_us (pad, buffer);
+  gboolean report = FALSE;
+
+  g_mutex_lock (&probe->lock);
+
+  for (guint i = 1; i <= probe->frame_len; i++) {
+    LatencyFrameStamp *frame = &probe->frames[(probe->frame_head +
+            LATENCY_FRAME_STAMPS - i) % LATENCY_FRAME_STAMPS];
+    if (frame->pts != GST_BUFFER_PTS (buffer))
+      continue;
+
+    guint slot = probe->window_head;
+    probe->window[LATENCY_AUDIO_TO_SCOPE][slot] =
+        frame->scope_us - frame->audio_us;
+    probe->window[LATENCY_SCOPE_TO_SINK][slot] = shown - frame->scope_us;
+    probe->window[LATENCY_AUDIO_TO_SINK][slot] = shown - frame->audio_us;
+    probe->window_head = (slot + 1) % LATENCY_WINDOW;
+    probe->window_len = MIN (probe->window_len + 1, LATENCY_WINDOW);
+    break;
+  }
+
+  if (now - probe->last_report_us >= LATENCY_REPORT_MS * 1000) {
+    probe->last_report_us = now;
+    report = TRUE;
+  }
+
+  g_mutex_unlock (&probe->lock);
+
+  if (report)
+    latency_probe_report (probe, GST_ELEMENT (GST_PAD_PARENT (pad)));
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* Start measuring on the three pads. The probe must outlive the pipeline's
+ * dataflow; free it after the pipeline is back in NULL.
+ */
+static inline LatencyProbe *
+latency_probe_new (GstPad * audio_pad, GstPad * scope_pad, GstPad * sink_pad)
+{
+  LatencyProbe *probe = g_new0 (LatencyProbe, 1);
+
+  g_mutex_init (&probe->lock);
+  probe->last_report_us = g_get_monotonic_time ();
+
+  gst_pad_add_probe (audio_pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) latency_audio_cb, probe, NULL);
+  gst_pad_add_probe (scope_pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) latency_scope_cb, probe, NULL);
+  gst_pad_add_probe (sink_pad, GST_PAD_PROBE_TYPE_BUFFER,
+      (GstPadProbeCallback) latency_sink_cb, probe, NULL);
+  return probe;
+}
+
+/* Also show the figures in the "text" property of @overlay (a textoverlay). */
+static inline void
+latency_probe_set_overlay (LatencyProbe * probe, GstElement * overlay)
+{
+  probe->overlay = overlay;
+}
+
+static inline void
+latency_probe_free (LatencyProbe * probe)
+{
+  g_mutex_clear (&probe->lock);
+  g_free (probe);
+}
+
+G_END_DECLS
+
+#endif /* LATENCY_H */
@@ -0,0 +1,229 @@
+/* A visualizer for multi-channel audio: one visualizer per channel, each in
+ * its own tile of a single video output.
+ *
+ *   sink -> deinterleave -+-> q0 -> audioconvert -> <factory> -> tile -+
+ *                         +-> q1 -> audioconvert -> <factory> -> tile -+
+ *                         ...                                          |
+ *                                                 src <- compositor <--+
+ *
+ * The audio is split into channels once. Each channel then has a queue of its
+ * own, so the visualizers render in parallel on as many streaming threads as
+ * there are channels, and the compositor lays their frames out in a grid of
+ * ceil(sqrt(n)) columns that fills the output size. multiscope_set_format
+ * changes that size, and the frame rate. The whole thing is one bin with an
+ * audio sink pad and a video src pad, so it can stand anywhere a single
+ * visualizer element can, including being swapped in and out by p1-2.c.
+ *
+ * The input must have exactly the number of channels the bin was made for:
+ * a tile with no channel feeding it would hold up the compositor.
+ */
+
+#ifndef MULTISCOPE_H
+#define MULTISCOPE_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+// Queued audio buffers per channel. Small, so a slow tile holds up the
+// deinterleave (and whatever is in front of the bin) soon, instead of adding
+// latency.
+#define MULTISCOPE_QUEUE_BUFFERS 3
+
+/* deinterleave adds its src_%u pads once it knows the channel count, and
+ * again after every trip through READY. Link each to its channel's queue.
+ */
+static inline void
+multiscope_pad_added_cb (GstElement * deinterleave, GstPad * pad,
+    GstBin * bin)
+{
+  const gchar *name = GST_PAD_NAME (pad);
+  gchar *queue_name;
+  GstElement *queue;
+  GstPad *sinkpad;
+
+  if (!g_str_has_prefix (name, "src_"))
+    return;
+
+  queue_name = g_strdup_printf ("q%s", name + 4);
+  queue = gst_bin_get_by_name (bin, queue_name);
+  g_free (queue_name);
+  if (!queue) {
+    GST_WARNING_OBJECT (bin, "no tile for %s", name);
+    return;
+  }
+
+  sinkpad = gst_element_get_static_pad (queue, "sink");
+  if (gst_pad_link (pad, sinkpad) != GST_PAD_LINK_OK)
+    GST_WARNING_OBJECT (bin, "could not link %s", name);
+  gst_object_unref (sinkpad);
+  gst_object_unref (queue);
+}
+
+/* Where tile @i of @n_channels goes in a @width x @height output, and its
+ * size: ceil(sqrt(n)) columns, and as many rows as that takes.
+ */
+static inline void
+multiscope_tile_rect (guint i, guint n_channels, gint width, gint height,
+    gint * x, gint * y, gint * tile_width, gint * tile_height)
+{
+  guint columns = 1, rows;
+
+  while (columns * columns < n_channels)
+    columns++;
+  rows = (n_channels + columns - 1) / columns;
+
+  *tile_width = width / columns;
+  *tile_height = height / MAX (rows, 1);
+  *x = (gint) (i % columns) * *tile_width;
+  *y = (gint) (i / columns) * *tile_height;
+}
+
+/* Makes a (floating) multi-channel visualizer with @n_channels tiles in a
+ * @width x @height output, each showing one channel with an element of
+ * @factory. Returns NULL if an element can't be created.
+ */
+static inline GstElement *
+multiscope_new (const gchar * factory, guint n_channels, gint width,
+    gint height)
+{
+  static gint count;
+  gchar *name = g_strdup_printf ("multi%s%d", factory,
+      g_atomic_int_add (&count, 1));
+  GstElement *bin = gst_bin_new (name);
+  GstElement *deinterleave = gst_element_factory_make ("deinterleave", NULL);
+  GstElement *compositor = gst_element_factory_make ("compositor", NULL);
+  gint x, y, tile_width, tile_height;
+  GstCaps *tile_caps;
+  GstPad *pad;
+
+  g_free (name);
+  multiscope_tile_rect (0, n_channels, width, height, &x, &y, &tile_width,
+      &tile_height);
+
+  if (!deinterleave || !compositor) {
+    if (deinterleave)
+      gst_object_unref (gst_object_ref_sink (deinterleave));
+    if (compositor)
+      gst_object_unref (gst_object_ref_sink (compositor));
+    gst_object_unref (gst_object_ref_sink (bin));
+    return NULL;
+  }
+
+  g_object_set (compositor, "background", 1 /* black */ , NULL);
+  gst_bin_add_many (GST_BIN (bin), deinterleave, compositor, NULL);
+  g_signal_connect (deinterleave, "pad-added",
+      G_CALLBACK (multiscope_pad_added_cb), bin);
+
+  tile_caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT,
+      tile_width, "height", G_TYPE_INT, tile_height, NULL);
+
+  for (guint i = 0; i < n_channels; i++) {
+    gchar *queue_name = g_strdup_printf ("q%u", i);
+    gchar *tile_name = g_strdup_printf ("tile%u", i);
+    GstElement *queue = gst_element_factory_make ("queue", queue_name);
+    GstElement *convert = gst_element_factory_make ("audioconvert", NULL);
+    GstElement *scope = gst_element_factory_make (factory, NULL);
+    GstElement *tile = gst_element_factory_make ("capsfilter", tile_name);
+    GstPad *tile_pad, *mixer_pad;
+
+    g_free (queue_name);
+    g_free (tile_name);
+    if (!queue || !convert || !scope || !tile) {
+      // Whatever was made is floating; the rest of the bin goes with it.
+      if (queue)
+        gst_object_unref (gst_object_ref_sink (queue));
+      if (convert)
+        gst_object_unref (gst_object_ref_sink (convert));
+      if (scope)
+        gst_object_unref (gst_object_ref_sink (scope));
+      if (tile)
+        gst_object_unref (gst_object_ref_sink (tile));
+      gst_caps_unref (tile_caps);
+      gst_object_unref (gst_object_ref_sink (bin));
+      return NULL;
+    }
+
+    g_object_set (queue, "max-size-buffers", MULTISCOPE_QUEUE_BUFFERS,
+        "max-size-bytes", 0, "max-size-time", (guint64) 0, NULL);
+    g_object_set (tile, "caps", tile_caps, NULL);
+
+    gst_bin_add_many (GST_BIN (bin), queue, convert, scope, tile, NULL);
+    gst_element_link_many (queue, convert, scope, tile, NULL);
+
+    multiscope_tile_rect (i, n_channels, width, height, &x, &y, &tile_width,
+        &tile_height);
+    mixer_pad = gst_element_get_request_pad (compositor, "sink_%u");
+    g_object_set (mixer_pad, "xpos", x, "ypos", y, NULL);
+    tile_pad = gst_element_get_static_pad (tile, "src");
+    gst_pad_link (tile_pad, mixer_pad);
+    gst_object_unref (tile_pad);
+    gst_object_unref (mixer_pad);
+  }
+  gst_caps_unref (tile_caps);
+
+  pad = gst_element_get_static_pad (deinterleave, "sink");
+  gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+  gst_object_unref (pad);
+
+  pad = gst_element_get_static_pad (compositor, "src");
+  gst_element_add_pad (bin, gst_ghost_pad_new ("src", pad));
+  gst_object_unref (pad);
+
+  return bin;
+}
+
+/* Lays the tiles of @bin, made by multiscope_new, out for a @width x @height
+ * output, and has each render @fps frames per second (if @fps is 0, as many
+ * as it likes). Each visualizer renegotiates on its next buffer. Safe while
+ * streaming.
+ */
+static inline void
+multiscope_set_format (GstElement * bin, gint width, gint height, gint fps)
+{
+  guint n_channels = 0;
+  GstElement *tile;
+
+  // The tiles are named tile0, tile1, ...; count them.
+  for (;; n_channels++) {
+    gchar *tile_name = g_strdup_printf ("tile%u", n_channels);
+    tile = gst_bin_get_by_name (GST_BIN (bin), tile_name);
+    g_free (tile_name);
+    if (!tile)
+      break;
+    gst_object_unref (tile);
+  }
+
+  for (guint i = 0; i < n_channels; i++) {
+    gchar *tile_name = g_strdup_printf ("tile%u", i);
+    gint x, y, tile_width, tile_height;
+    GstCaps *tile_caps;
+    GstPad *tile_pad, *mixer_pad;
+
+    tile = gst_bin_get_by_name (GST_BIN (bin), tile_name);
+    g_free (tile_name);
+    multiscope_tile_rect (i, n_channels, width, height, &x, &y, &tile_width,
+        &tile_height);
+
+    tile_caps = gst_caps_new_simple ("video/x-raw", "width", G_TYPE_INT,
+        tile_width, "height", G_TYPE_INT, tile_height, NULL);
+    if (fps > 0)
+      gst_caps_set_simple (tile_caps, "framerate", GST_TYPE_FRACTION, fps, 1,
+          NULL);
+    g_object_set (tile, "caps", tile_caps, NULL);
+    gst_caps_unref (tile_caps);
+
+    tile_pad = gst_element_get_static_pad (tile, "src");
+    mixer_pad = gst_pad_get_peer (tile_pad);
+    if (mixer_pad) {
+      g_object_set (mixer_pad, "xpos", x, "ypos", y, NULL);
+      gst_object_unref (mixer_pad);
+    }
+    gst_object_unref (tile_pad);
+    gst_object_unref (tile);
+  }
+}
+
+G_END_DECLS
+
+#endif /* MULTISCOPE_H */
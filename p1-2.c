@@ -1,18 +1,172 @@
 /*
-clear && gcc -g p1-1.c -o p1-1 `pkg-config --cflags --libs gtk+-3.0 gstreamer-video-1.0` && ./p1-1
+clear && gcc -g p1-2.c -o p1-2 `pkg-config --cflags --libs gtk+-3.0 gstreamer-video-1.0 gstreamer-app-1.0` && ./p1-2
 */
 
 /* GTK/GStreamer example application with a dynamic pipeline. Click the buttons
  * to select from four types of audiovisualizer element. The input source is a
- * JACK Audio Source.
+ * JACK Audio Source. A tee right after the source also plays the audio back
+ * through AUDIO_SINK, on a branch of its own, so nothing the visualizers or
+ * GTK do can hold up the speaker.
+ *
+ * Build options (pass with -D on the gcc line above):
+ *
+ *   COLD_SWAP - Swap visualizers the original way: the next element is added,
+ *               linked and started only after the pad is blocked. By default
+ *               the next element is pre-warmed (PAUSED, input and output caps
+ *               negotiated) before the pad is blocked, so once the old
+ *               element has drained, the blocked window is only the relink.
+ *               Each swap prints its whole stall, and the drain and relink
+ *               times it is made of.
+ *
+ *   SELECTOR_BANK - Keep all four visualizers linked between an
+ *               output-selector and an input-selector and switch by changing
+ *               the active branch. Nothing is blocked or drained, and only the
+ *               active visualizer receives audio.
+ *
+ *   CROSSFADE - Like SELECTOR_BANK, but the outgoing and incoming visualizers
+ *               both run for CROSSFADE_FRAMES frames while the incoming one is
+ *               faded in on top by a single compositor in front of conv_after.
+ *               At most two visualizers run at any time.
+ *
+ *   PROTOSCOPE - Use the in-tree visualizers from visualizers/protoscope.c
+ *               instead of the stock ones, behind a protospectrum stage after
+ *               q1 that computes the spectrum once for all of them. Add
+ *               visualizers/protoscope.c visualizers/protospectrum.c and
+ *               gstreamer-pbutils-1.0 gstreamer-fft-1.0 to the gcc line.
+ *
+ *   SWITCH_STRESS - Fire 1,000 random visualizer switches per second for 30
+ *               seconds, then check that the last swap finished and that no
+ *               elements or references were leaked. Prints PASS or FAIL and
+ *               exits non-zero on failure. Not with SELECTOR_BANK/CROSSFADE.
+ *
+ *   LATENCY_OVERLAY - Also draw the audio-to-sink latency figures from
+ *               latency.h over the video, with a textoverlay in front of
+ *               conv_after. They are always printed from the bus.
+ *
+ *   LATENCY_BUDGET_MS=n - Size q1 and q2 for n milliseconds of latency in
+ *               total and make them drop their oldest buffers when full,
+ *               instead of holding up to a second each and blocking. See
+ *               latency-budget.h for the trade-off. The drop counts are
+ *               printed every 10 seconds.
+ *
+ *   VIS_POOL_WARM=n - Keep up to n swapped-out visualizers warm in the
+ *               visualizer pool (default 2), see vispool.h. Only the first
+ *               visualizer is created at startup; the others are created when
+ *               first selected. Ignored by SELECTOR_BANK and CROSSFADE, which
+ *               need all four linked from the start.
+ *
+ *   FAST_STARTUP - Have gst_init load only the plugins the prototype uses,
+ *               from the private plugin directory and registry cache of
+ *               faststart.h, instead of checking every plugin on the system.
+ *               Build and run fast-startup-setup.c first. The time from main
+ *               to the first rendered frame is printed either way.
+ *
+ *   MULTICHANNEL=n - Take n channels from JACK and show each on its own
+ *               visualizer, as tiles of one picture. Every visualizer the
+ *               buttons select is a multiscope.h bin of n of them behind one
+ *               deinterleave. Not with PROTOSCOPE.
+ *
+ *   SURFACE_SINK - Show the video with the SurfaceSink of surfacesink.h
+ *               instead of gtksink: the streaming thread writes each frame
+ *               into a triple-buffered Cairo surface of the drawing area's
+ *               size, and the main thread only flips buffers and paints them
+ *               1:1. The main thread time per frame is printed every 10
+ *               seconds either way.
+ *
+ *   RESIZE_DEBOUNCE_MS=n - The visualizers render at the video widget's size
+ *               in device pixels (its allocation times the HiDPI scale
+ *               factor) and are renegotiated to the new size once the widget
+ *               has kept it for n milliseconds (default 200), so dragging the
+ *               window edge renegotiates once, not on every step.
+ *
+ *   HIDDEN_FPS=n, THROTTLE_MIN_FPS=n - The frame-rate governor of governor.h
+ *               has the visualizers render at the monitor's refresh rate
+ *               while the window is visible, halving it down to
+ *               THROTTLE_MIN_FPS (default 15) while the system is short of
+ *               CPU, and at HIDDEN_FPS (default 1; the visualizers can't do
+ *               0) while the window is minimized or covered. The CPU used in
+ *               each state is printed every 10 seconds.
+ *
+ *   UNGOVERNED - Leave the frame rate to the visualizers, as before the
+ *               governor. The states and their CPU use are still tracked and
+ *               printed, to compare against.
+ *
+ *   PROTOTRACE - Trace the pipeline with the in-tree tracer of
+ *               tracers/prototrace.c: per-element processing time and buffer
+ *               counts, the fill levels of q1 and q2 (and every other queue)
+ *               and the swap stalls. `kill -USR1` the process to write the
+ *               last records to PROTOTRACE_FILE (default prototrace.csv);
+ *               they are also written on exit. Add tracers/prototrace.c to
+ *               the gcc line.
+ *
+ *   HUD - Lay a live performance HUD from hud.h over the video: frames per
+ *               second reaching the sink and frames dropped, swap stall time,
+ *               q1 and q2 levels and audio-to-sink latency, updated 4 times a
+ *               second. The streaming threads only bump counters for it.
  */
 
 #include <gtk/gtk.h>
 #include <gst/gst.h>
 #include <gst/video/videooverlay.h>
+#include <gst/base/gstbasetransform.h>
 
 #include <assert.h> // <0.o> This program will fail due to assertions.
 
+#include "cmdring.h"
+#include "cputime.h"
+#include "latency.h"
+#include "latency-budget.h"
+#include "vispool.h"
+#include "faststart.h"
+#include "multiscope.h"
+#include "surfacesink.h"
+#include "governor.h"
+#include "hud.h"
+
+#ifdef PROTOSCOPE
+#include "visualizers/protoscope.h"
+#include "visualizers/protospectrum.h"
+#endif
+
+#ifdef PROTOTRACE
+#include "tracers/prototrace.h"
+
+#ifndef PROTOTRACE_FILE
+#define PROTOTRACE_FILE "prototrace.csv"
+#endif
+#endif
+
+// SELECTOR_BANK and CROSSFADE switch between visualizer branches that stay
+// linked; the other builds swap the visualizer element itself.
+#if defined (SELECTOR_BANK) || defined (CROSSFADE)
+#define BRANCH_SWITCH
+#elif !defined (COLD_SWAP)
+#define PREWARM_SWAP
+#endif
+
+#if defined (MULTICHANNEL) && defined (PROTOSCOPE)
+#error "PROTOSCOPE analyzes the interleaved stream; build without MULTICHANNEL"
+#endif
+
+#ifndef RESIZE_DEBOUNCE_MS
+#define RESIZE_DEBOUNCE_MS 200
+#endif
+
+// The video widget opens at 800x600 but can be shrunk down to this.
+#define VIDEO_MIN_WIDTH 160
+#define VIDEO_MIN_HEIGHT 120
+
+#ifndef HIDDEN_FPS
+#define HIDDEN_FPS 1
+#endif
+#ifndef THROTTLE_MIN_FPS
+#define THROTTLE_MIN_FPS 15
+#endif
+
+#if defined (SWITCH_STRESS) && defined (BRANCH_SWITCH)
+#error "SWITCH_STRESS tests the pad-probe swap; build without SELECTOR_BANK and CROSSFADE"
+#endif
+
 #include <gdk/gdk.h>
 #if defined (GDK_WINDOWING_X11)
 #include <gdk/gdkx.h>
@@ -30,6 +184,492 @@ static GstElement* cur_effect;
 static GstElement* pipeline;
 static GstElement* effects[] = { NULL, NULL, NULL, NULL, NULL };
 
+// Size the visualizers render at, in device pixels. Follows the video widget,
+// see RESIZE_DEBOUNCE_MS; changed only by the controller thread.
+static gint render_width = 800;
+static gint render_height = 600;
+
+// Frame rate the visualizers render at, set by the governor the same way. 0
+// leaves it to them.
+static gint render_fps;
+
+// Startup time: when main started and when gst_init returned, in
+// microseconds. @first_frame is set once the first frame reaches the sink.
+static gint64 main_start_us;
+static gint64 init_done_us;
+static gint first_frame;
+static gulong first_draw_handler;
+
+/* One-shot buffer probe on the sink pad. */
+static GstPadProbeReturn
+first_frame_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+  g_atomic_int_set (&first_frame, 1);
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* Called after the video widget has drawn. Prints the startup time once it
+ * has drawn the first frame.
+ */
+static gboolean
+first_draw_cb (GtkWidget* widget, cairo_t* cr, gpointer user_data)
+{
+  if (!g_atomic_int_get (&first_frame)) {
+    return FALSE;
+  }
+
+  g_print ("Startup: gst_init %.1f ms, first frame %.1f ms after main\n",
+      (init_done_us - main_start_us) / 1e3,
+      (g_get_monotonic_time() - main_start_us) / 1e3);
+  g_signal_handler_disconnect (widget, first_draw_handler);
+  return FALSE;
+}
+
+#ifdef SURFACE_SINK
+static SurfaceSink* surface_sink;
+
+/* Periodically print how much main thread time showing a frame takes. */
+static gboolean
+report_main_thread (gpointer user_data)
+{
+  gint written, shown;
+  gdouble us = surface_sink_take_stats (surface_sink, &written, &shown);
+  g_print ("Main thread: %.1f us per frame, %d frames shown of %d rendered\n",
+      us, shown, written);
+  return G_SOURCE_CONTINUE;
+}
+#else
+// Main thread time spent in gtksink's draw handler, and how often it ran.
+static gint64 draw_start_us;
+static gint64 draw_us;
+static gint draws;
+
+static gboolean
+draw_begin_cb (GtkWidget* widget, cairo_t* cr, gpointer user_data)
+{
+  draw_start_us = g_get_monotonic_time ();
+  return FALSE;
+}
+
+static gboolean
+draw_end_cb (GtkWidget* widget, cairo_t* cr, gpointer user_data)
+{
+  draw_us += g_get_monotonic_time () - draw_start_us;
+  draws++;
+  return FALSE;
+}
+
+/* Periodically print how much main thread time showing a frame takes. */
+static gboolean
+report_main_thread (gpointer user_data)
+{
+  g_print ("Main thread: %.1f us per frame, %d frames shown\n",
+      draws ? (gdouble) draw_us / draws : 0, draws);
+  draw_us = 0;
+  draws = 0;
+  return G_SOURCE_CONTINUE;
+}
+#endif
+
+// Where @effects come from. An entry of @effects is NULL while its visualizer
+// is not in use; the controller thread acquires it from the pool when it is
+// selected and releases it back once it has been swapped out.
+#ifndef VIS_POOL_WARM
+#define VIS_POOL_WARM 2
+#endif
+static VisPool* vis_pool;
+
+#ifdef MULTICHANNEL
+/* How the pool makes visualizers: a multiscope bin with MULTICHANNEL of
+ * factory @name, one per input channel.
+ */
+static GstElement*
+make_multiscope (const gchar* name, gpointer user_data)
+{
+  GstElement* bin = multiscope_new (name, MULTICHANNEL, render_width,
+      render_height);
+  if (bin) {
+    multiscope_set_format (bin, render_width, render_height, render_fps);
+  }
+  return bin;
+}
+#endif
+
+/* Periodically print how well the visualizer pool does. */
+static gboolean
+report_vis_pool (gpointer user_data)
+{
+  gint hits, misses, evictions;
+  vis_pool_get_stats (vis_pool, &hits, &misses, &evictions);
+  g_print ("Visualizer pool: %d hits, %d misses, %d evicted\n", hits, misses,
+      evictions);
+  return G_SOURCE_CONTINUE;
+}
+
+// Commands for the controller thread: @ui_ring is filled by the GTK main
+// thread, @swap_ring by the streaming thread that finishes a swap. Both wake
+// the controller through @controller_waiter.
+static CmdRing ui_ring;
+static CmdRing swap_ring;
+static CmdWaiter controller_waiter;
+static GThread* controller;
+
+#ifdef HUD
+static Hud hud;
+
+static gboolean
+hud_update_cb (gpointer user_data)
+{
+  hud_update (&hud);
+  return G_SOURCE_CONTINUE;
+}
+#endif
+
+// The audio playback branch: tee -> queue -> audioconvert -> audioresample ->
+// AUDIO_SINK. The sink asks for a short buffer so it adds little latency.
+#define AUDIO_SINK "jackaudiosink"
+#define AUDIO_BUFFER_US 20000
+#define AUDIO_LATENCY_US 5000
+
+static GstElement* audio_sink;
+
+// Audio xruns: discontinuities reaching @audio_sink (the source overran or
+// something upstream dropped audio) plus QoS messages from it (it had to drop
+// or skip late audio).
+static gint xruns;
+
+/* Buffer probe on the @audio_sink sink pad. The first buffer of a stream is
+ * always DISCONT, so it isn't counted.
+ */
+static GstPadProbeReturn
+audio_discont_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+  static gboolean started;
+
+  if (GST_BUFFER_IS_DISCONT (GST_PAD_PROBE_INFO_BUFFER (info)) && started) {
+    g_atomic_int_inc (&xruns);
+  }
+  started = TRUE;
+  return GST_PAD_PROBE_OK;
+}
+
+/* This function is called when a QoS message is posted on the bus. */
+static void
+qos_cb (GstBus *bus, GstMessage *msg)
+{
+  if (GST_MESSAGE_SRC (msg) == GST_OBJECT (audio_sink)) {
+    g_atomic_int_inc (&xruns);
+  }
+#ifdef HUD
+  hud_qos (&hud, msg);
+#endif
+}
+
+/* Periodically print the audio xrun count. */
+static gboolean
+report_xruns (gpointer user_data)
+{
+  g_print ("Audio xruns: %d\n", g_atomic_int_get (&xruns));
+  return G_SOURCE_CONTINUE;
+}
+
+// Measures the latency from @blockpad to the sink, see latency.h.
+static LatencyProbe* latency;
+
+#ifdef LATENCY_BUDGET_MS
+// Buffers into and out of q1 (audio) and q2 (video).
+static LatencyBudgetQueue q1_counts;
+static LatencyBudgetQueue q2_counts;
+
+/* Periodically print how many buffers the leaky queues have dropped. */
+static gboolean
+report_queue_drops (gpointer user_data)
+{
+  g_print ("Dropped by the %d ms latency budget: %d audio buffers, "
+      "%d video frames\n", LATENCY_BUDGET_MS, latency_budget_drops (&q1_counts),
+      latency_budget_drops (&q2_counts));
+  return G_SOURCE_CONTINUE;
+}
+#endif
+
+// Caps filter between the visualizer output and conv_after. It holds the
+// visualizers to a format the sink takes as-is (@sink_caps), so conv_after
+// runs in passthrough.
+static GstElement* scope_filter;
+static GstCaps* sink_caps;
+
+// Frames seen by conv_after, and how many of those it had to convert.
+static gint frames_total;
+static gint frames_converted;
+
+/* Put the current output constraints on @scope_filter: what the sink takes,
+ * at the size of the video widget and the governor's frame rate.
+ */
+static void
+update_scope_caps (void)
+{
+  GstCaps* caps = gst_caps_copy (sink_caps);
+  gst_caps_set_simple (caps, "width", G_TYPE_INT, render_width,
+      "height", G_TYPE_INT, render_height, NULL);
+  if (render_fps > 0) {
+    gst_caps_set_simple (caps, "framerate", GST_TYPE_FRACTION, render_fps, 1,
+        NULL);
+  }
+  g_object_set (scope_filter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+}
+
+/* Buffer probe on the conv_after sink pad. Counts the frames that went
+ * through a real color conversion.
+ */
+static GstPadProbeReturn
+conversion_count_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+  g_atomic_int_inc (&frames_total);
+  if (!gst_base_transform_is_passthrough (GST_BASE_TRANSFORM (conv_after))) {
+    g_atomic_int_inc (&frames_converted);
+  }
+  return GST_PAD_PROBE_OK;
+}
+
+/* Periodically print how many frames conv_after had to convert. */
+static gboolean
+report_conversion (gpointer user_data)
+{
+  g_print ("Frames converted: %d of %d\n", g_atomic_int_get (&frames_converted),
+      g_atomic_int_get (&frames_total));
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+quit_idle_cb (gpointer user_data)
+{
+  gtk_main_quit ();
+  return G_SOURCE_REMOVE;
+}
+
+/* Quit the application from any thread. gtk_main_quit() itself must run in
+ * the main thread.
+ */
+static void
+request_quit (void)
+{
+  g_idle_add (quit_idle_cb, NULL);
+}
+
+#ifndef BRANCH_SWITCH
+// The visualizer that has been pre-warmed for the pending swap, or NULL.
+static GstElement* next_effect;
+
+// Switch requests are coalesced by the controller thread: while a drain is in
+// flight, a new request only replaces @pending_index (-1 for none), and the
+// last one requested is started once the drain is done. Only the controller
+// thread writes these; the stress test reads them.
+static gint pending_index = -1;
+static gint drain_in_flight;
+
+static gint switches_requested;
+static gint switches_coalesced;
+static gint swaps_done;
+
+// A swap holds up @blockpad while the old visualizer drains (the EOS sent
+// into it comes out) and then while the new one is linked in. The swap stall
+// time is all of it, as upstream sees it; the relink part, which is what
+// pre-warming shortens, and the drain are reported next to it. In
+// microseconds; @block_start_us is written when the pad blocks and
+// @relink_start_us when the EOS comes out.
+static gint64 block_start_us;
+static gint64 relink_start_us;
+static gint64 drain_last_us;
+static gint64 relink_last_us;
+static gint64 stall_last_us;
+static gint64 stall_max_us;
+
+// The probe that holds up @blockpad during a swap. It stays in place until
+// event_probe_cb has relinked, because the EOS may come out of the old
+// visualizer later and on another thread: a multiscope.h bin passes it
+// through its queues and compositor first.
+static gulong block_probe_id;
+
+/* Print the swap stall time for the swap that just finished, also as a
+ * fraction of one video frame of the new visualizer's output, and how it
+ * splits into draining and relinking.
+ */
+static void
+report_swap_stall (GstElement* next)
+{
+  gint64 now = g_get_monotonic_time();
+
+  drain_last_us = relink_start_us - block_start_us;
+  relink_last_us = now - relink_start_us;
+  stall_last_us = now - block_start_us;
+  stall_max_us = MAX (stall_max_us, stall_last_us);
+#ifdef PROTOTRACE
+  // This is the streaming thread that was held up.
+  proto_trace_block (blockpad, stall_last_us * GST_USECOND);
+#endif
+#ifdef HUD
+  hud_set_stall (&hud, stall_last_us, stall_max_us);
+#endif
+
+  gdouble frame_us = 0;
+  GstPad* srcpad = gst_element_get_static_pad (next, "src");
+  GstCaps* caps = gst_pad_get_current_caps (srcpad);
+  if (caps) {
+    gint num = 0, den = 1;
+    if (gst_structure_get_fraction (gst_caps_get_structure (caps, 0),
+            "framerate", &num, &den) && num > 0) {
+      frame_us = 1e6 * den / num;
+    }
+    gst_caps_unref (caps);
+  }
+  gst_object_unref (srcpad);
+
+  g_print ("Swap stall time: %.3f ms (max %.3f ms", stall_last_us / 1e3,
+      stall_max_us / 1e3);
+  if (frame_us > 0) {
+    g_print (", %.2f video frames", stall_last_us / frame_us);
+  }
+  g_print ("): %.3f ms draining, %.3f ms relinking\n", drain_last_us / 1e3,
+      relink_last_us / 1e3);
+}
+
+/* Hand a visualizer that was swapped out, and is out of the pipeline, back to
+ * @vis_pool. Runs in the controller thread.
+ */
+static void
+release_effect (GstElement* old)
+{
+  for (guint i = 0; i < 4; ++i) {
+    if (effects[i] == old) {
+      effects[i] = NULL;
+      vis_pool_release (vis_pool, i, old);
+      return;
+    }
+  }
+}
+
+#ifdef PREWARM_SWAP
+// Stands in for @scope_filter while a visualizer is pre-warmed: it carries
+// the caps @scope_filter had then, so the visualizer negotiates its output
+// against them before it is linked. Its src pad is never linked.
+static GstElement* warm_filter;
+
+/* Hand one of conv_before's sticky events (stream-start, caps, segment) to the
+ * sink pad of a pre-warmed visualizer, so it knows its input caps before it
+ * is linked into the pipeline.
+ */
+static gboolean
+forward_sticky_event (GstPad* pad, GstEvent** event, gpointer sinkpad)
+{
+  gst_pad_send_event (GST_PAD (sinkpad), gst_event_ref (*event));
+  return TRUE;
+}
+
+/* Get @next ready for a swap while data is still flowing: add it to the
+ * pipeline, bring it to PAUSED and negotiate both its input and its output
+ * caps. The blocked window in event_probe_cb then only has to relink it and
+ * set it to PLAYING.
+ *
+ * This runs in the controller thread, before the blocking probe is installed.
+ */
+static void
+prewarm_effect (GstElement* next)
+{
+  if (next == cur_effect || next == next_effect) {
+    return;
+  }
+
+  // An earlier pre-warm that was never swapped in lets go of @warm_filter.
+  if (next_effect) {
+    gst_element_unlink (next_effect, warm_filter);
+    next_effect = NULL;
+  }
+
+  if (!GST_OBJECT_PARENT (next)) {
+    gst_bin_add (GST_BIN (pipeline), next);
+  }
+
+  // Go through READY so an element left over from an earlier swap (which saw
+  // the EOS used to drain it) starts over with fresh pads.
+  gst_element_set_state (next, GST_STATE_READY);
+  gst_element_set_state (next, GST_STATE_PAUSED);
+
+  GstCaps* caps = NULL;
+  g_object_get (scope_filter, "caps", &caps, NULL);
+  g_object_set (warm_filter, "caps", caps, NULL);
+  gst_caps_unref (caps);
+  gst_element_link (next, warm_filter);
+
+  GstPad* srcpad = gst_element_get_static_pad (conv_before, "src");
+  GstPad* sinkpad = gst_element_get_static_pad (next, "sink");
+  gst_pad_sticky_events_foreach (srcpad, forward_sticky_event, sinkpad);
+
+  // A visualizer negotiates its output on its first buffer. An empty one
+  // does that and nothing else; DISCONT makes it forget audio it held from
+  // the last time it was shown.
+  GstBuffer* buffer = gst_buffer_new ();
+  GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+  gst_pad_chain (sinkpad, buffer);
+
+  gst_object_unref (sinkpad);
+  gst_object_unref (srcpad);
+
+  GST_DEBUG_OBJECT (pipeline, "pre-warmed %" GST_PTR_FORMAT, next);
+  next_effect = next;
+}
+
+/* Link the pre-warmed @next to @scope_filter. Streaming thread, pad blocked.
+ */
+static void
+link_prewarmed (GstElement* next)
+{
+  GstCaps* warm_caps = NULL;
+  GstCaps* caps = NULL;
+
+  g_object_get (warm_filter, "caps", &warm_caps, NULL);
+  g_object_get (scope_filter, "caps", &caps, NULL);
+
+  gst_element_unlink (next, warm_filter);
+  gst_element_link (next, scope_filter);
+
+  // Linking asks the visualizer to negotiate again on its next buffer. Its
+  // output caps are already what @scope_filter takes unless a resize or a
+  // frame rate change came in since the pre-warm, so skip that. A multiscope
+  // bin negotiates inside, behind its ghost pad, and does it again anyway.
+  if (gst_caps_is_equal (warm_caps, caps)) {
+    GstPad* srcpad = gst_element_get_static_pad (next, "src");
+    gst_pad_check_reconfigure (srcpad);
+    gst_object_unref (srcpad);
+  }
+
+  gst_caps_unref (warm_caps);
+  gst_caps_unref (caps);
+}
+
+/* Take a visualizer that was swapped out back down to NULL and out of the
+ * pipeline, and release it to the pool. This runs in the controller thread,
+ * after the swap, so it doesn't add to the blocked window.
+ */
+static void
+retire_effect (GstElement* old)
+{
+  // The user may have picked it again since it was swapped out.
+  if (old == cur_effect || old == next_effect) {
+    return;
+  }
+
+  gst_element_set_state (old, GST_STATE_NULL);
+
+  // @effects holds its own reference, so the element survives the bin
+  // dropping its reference on remove.
+  GST_DEBUG_OBJECT (pipeline, "removing %" GST_PTR_FORMAT, old);
+  gst_bin_remove (GST_BIN (pipeline), old);
+
+  release_effect (old);
+}
+#endif
+
 /**
  * @brief event_probe_cb
  * 
@@ -38,7 +678,7 @@ static GstElement* effects[] = { NULL, NULL, NULL, NULL, NULL };
  * 
  */
 static GstPadProbeReturn
-event_probe_cb (GstPad* pad, GstPadProbeInfo* info, GstStructure* data)
+event_probe_cb (GstPad* pad, GstPadProbeInfo* info, gpointer data)
 {
   // Pass until end of stream is reached
   if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_DATA(info)) != GST_EVENT_EOS) {
@@ -47,39 +687,18 @@ event_probe_cb (GstPad* pad, GstPadProbeInfo* info, GstStructure* data)
 
   gst_pad_remove_probe (pad, GST_PAD_PROBE_INFO_ID(info));
 
-  // Unlike gst_structure_get_string, GStreamer's gst_structure_get_int
-  // function needs you to provide the address of a variable where
-  // gst_structure_get_int can write the value. This is simply so that
-  // GStreamer has a way to tell you if there was an error. The
-  // gst_structure_get_int function does this by returning TRUE on
-  // success and FALSE on failure (TRUE and FALSE are GObject macros for
-  // objects of type gboolean);
-  gint index=0;
-  gboolean pass = gst_structure_get_int(data, "index", &index);
-  if (!pass) {
-    // In C, adjacent string literals get concatenated, and all whitespace
-    // between adjacent string literals is ignored.
-    g_print("\nThere is no field with name \"index\", or the existing field "
-            "does not contain an integer.");
-  }
-
-  if (index != 4) {
-    g_print("Button clicked (index=%d)", index);
-  }
-  // TODO otherwise
-  //     get the @id property out of @data
-  //     set @next equal to @effects[@id]
-  //     proceed
-
-  // TODO if the @index property of @data is 4, post a quit message to the
-  //      bus
-  else {
+  // The old visualizer has drained.
+  relink_start_us = g_get_monotonic_time();
+
+  // The controller passes the requested index as the probe's user data.
+  gint index = GPOINTER_TO_INT(data);
+
+  // Index 4 is the quit button. The main thread quits, from an idle callback.
+  if (index == 4) {
     GST_DEBUG_OBJECT (pad, "Quit Button click event received.");
 
-    // Push a "quit" message onto the bus.
-    gst_element_post_message(pipeline,
-        gst_message_new_application(GST_OBJECT (pipeline),
-            gst_structure_new_empty("gtk-main-quit")));
+    gst_pad_remove_probe (blockpad, block_probe_id);
+    request_quit();
 
     return GST_PAD_PROBE_DROP;
   }
@@ -95,11 +714,39 @@ event_probe_cb (GstPad* pad, GstPadProbeInfo* info, GstStructure* data)
   g_print ("Switching from '%s' to '%s'. \n", GST_OBJECT_NAME (cur_effect),
       GST_OBJECT_NAME (next));
 
+#ifdef PREWARM_SWAP
+  // @next was pre-warmed by the controller. Only unlink the current element
+  // here; lowering its state and removing it happens later in the controller
+  // thread, so the pad stays blocked just for the relink.
+  GstElement* old = cur_effect;
+  gst_element_unlink_many (conv_before, old, scope_filter, NULL);
+
+  GST_DEBUG_OBJECT (pipeline, "linking...");
+  gst_element_link (conv_before, next);
+  link_prewarmed (next);
+
+  gst_element_sync_state_with_parent (next);
+
+  cur_effect = next;
+  if (next_effect == next) {
+    next_effect = NULL;
+  }
+
+  gst_pad_remove_probe (blockpad, block_probe_id);
+  report_swap_stall (next);
+
+  Cmd done = { .type = CMD_SWAP_DONE, .element = old };
+#else
   /* lower the state of the current element */
+  GstElement* old = cur_effect;
+#ifndef MULTICHANNEL
+  // A multiscope bin is left to the controller: this is its own compositor
+  // thread, which pushed the EOS and can't stop itself.
   gst_element_set_state (cur_effect, GST_STATE_NULL);
+#endif
 
-  // Unlink and remove the current element, but avoid dereferencing it. See
-  // below NOTES.
+  // Unlink and remove the current element. @effects holds its own reference,
+  // so this doesn't free it. See below NOTES.
   //
   // NOTES on gst_bin_remove
   //
@@ -114,7 +761,6 @@ event_probe_cb (GstPad* pad, GstPadProbeInfo* info, GstStructure* data)
   // bin.
   // """
   GST_DEBUG_OBJECT (pipeline, "removing %" GST_PTR_FORMAT, cur_effect);
-  gst_object_ref(cur_effect);
   gst_bin_remove (GST_BIN (pipeline), cur_effect);
 
   /* Add the next element to the pipeline. */
@@ -123,14 +769,27 @@ event_probe_cb (GstPad* pad, GstPadProbeInfo* info, GstStructure* data)
 
   /* Link the new element to the appropriate elements. */
   GST_DEBUG_OBJECT (pipeline, "linking...");
-  gst_element_link_many (conv_before, next, conv_after, NULL);
+  gst_element_link_many (conv_before, next, scope_filter, NULL);
 
   gst_element_set_state (next, GST_STATE_PLAYING);
 
   cur_effect = next;
 
+  gst_pad_remove_probe (blockpad, block_probe_id);
+  report_swap_stall (next);
+
   GST_DEBUG_OBJECT (pipeline, "done");
 
+  // The controller hands @old back to the visualizer pool.
+  Cmd done = { .type = CMD_SWAP_DONE, .element = old };
+#endif
+
+  // Let the controller start the next swap, if one was requested meanwhile.
+  // This thread is the only one that pushes to @swap_ring, and at most one
+  // swap is in flight, so the ring can't be full.
+  cmd_ring_push (&swap_ring, &done);
+  cmd_waiter_wake (&controller_waiter);
+
   /* Drop the probe */
   return GST_PAD_PROBE_DROP;
 }
@@ -149,14 +808,19 @@ event_probe_cb (GstPad* pad, GstPadProbeInfo* info, GstStructure* data)
  * @return GstPadProbeReturn
  */
 static GstPadProbeReturn
-pad_probe_cb (GstPad * pad, GstPadProbeInfo * info, GstStructure* data)
+pad_probe_cb (GstPad * pad, GstPadProbeInfo * info, gpointer data)
 {
   GstPad *srcpad, *sinkpad;
 
   GST_DEBUG_OBJECT (pad, "pad is blocked now");
 
-  /* Remove the probe first (so it doesn't keep firing) */
-  gst_pad_remove_probe(pad, GST_PAD_PROBE_INFO_ID (info));
+  // The swap stall, draining and then relinking, is measured from here to the
+  // end of event_probe_cb.
+  block_start_us = g_get_monotonic_time();
+
+  // Keep the probe, and so the pad blocked, until event_probe_cb has relinked.
+  // Nothing else comes through while this thread waits in it.
+  block_probe_id = GST_PAD_PROBE_INFO_ID (info);
 
   /* Install new probe for EOS. This is the callback we defined above, event_probe_cb. */
   srcpad = gst_element_get_static_pad (cur_effect, "src");
@@ -165,7 +829,8 @@ pad_probe_cb (GstPad * pad, GstPadProbeInfo * info, GstStructure* data)
   gst_object_unref (srcpad);
 
   /* Push EOS into the element. The probe will be fired when EOS leaves the
-   * effect element, at which point all the data has been drained.
+   * effect element, at which point all the data has been drained. With the
+   * stock visualizers that happens before gst_pad_send_event returns.
    */
   sinkpad = gst_element_get_static_pad (cur_effect, "sink");
   gst_pad_send_event(sinkpad, gst_event_new_eos());
@@ -174,6 +839,212 @@ pad_probe_cb (GstPad * pad, GstPadProbeInfo * info, GstStructure* data)
   return GST_PAD_PROBE_OK;
 }
 
+#elif defined (SELECTOR_BANK)
+// The selector bank. Each visualizer in @effects sits on its own branch
+// between @osel and @isel; @osel_pads and @isel_pads are the request pads of
+// each branch.
+static GstElement* osel;
+static GstElement* isel;
+static GstPad* osel_pads[4];
+static GstPad* isel_pads[4];
+
+// Set when a branch is made active, so its first buffer can be marked DISCONT.
+static gint resync[4];
+
+// When the last switch was requested, in microseconds.
+static gint64 switch_start_us;
+
+/* Buffer probe on each output-selector src pad. A visualizer that has been
+ * idle still holds the audio it saw when it was last active, so the first
+ * buffer after a switch is flagged DISCONT, which makes the visualizer drop
+ * that stale audio.
+ */
+static GstPadProbeReturn
+branch_buffer_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+  gint i = GPOINTER_TO_INT (user_data);
+
+  if (!g_atomic_int_compare_and_exchange (&resync[i], 1, 0)) {
+    return GST_PAD_PROBE_OK;
+  }
+
+  GstBuffer* buffer = gst_buffer_make_writable (GST_PAD_PROBE_INFO_BUFFER (info));
+  GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+  GST_PAD_PROBE_INFO_DATA (info) = buffer;
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* One-shot buffer probe on the input-selector sink pad of a newly selected
+ * branch. Prints how long it took for the new visualizer's first frame to
+ * arrive.
+ */
+static GstPadProbeReturn
+branch_output_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+  g_print ("Switch latency: %.3f ms\n",
+      (g_get_monotonic_time() - switch_start_us) / 1e3);
+
+  return GST_PAD_PROBE_REMOVE;
+}
+
+/* Switch the selector bank over to the branch of @effects[@index]. This just
+ * changes the active pads, so the next buffer goes to the new visualizer.
+ */
+static void
+select_branch (gint index)
+{
+  g_print ("Switching from '%s' to '%s'. \n", GST_OBJECT_NAME (cur_effect),
+      GST_OBJECT_NAME (effects[index]));
+
+  g_atomic_int_set (&resync[index], 1);
+  switch_start_us = g_get_monotonic_time();
+  gst_pad_add_probe (isel_pads[index], GST_PAD_PROBE_TYPE_BUFFER,
+      branch_output_cb, NULL, NULL);
+
+  // Select downstream first, so the new visualizer's first frame isn't
+  // dropped by the input-selector.
+  g_object_set (isel, "active-pad", isel_pads[index], NULL);
+  g_object_set (osel, "active-pad", osel_pads[index], NULL);
+
+  cur_effect = effects[index];
+}
+#else
+// Length of a crossfade, in output frames.
+#define CROSSFADE_FRAMES 30
+
+// Output of every visualizer branch: 60 fps, unless the governor says
+// otherwise, at the current render size. The compositor takes both from
+// @scope_filter.
+#define VISUAL_CAPS "video/x-raw,framerate=60/1"
+#define FRAME_BUDGET_US (G_USEC_PER_SEC / 60)
+
+// The crossfade bank. Each visualizer in @effects sits on its own branch from
+// a tee, behind a valve, to its own compositor pad in @mixer_pads.
+static GstElement* mixer;
+static GstElement* valves[4];
+static GstElement* fade_filters[4];
+static GstPad* mixer_pads[4];
+static guint zorder_top = 4; // above the zorders the compositor hands out
+
+// State of the running fade, protected by @fade_lock. @fade_in is -1 when no
+// fade is running.
+static GMutex fade_lock;
+static gint fade_in = -1;
+static gint fade_out = -1;
+static gint fade_step;
+static gint64 fade_last_us;
+static gint64 fade_last_cpu_us;
+static gint64 fade_max_interval_us;
+static gint64 fade_max_cpu_us;
+
+/* Caps for the output of each visualizer branch: VISUAL_CAPS at the current
+ * render size and frame rate.
+ */
+static GstCaps*
+branch_caps_new (void)
+{
+  GstCaps* caps = gst_caps_from_string (VISUAL_CAPS);
+  gst_caps_set_simple (caps, "width", G_TYPE_INT, render_width,
+      "height", G_TYPE_INT, render_height, NULL);
+  if (render_fps > 0) {
+    gst_caps_set_simple (caps, "framerate", GST_TYPE_FRACTION, render_fps, 1,
+        NULL);
+  }
+  return caps;
+}
+
+/* End the running fade: hide and stop the outgoing branch, and print what the
+ * fade cost against the 60 fps frame budget. Called with @fade_lock held.
+ */
+static void
+finish_fade_locked (void)
+{
+  g_object_set (mixer_pads[fade_in], "alpha", 1.0, NULL);
+  if (fade_out >= 0) {
+    g_object_set (mixer_pads[fade_out], "alpha", 0.0, NULL);
+    g_object_set (valves[fade_out], "drop", TRUE, NULL);
+  }
+
+  g_print ("Crossfade: %d frames, max frame interval %.2f ms, max CPU "
+      "%.2f ms/frame (budget %.2f ms)\n", fade_step,
+      fade_max_interval_us / 1e3, fade_max_cpu_us / 1e3,
+      FRAME_BUDGET_US / 1e3);
+
+  fade_in = fade_out = -1;
+}
+
+/* Buffer probe on the compositor src pad, called once per output frame. Steps
+ * the running fade and measures each frame's wall and CPU time.
+ */
+static GstPadProbeReturn
+mixer_frame_cb (GstPad* pad, GstPadProbeInfo* info, gpointer user_data)
+{
+  g_mutex_lock (&fade_lock);
+
+  if (fade_in < 0) {
+    g_mutex_unlock (&fade_lock);
+    return GST_PAD_PROBE_OK;
+  }
+
+  gint64 now = g_get_monotonic_time();
+  gint64 cpu = process_cpu_us();
+  if (fade_step > 0) {
+    fade_max_interval_us = MAX (fade_max_interval_us, now - fade_last_us);
+    fade_max_cpu_us = MAX (fade_max_cpu_us, cpu - fade_last_cpu_us);
+  }
+  fade_last_us = now;
+  fade_last_cpu_us = cpu;
+
+  // The outgoing branch stays fully opaque underneath, so blending the
+  // incoming branch over it at @alpha is exactly a crossfade.
+  ++fade_step;
+  gdouble alpha = MIN (1.0, (gdouble) fade_step / CROSSFADE_FRAMES);
+  g_object_set (mixer_pads[fade_in], "alpha", alpha, NULL);
+
+  if (fade_step >= CROSSFADE_FRAMES) {
+    finish_fade_locked();
+  }
+
+  g_mutex_unlock (&fade_lock);
+  return GST_PAD_PROBE_OK;
+}
+
+/* Start fading from the current visualizer to @effects[@index]. A fade that is
+ * still running is finished first, so no more than two branches ever run.
+ */
+static void
+select_branch (gint index)
+{
+  g_print ("Switching from '%s' to '%s'. \n", GST_OBJECT_NAME (cur_effect),
+      GST_OBJECT_NAME (effects[index]));
+
+  g_mutex_lock (&fade_lock);
+
+  if (fade_in >= 0) {
+    finish_fade_locked();
+  }
+
+  fade_out = -1;
+  for (gint i = 0; i < 4; ++i) {
+    if (effects[i] == cur_effect) {
+      fade_out = i;
+    }
+  }
+  fade_in = index;
+  fade_step = 0;
+  fade_max_interval_us = fade_max_cpu_us = 0;
+
+  // Start the incoming branch transparent, on top of everything else.
+  g_object_set (mixer_pads[index], "alpha", 0.0, "zorder", ++zorder_top, NULL);
+  g_object_set (valves[index], "drop", FALSE, NULL);
+
+  cur_effect = effects[index];
+
+  g_mutex_unlock (&fade_lock);
+}
+#endif
+
 /* This function is called when an error message is posted on the bus.
  * @param bus - (GstBus*)
  * @param msg - (GstMessage*)
@@ -192,47 +1063,251 @@ error_cb (GstBus *bus, GstMessage *msg)
   // No explicit "loop" argument, and shouldn't call gtk_main_quit() (a GTK
   // function) inside of a GStreamer callback, because callbacks execute in
   // the calling thread, which does not need to be the main thread. Thus
-  // we push a "quit" message onto the bus.
-    
-  gst_element_post_message(pipeline,
-      gst_message_new_application(GST_OBJECT (pipeline),
-        gst_structure_new_empty("gtk-main-quit")));
+  // we have the main thread quit from an idle callback.
+  request_quit();
 }
 
-/* This callback function is run in the main thread, so it's safe to use GTK
- * functions. This function is called when an "application" message is posted on
- * the bus. Here we retrieve the message posted by the tags_cb callback (and
- * now the button_clicked callback).
+/* This function is called when an element message is posted on the bus.
+ * Prints the "latency-stats" messages of @latency.
  */
 static void
-application_cb(GstBus *bus, GstMessage *msg)
+element_cb (GstBus *bus, GstMessage *msg)
 {
-  // Get the GstStructure out of the GstMessage.
-  GstStructure* data = gst_structure_copy(gst_message_get_structure(msg));
+  const GstStructure* s = gst_message_get_structure (msg);
 
-  // Get the name we gave the GstStructure.
-  gchar const*const  name = gst_structure_get_name(data);
+  if (!gst_structure_has_name (s, "latency-stats")) {
+    return;
+  }
 
-  if (!g_strcmp0(name, "gtk-main-quit")) {
-    // If we named the structure "gtk-main-quit", quit our application by
-    // quittingGTK, which will also take down GSstreamer.
-    //
-    // This will cause an error message to be printed as GStreamer goes down.
-    gtk_main_quit();
-  } else if (!g_strcmp0(name, "gtk-button-clicked")) {
-    // Set up a GStreamer Pad Probe, which will safely stop streaming,
-    // dynamically swap out the GStreamer audiovisualizer element.
-    gst_pad_add_probe (blockpad,
-                       GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
-                       (GstPadProbeCallback)pad_probe_cb,
-                       data,
-                       NULL);
+  g_print ("Latency (p50/p99/max ms):");
+  for (guint i = 0; i < LATENCY_N_SEGMENTS; ++i) {
+    const gchar* name = latency_segment_names[i];
+    gchar* p50 = g_strdup_printf ("%s-p50", name);
+    gchar* p99 = g_strdup_printf ("%s-p99", name);
+    gchar* max = g_strdup_printf ("%s-max", name);
+    gdouble v50 = 0, v99 = 0, vmax = 0;
+
+    gst_structure_get (s, p50, G_TYPE_DOUBLE, &v50, p99, G_TYPE_DOUBLE, &v99,
+        max, G_TYPE_DOUBLE, &vmax, NULL);
+    g_print (" %s %.1f/%.1f/%.1f", name, v50, v99, vmax);
+#ifdef HUD
+    if (i == LATENCY_AUDIO_TO_SINK) {
+      hud_set_latency (&hud, v50, v99);
+    }
+#endif
+
+    g_free (p50);
+    g_free (p99);
+    g_free (max);
+  }
+  g_print ("\n");
+}
+
+#ifndef BRANCH_SWITCH
+/* Start the swap to the most recently requested visualizer, unless a drain is
+ * still in flight. Runs in the controller thread.
+ */
+static void
+start_pending_switch (void)
+{
+  gint index = pending_index;
+
+  if (drain_in_flight || index == -1) {
+    return;
+  }
+  pending_index = -1;
+
+  if (index >= 0 && index < 4 && effects[index] == cur_effect) {
+    // Already showing this visualizer, nothing to swap.
+    return;
+  }
+
+  // Create the next visualizer, or take it warm from the pool, before
+  // anything is blocked.
+  if (index >= 0 && index < 4 && !effects[index]) {
+    effects[index] = vis_pool_acquire (vis_pool, index);
+    if (!effects[index]) {
+      g_printerr ("Could not create visualizer %d\n", index);
+      return;
+    }
+#ifdef MULTICHANNEL
+    // It may have been kept warm through a resize.
+    multiscope_set_format (effects[index], render_width, render_height,
+        render_fps);
+#endif
+  }
+
+#ifdef PREWARM_SWAP
+  // Pre-warm the next visualizer before anything is blocked.
+  if (index >= 0 && index < 4) {
+    prewarm_effect(effects[index]);
+  }
+#endif
+
+  g_atomic_int_set (&drain_in_flight, TRUE);
+
+  // Set up a GStreamer Pad Probe, which will safely stop streaming,
+  // dynamically swap out the GStreamer audiovisualizer element.
+  gst_pad_add_probe (blockpad,
+                     GST_PAD_PROBE_TYPE_BLOCK_DOWNSTREAM,
+                     (GstPadProbeCallback)pad_probe_cb,
+                     GINT_TO_POINTER(index),
+                     NULL);
+}
+#endif
+
+/* Have the visualizers render at the current @render_width x @render_height
+ * and @render_fps. Each renegotiates on its next buffer. Runs in the
+ * controller thread.
+ */
+static void
+update_visuals (void)
+{
+#ifdef SURFACE_SINK
+  // The sink first, so it already takes the new size when upstream asks.
+  surface_sink_set_size (surface_sink, render_width, render_height);
+#endif
+  update_scope_caps ();
+
+#ifdef CROSSFADE
+  GstCaps* caps = branch_caps_new ();
+  for (unsigned i = 0; i < 4; ++i) {
+    g_object_set (fade_filters[i], "caps", caps, NULL);
+  }
+  gst_caps_unref (caps);
+#endif
+
+#ifdef MULTICHANNEL
+  for (unsigned i = 0; i < 4; ++i) {
+    if (effects[i]) {
+      multiscope_set_format (effects[i], render_width, render_height,
+          render_fps);
+    }
   }
+#endif
+}
+
+/* Carry out one command in the controller thread. Returns FALSE when the
+ * controller should stop.
+ */
+static gboolean
+handle_command (const Cmd* cmd)
+{
+  switch (cmd->type) {
+    case CMD_QUIT:
+      request_quit();
+      return FALSE;
+
+    case CMD_STOP:
+      return FALSE;
+
+    case CMD_RESIZE:
+      if (cmd->width != render_width || cmd->height != render_height) {
+        render_width = cmd->width;
+        render_height = cmd->height;
+        update_visuals ();
+        g_print ("Rendering at %dx%d\n", render_width, render_height);
+      }
+      return TRUE;
+
+    case CMD_SET_FRAMERATE:
+      if (cmd->fps != render_fps) {
+        render_fps = cmd->fps;
+        update_visuals ();
+        g_print ("Rendering at %d fps\n", render_fps);
+      }
+      return TRUE;
+
+    case CMD_SWAP_DONE:
+#ifndef BRANCH_SWITCH
+#ifdef PREWARM_SWAP
+      retire_effect (cmd->element);
+#else
+#ifdef MULTICHANNEL
+      gst_element_set_state (cmd->element, GST_STATE_NULL);
+#endif
+      release_effect (cmd->element);
+#endif
+      g_atomic_int_set (&drain_in_flight, FALSE);
+      g_atomic_int_inc (&swaps_done);
+      start_pending_switch ();
+#endif
+      return TRUE;
+
+    case CMD_SWITCH_VISUALIZER:
+      break;
+  }
+
+  gint index = cmd->index;
+
+#ifdef BRANCH_SWITCH
+  if (index >= 0 && index < 4 && effects[index] == cur_effect) {
+    // Already showing this visualizer, nothing to swap.
+    return TRUE;
+  }
+
+  if (index == 4) {
+    request_quit();
+    return FALSE;
+  }
+  select_branch(index);
+#else
+  g_atomic_int_inc (&switches_requested);
+  if (pending_index != -1) {
+    g_atomic_int_inc (&switches_coalesced);
+  }
+  pending_index = index;
+
+  if (!drain_in_flight) {
+    start_pending_switch ();
+  }
+#endif
+
+  return TRUE;
+}
+
+/* The pipeline controller. Takes commands from the GTK main thread and from
+ * the streaming threads off the command rings and applies them to the
+ * pipeline, so neither the UI nor streaming ever waits on a state change.
+ */
+static gpointer
+controller_thread (gpointer user_data)
+{
+  CmdRing* const rings[] = { &swap_ring, &ui_ring };
+  gboolean running = TRUE;
+
+  while (running) {
+    cmd_waiter_wait (&controller_waiter, rings, G_N_ELEMENTS (rings));
+
+    Cmd cmd;
+    while (running && cmd_ring_pop (&swap_ring, &cmd)) {
+      running = handle_command (&cmd);
+    }
+    while (running && cmd_ring_pop (&ui_ring, &cmd)) {
+      running = handle_command (&cmd);
+    }
+  }
+
+  return NULL;
+}
+
+/* Queue a command for the controller thread. Only the GTK main thread may
+ * call this.
+ */
+static gboolean
+send_command (const Cmd* cmd)
+{
+  if (!cmd_ring_push (&ui_ring, cmd)) {
+    g_printerr ("Command ring full, dropping command %d\n", cmd->type);
+    return FALSE;
+  }
+  cmd_waiter_wake (&controller_waiter);
+  return TRUE;
 }
 
 /**
- * @brief A button click handler. posts a message containing the button index
- *        to the GstBus.
+ * @brief A button click handler. Queues a switch-visualizer command with the
+ *        button index for the controller thread.
  * 
  * @param widget {GtkWidget} - This GtkWidget is connected to the signal
  *               handler.
@@ -242,24 +1317,254 @@ application_cb(GstBus *bus, GstMessage *msg)
 void
 button_clicked(GtkWidget* widget, gint* index_ptr)
 {
-  // Create a GstStructure @data containing the button index.
-  GstStructure* gst_struct =
-      gst_structure_new("gtk-button-clicked",
-                        "index", G_TYPE_INT, *index_ptr,
-                        NULL);
+  Cmd cmd = {
+    .type = CMD_SWITCH_VISUALIZER,
+    .index = *index_ptr,
+    .sent_us = g_get_monotonic_time(),
+  };
+  send_command(&cmd);
+}
+
+// Pending resize of the video widget, waiting for RESIZE_DEBOUNCE_MS without
+// another one.
+static guint resize_source;
+
+/* The video widget has kept its size for RESIZE_DEBOUNCE_MS. Have the
+ * controller render at that size in device pixels.
+ */
+static gboolean
+resize_timeout_cb (gpointer user_data)
+{
+  GtkWidget* widget = user_data;
+  gint scale = gtk_widget_get_scale_factor (widget);
+  Cmd cmd = {
+    .type = CMD_RESIZE,
+    .width = gtk_widget_get_allocated_width (widget) * scale,
+    .height = gtk_widget_get_allocated_height (widget) * scale,
+    .sent_us = g_get_monotonic_time(),
+  };
+
+  resize_source = 0;
+  send_command (&cmd);
+  return G_SOURCE_REMOVE;
+}
+
+/* The video widget got a new allocation ("size-allocate") or scale factor
+ * ("notify::scale-factor"). (Re)start the debounce timer.
+ */
+static void
+video_resized_cb (GtkWidget* widget, gpointer allocation_or_pspec,
+    gpointer user_data)
+{
+  if (resize_source) {
+    g_source_remove (resize_source);
+  }
+  resize_source = g_timeout_add (RESIZE_DEBOUNCE_MS, resize_timeout_cb,
+      widget);
+}
+
+// Decides the frame rate from the window's state, see governor.h.
+static Governor governor;
+
+/* Have the controller render at the governor's frame rate. */
+static void
+apply_frame_rate (void)
+{
+#ifndef UNGOVERNED
+  Cmd cmd = {
+    .type = CMD_SET_FRAMERATE,
+    .fps = governor.fps,
+    .sent_us = g_get_monotonic_time(),
+  };
+  send_command (&cmd);
+#endif
+}
+
+static gboolean
+window_state_cb (GtkWidget* window, GdkEventWindowState* event,
+    gpointer user_data)
+{
+  gboolean iconified = (event->new_window_state & (GDK_WINDOW_STATE_ICONIFIED |
+          GDK_WINDOW_STATE_WITHDRAWN)) != 0;
+  if (governor_set_iconified (&governor, iconified)) {
+    apply_frame_rate ();
+  }
+  return FALSE;
+}
+
+/* Only X11 without a compositor says when a window is covered. */
+static gboolean
+window_visibility_cb (GtkWidget* window, GdkEventVisibility* event,
+    gpointer user_data)
+{
+  gboolean obscured = event->state == GDK_VISIBILITY_FULLY_OBSCURED;
+  if (governor_set_obscured (&governor, obscured)) {
+    apply_frame_rate ();
+  }
+  return FALSE;
+}
+
+/* Every 2 seconds: follow the monitor's refresh rate and the CPU pressure. */
+static gboolean
+governor_tick_cb (gpointer window)
+{
+  if (governor_tick (&governor, window)) {
+    apply_frame_rate ();
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+report_governor (gpointer user_data)
+{
+  governor_report (&governor);
+  return G_SOURCE_CONTINUE;
+}
 
-  int i=0;
-  gst_structure_get_int(gst_struct, "index", &i);
+#ifdef SWITCH_STRESS
+#define STRESS_SWITCHES_PER_SECOND 1000
+#define STRESS_SECONDS 30
 
-  // Create a GstMessage @msg containing the GstStructure @gst_struct.
-  GstMessage* msg =
-      gst_message_new_application(GST_OBJECT(pipeline), gst_struct);
+// Time given to the last swap to finish before the elements are checked.
+#define STRESS_SETTLE_SECONDS 2
 
-  // Push an application message to the bus. The message will be parsed and
-  // handled by application_cb, which runs in the main thread.
-  gst_element_post_message(pipeline, msg);
+// A drain that makes no progress for this long counts as a deadlock.
+#define STRESS_DEADLOCK_SECONDS 3
+
+static gint64 stress_start_us;
+static gint stress_sent;
+static guint stress_base_children;
+static gint stress_last_swaps;
+static gint64 stress_last_progress_us;
+static gboolean stress_failed;
+
+/* Fire random switch requests at STRESS_SWITCHES_PER_SECOND, catching up on
+ * the ones that are due if the main loop was late.
+ */
+static gboolean
+stress_send_cb (gpointer user_data)
+{
+  gint64 elapsed_us = g_get_monotonic_time() - stress_start_us;
+
+  if (elapsed_us >= STRESS_SECONDS * G_USEC_PER_SEC) {
+    return G_SOURCE_REMOVE;
+  }
+
+  gint due = elapsed_us * STRESS_SWITCHES_PER_SECOND / G_USEC_PER_SEC;
+  for (; stress_sent < due; ++stress_sent) {
+    Cmd cmd = {
+      .type = CMD_SWITCH_VISUALIZER,
+      .index = g_random_int_range (0, 4),
+      .sent_us = g_get_monotonic_time(),
+    };
+    if (!send_command(&cmd)) {
+      break;
+    }
+  }
+  return G_SOURCE_CONTINUE;
 }
 
+/* After the stress run, the pipeline must hold the same elements as before it,
+ * each visualizer in use only the references of @effects and, if it is in the
+ * pipeline, of the bin, and each warm one in the pool only the pool's.
+ */
+static gboolean
+stress_check_elements (void)
+{
+  gboolean ok = TRUE;
+
+  GST_OBJECT_LOCK (pipeline);
+  guint children = GST_BIN_NUMCHILDREN (pipeline);
+  GST_OBJECT_UNLOCK (pipeline);
+
+  if (children != stress_base_children) {
+    g_print ("Switch stress: pipeline has %u elements, expected %u\n",
+        children, stress_base_children);
+    ok = FALSE;
+  }
+
+  for (unsigned i = 0; i < 4; ++i) {
+    if (!effects[i]) {
+      continue;
+    }
+    gint refs = GST_OBJECT_REFCOUNT_VALUE (effects[i]);
+    gint expected = GST_OBJECT_PARENT (effects[i]) ? 2 : 1;
+    if (refs != expected) {
+      g_print ("Switch stress: %s has %d references, expected %d\n",
+          GST_OBJECT_NAME (effects[i]), refs, expected);
+      ok = FALSE;
+    }
+  }
+
+  for (GList* l = vis_pool->warm.head; l; l = l->next) {
+    VisPoolEntry* entry = l->data;
+    gint refs = GST_OBJECT_REFCOUNT_VALUE (entry->element);
+    if (refs != 1 || GST_OBJECT_PARENT (entry->element)) {
+      g_print ("Switch stress: warm %s has %d references, expected 1\n",
+          GST_OBJECT_NAME (entry->element), refs);
+      ok = FALSE;
+    }
+  }
+  if (vis_pool->warm.length > VIS_POOL_WARM) {
+    g_print ("Switch stress: %u warm visualizers, expected at most %d\n",
+        vis_pool->warm.length, VIS_POOL_WARM);
+    ok = FALSE;
+  }
+
+  return ok;
+}
+
+/* Once a second: report progress, watch for a drain that never finishes, and
+ * check for leaked elements when the run is over.
+ */
+static gboolean
+stress_check_cb (gpointer user_data)
+{
+  gint64 now_us = g_get_monotonic_time();
+  gint swaps = g_atomic_int_get (&swaps_done);
+  gboolean in_flight = g_atomic_int_get (&drain_in_flight);
+
+  g_print ("Switch stress: %d requested, %d coalesced, %d swaps done\n",
+      g_atomic_int_get (&switches_requested),
+      g_atomic_int_get (&switches_coalesced), swaps);
+
+  if (swaps != stress_last_swaps || !in_flight) {
+    stress_last_swaps = swaps;
+    stress_last_progress_us = now_us;
+  } else if (now_us - stress_last_progress_us >
+      STRESS_DEADLOCK_SECONDS * G_USEC_PER_SEC) {
+    g_print ("Switch stress: FAIL, a drain has been stuck for %d s\n",
+        STRESS_DEADLOCK_SECONDS);
+    stress_failed = TRUE;
+    gtk_main_quit();
+    return G_SOURCE_REMOVE;
+  }
+
+  if (now_us - stress_start_us <
+      (STRESS_SECONDS + STRESS_SETTLE_SECONDS) * G_USEC_PER_SEC || in_flight) {
+    return G_SOURCE_CONTINUE;
+  }
+
+  stress_failed = !stress_check_elements ();
+  g_print ("Switch stress: %s\n", stress_failed ? "FAIL" : "PASS");
+  gtk_main_quit();
+  return G_SOURCE_REMOVE;
+}
+
+/* Start the switch stress test. Runs in the main thread, like the buttons. */
+static void
+start_switch_stress (void)
+{
+  GST_OBJECT_LOCK (pipeline);
+  stress_base_children = GST_BIN_NUMCHILDREN (pipeline);
+  GST_OBJECT_UNLOCK (pipeline);
+
+  stress_start_us = stress_last_progress_us = g_get_monotonic_time();
+  g_timeout_add (1, stress_send_cb, NULL);
+  g_timeout_add_seconds (1, stress_check_cb, NULL);
+}
+#endif
+
 /** This is the primary primary callback function for the application.
  */
 static void
@@ -269,22 +1574,64 @@ activate(GtkApplication *app, gpointer _data/*gpointer data*/)
 
   GtkWidget *window = gtk_application_window_new(app);
 
+  // Follow the window's visibility with the frame rate.
+  governor_init (&governor, HIDDEN_FPS, THROTTLE_MIN_FPS);
+  gtk_widget_add_events (window, GDK_VISIBILITY_NOTIFY_MASK);
+  g_signal_connect (window, "window-state-event",
+      G_CALLBACK (window_state_cb), NULL);
+  g_signal_connect (window, "visibility-notify-event",
+      G_CALLBACK (window_visibility_cb), NULL);
+  g_timeout_add_seconds (2, governor_tick_cb, window);
+  g_timeout_add_seconds (10, report_governor, NULL);
+
   GtkWidget* grid = gtk_grid_new();
 
   // Set the space between Grid columns (in pixels)
   gtk_grid_set_column_spacing(GTK_GRID(grid), 20);
 
-  gtk_widget_set_halign(grid, GTK_ALIGN_CENTER);
-  gtk_widget_set_valign(grid, GTK_ALIGN_CENTER);
+  gtk_widget_set_halign(grid, GTK_ALIGN_FILL);
+  gtk_widget_set_valign(grid, GTK_ALIGN_FILL);
 
   GtkWidget *root_pane = gtk_overlay_new();
   gtk_container_add(GTK_CONTAINER(window), grid);
 
   GtkWidget *video_drawing_area = gtk_drawing_area_new();
 
+#ifdef SURFACE_SINK
+  video_drawing_area = surface_sink_create_widget (surface_sink);
+#else
   g_object_get (sink, "widget", &video_drawing_area, NULL);
+
+  // gtksink draws in the widget's own draw handler, which runs between these.
+  g_signal_connect (video_drawing_area, "draw", G_CALLBACK (draw_begin_cb),
+      NULL);
+  g_signal_connect_after (video_drawing_area, "draw", G_CALLBACK (draw_end_cb),
+      NULL);
+#endif
   gtk_widget_set_size_request(video_drawing_area, 800, 600);
-  gtk_grid_attach(GTK_GRID(grid), video_drawing_area, 2, 0, 3, 5);
+  g_timeout_add_seconds (10, report_main_thread, NULL);
+
+  // The video takes whatever room the window has, and the visualizers follow
+  // its size.
+  gtk_widget_set_hexpand (video_drawing_area, TRUE);
+  gtk_widget_set_vexpand (video_drawing_area, TRUE);
+  g_signal_connect (video_drawing_area, "size-allocate",
+      G_CALLBACK (video_resized_cb), NULL);
+  g_signal_connect (video_drawing_area, "notify::scale-factor",
+      G_CALLBACK (video_resized_cb), NULL);
+  first_draw_handler = g_signal_connect_after (video_drawing_area, "draw",
+      G_CALLBACK (first_draw_cb), NULL);
+
+  // The video is the main child of @root_pane, so things can be laid over it.
+  gtk_container_add (GTK_CONTAINER (root_pane), video_drawing_area);
+  gtk_grid_attach(GTK_GRID(grid), root_pane, 2, 0, 3, 5);
+
+#ifdef HUD
+  hud_init (&hud);
+  gtk_overlay_add_overlay (GTK_OVERLAY (root_pane), hud.label);
+  gtk_overlay_set_overlay_pass_through (GTK_OVERLAY (root_pane), hud.label,
+      TRUE);
+#endif
 
   // Create the buttons
   GtkWidget* buttons[4] = {
@@ -302,7 +1649,7 @@ activate(GtkApplication *app, gpointer _data/*gpointer data*/)
     gtk_box_new(GTK_ORIENTATION_HORIZONTAL, 12),
   };
 
-  GtkStyleContext* context = gtk_widget_get_style_context(button);
+  GtkStyleContext* context = gtk_widget_get_style_context(buttons[0]);
   GtkCssProvider* provider = gtk_css_provider_new();
   gtk_css_provider_load_from_path(provider, "button.css", NULL);
 
@@ -310,12 +1657,21 @@ activate(GtkApplication *app, gpointer _data/*gpointer data*/)
   gint indices[4] = { 0, 1, 2, 3 };
 
   // Define the @effect_names array.
+#ifdef PROTOSCOPE
+  gchar* effect_names[4] = {
+    "protospacescope",
+    "protospectrascope",
+    "protosynaescope",
+    "protowavescope"
+  };
+#else
   gchar* effect_names[4] = {
     "spacescope",
     "spectrascope",
     "synaescope",
     "wavescope"
   };
+#endif
 
   // { HORIZONTAL, VERTICAL }
   gint coords[4][2] = {
@@ -334,9 +1690,6 @@ activate(GtkApplication *app, gpointer _data/*gpointer data*/)
     g_signal_connect(G_OBJECT(buttons[i]), "clicked",
         G_CALLBACK(button_clicked), &indices[i]);
 
-    // Initialize the gst element corresponding to the button.
-    effects[i] = gst_element_factory_make(effect_names[i], NULL);
-
     // Add the button to its container.
     gtk_box_pack_end(GTK_BOX(boxes[i]), buttons[i], TRUE, TRUE, 0);
 
@@ -361,6 +1714,29 @@ activate(GtkApplication *app, gpointer _data/*gpointer data*/)
   // Recursively show window and all its children.
   gtk_widget_show_all(window);
 
+  // The window has taken its size from the 800x600 request. From now on the
+  // video may get smaller than that, and the visualizers follow it down.
+  gtk_widget_set_size_request (video_drawing_area, VIDEO_MIN_WIDTH,
+      VIDEO_MIN_HEIGHT);
+
+  // The visualizers come from the pool. The pool's references keep them alive
+  // while they are out of the pipeline between swaps.
+  vis_pool = vis_pool_new ((const gchar* const*) effect_names, 4, VIS_POOL_WARM);
+#ifdef MULTICHANNEL
+  vis_pool_set_make_func (vis_pool, make_multiscope, NULL);
+#endif
+  g_timeout_add_seconds (10, report_vis_pool, NULL);
+
+#ifdef BRANCH_SWITCH
+  // Every branch is linked from the start.
+  for (unsigned i = 0; i < 4; ++i) {
+    effects[i] = vis_pool_acquire (vis_pool, i);
+  }
+#else
+  // The others are created when they are first selected.
+  effects[0] = vis_pool_acquire (vis_pool, 0);
+#endif
+
   pipeline = gst_pipeline_new ("pipeline");
 
   // Create the source element for the pipeline, a Jack Audio Source.
@@ -369,7 +1745,41 @@ activate(GtkApplication *app, gpointer _data/*gpointer data*/)
   // The jackaudiosrc element doesn't have this.
   //g_object_set (src, "is-live", TRUE, NULL);
 
-  q1 = gst_element_factory_make ("queue", NULL); 
+  // What the rest of the pipeline is linked to.
+  GstElement* src_out = src;
+
+#ifdef MULTICHANNEL
+  // One JACK port per channel. The visualizers need exactly this many.
+  GstElement* src_filter = gst_element_factory_make ("capsfilter", NULL);
+  GstCaps* src_caps = gst_caps_new_simple ("audio/x-raw", "channels",
+      G_TYPE_INT, MULTICHANNEL, NULL);
+  g_object_set (src_filter, "caps", src_caps, NULL);
+  gst_caps_unref (src_caps);
+  gst_bin_add (GST_BIN (pipeline), src_filter);
+  src_out = src_filter;
+#endif
+
+  GstElement* audio_tee = gst_element_factory_make ("tee", NULL);
+
+  GstElement* audio_queue = gst_element_factory_make ("queue", NULL);
+  GstElement* audio_convert = gst_element_factory_make ("audioconvert", NULL);
+  GstElement* audio_resample = gst_element_factory_make ("audioresample", NULL);
+  audio_sink = gst_element_factory_make (AUDIO_SINK, NULL);
+  g_object_set (audio_sink, "buffer-time", (gint64) AUDIO_BUFFER_US,
+      "latency-time", (gint64) AUDIO_LATENCY_US, "qos", TRUE, NULL);
+
+  GstPad* audiopad = gst_element_get_static_pad (audio_sink, "sink");
+  gst_pad_add_probe (audiopad, GST_PAD_PROBE_TYPE_BUFFER, audio_discont_cb,
+      NULL, NULL);
+  gst_object_unref (audiopad);
+  g_timeout_add_seconds (10, report_xruns, NULL);
+
+  q1 = gst_element_factory_make ("queue", "q1");
+
+  // q1 is the only way the visualizers can push back on the tee. Make it drop
+  // its oldest audio when full instead, so a slow swap or repaint never
+  // reaches the audio branch.
+  g_object_set (q1, "leaky", 2 /* downstream */, NULL);
 
   blockpad = gst_element_get_static_pad (q1, "src");
 
@@ -380,13 +1790,178 @@ activate(GtkApplication *app, gpointer _data/*gpointer data*/)
 
   conv_after = gst_element_factory_make ("videoconvert", NULL);
 
-  q2 = gst_element_factory_make ("queue", NULL);
+  q2 = gst_element_factory_make ("queue", "q2");
+
+#ifdef LATENCY_BUDGET_MS
+  latency_budget_apply (q1, q2, LATENCY_BUDGET_MS, &q1_counts, &q2_counts);
+  g_timeout_add_seconds (10, report_queue_drops, NULL);
+#endif
+
+#ifdef HUD
+  hud_watch (&hud, q1, q2, sink);
+  g_timeout_add (HUD_INTERVAL_MS, hud_update_cb, NULL);
+#endif
+
+  // Ask the sink which formats it takes without conversion, and hold the
+  // visualizer output to those.
+  GstPad* sinkpad = gst_element_get_static_pad (sink, "sink");
+  sink_caps = gst_pad_query_caps (sinkpad, NULL);
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER, first_frame_cb, NULL,
+      NULL);
+  gst_object_unref (sinkpad);
+
+  scope_filter = gst_element_factory_make ("capsfilter", NULL);
+  update_scope_caps ();
 
-  gst_bin_add_many (GST_BIN (pipeline), src, q1, conv_before, effect,
-      conv_after, q2, sink, NULL);
+#ifdef PREWARM_SWAP
+  warm_filter = gst_element_factory_make ("capsfilter", NULL);
+  gst_bin_add (GST_BIN (pipeline), warm_filter);
+#endif
+
+  GstPad* convpad = gst_element_get_static_pad (conv_after, "sink");
+  gst_pad_add_probe (convpad, GST_PAD_PROBE_TYPE_BUFFER, conversion_count_cb,
+      NULL, NULL);
+  gst_object_unref (convpad);
+  g_timeout_add_seconds (10, report_conversion, NULL);
 
-  gst_element_link_many (src, q1, conv_before, effect,
-      conv_after, q2, sink, NULL);
+  gst_bin_add_many (GST_BIN (pipeline), src, audio_tee, audio_queue, audio_convert,
+      audio_resample, audio_sink, q1, conv_before, scope_filter, conv_after,
+      q2, sink, NULL);
+
+#ifdef MULTICHANNEL
+  gst_element_link (src, src_filter);
+#endif
+  gst_element_link_many (src_out, audio_tee, audio_queue, audio_convert, audio_resample,
+      audio_sink, NULL);
+
+#ifdef PROTOSCOPE
+  // Analyze once, right after the queue; the spectra and synae scopes read
+  // the bins from each buffer.
+  GstElement* analysis = gst_element_factory_make ("protospectrum", NULL);
+  gst_bin_add (GST_BIN (pipeline), analysis);
+  gst_element_link_many (audio_tee, q1, analysis, conv_before, NULL);
+#else
+  gst_element_link_many (audio_tee, q1, conv_before, NULL);
+#endif
+
+#ifdef LATENCY_OVERLAY
+  GstElement* overlay = gst_element_factory_make ("textoverlay", NULL);
+  g_object_set (overlay, "valignment", 2 /* top */, "halignment", 0 /* left */,
+      "font-desc", "Sans 10", NULL);
+  gst_bin_add (GST_BIN (pipeline), overlay);
+  gst_element_link_many (scope_filter, overlay, conv_after, q2, sink, NULL);
+#else
+  gst_element_link_many (scope_filter, conv_after, q2, sink, NULL);
+#endif
+
+  // Latency from the audio leaving q1, through the visualizer output (which
+  // stays the same pad across swaps), to the sink.
+  GstPad* scopepad = gst_element_get_static_pad (scope_filter, "sink");
+  sinkpad = gst_element_get_static_pad (sink, "sink");
+  latency = latency_probe_new (blockpad, scopepad, sinkpad);
+  gst_object_unref (sinkpad);
+  gst_object_unref (scopepad);
+#ifdef LATENCY_OVERLAY
+  latency_probe_set_overlay (latency, overlay);
+#endif
+
+#ifdef SELECTOR_BANK
+  osel = gst_element_factory_make ("output-selector", NULL);
+  isel = gst_element_factory_make ("input-selector", NULL);
+
+  // Inactive branches never get data, so don't let the input-selector wait
+  // for them.
+  g_object_set (isel, "sync-streams", FALSE, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), osel, isel, NULL);
+
+  gst_element_link (conv_before, osel);
+
+  // Give each visualizer its own branch from @osel to @isel.
+  for (gint i = 0; i < 4; ++i) {
+    gst_bin_add (GST_BIN (pipeline), effects[i]);
+
+    osel_pads[i] = gst_element_get_request_pad (osel, "src_%u");
+    isel_pads[i] = gst_element_get_request_pad (isel, "sink_%u");
+
+    GstPad* sinkpad = gst_element_get_static_pad (effects[i], "sink");
+    GstPad* srcpad = gst_element_get_static_pad (effects[i], "src");
+    gst_pad_link (osel_pads[i], sinkpad);
+    gst_pad_link (srcpad, isel_pads[i]);
+    gst_object_unref (sinkpad);
+    gst_object_unref (srcpad);
+
+    gst_pad_add_probe (osel_pads[i], GST_PAD_PROBE_TYPE_BUFFER,
+        branch_buffer_cb, GINT_TO_POINTER (i), NULL);
+  }
+
+  g_object_set (osel, "active-pad", osel_pads[0], NULL);
+  g_object_set (isel, "active-pad", isel_pads[0], NULL);
+
+  gst_element_link (isel, scope_filter);
+#elif defined (CROSSFADE)
+  GstElement* tee = gst_element_factory_make ("tee", NULL);
+  mixer = gst_element_factory_make ("compositor", NULL);
+  GstElement* mixer_filter = gst_element_factory_make ("capsfilter", NULL);
+
+  // Only raw video; size and rate are up to @scope_filter.
+  GstCaps* visual_caps = gst_caps_new_empty_simple ("video/x-raw");
+  GstCaps* branch_caps = branch_caps_new ();
+  g_object_set (mixer_filter, "caps", visual_caps, NULL);
+
+  // Black background (1), so a fade never shows the default checkerboard.
+  g_object_set (mixer, "background", 1, NULL);
+
+  // Closed branches have no data at all. Newer compositors can be told not to
+  // wait for them.
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (mixer),
+          "ignore-inactive-pads")) {
+    g_object_set (mixer, "ignore-inactive-pads", TRUE, NULL);
+  }
+
+  gst_bin_add_many (GST_BIN (pipeline), tee, mixer, mixer_filter, NULL);
+
+  gst_element_link (conv_before, tee);
+
+  // Give each visualizer its own branch: tee -> valve -> queue -> visualizer
+  // -> capsfilter -> compositor. The valve comes first so a closed branch
+  // costs nothing, and the queue gives each visualizer its own thread.
+  for (gint i = 0; i < 4; ++i) {
+    GstElement* queue = gst_element_factory_make ("queue", NULL);
+    GstElement* filter = gst_element_factory_make ("capsfilter", NULL);
+    valves[i] = gst_element_factory_make ("valve", NULL);
+    fade_filters[i] = filter;
+
+    g_object_set (valves[i], "drop", i != 0, NULL);
+    g_object_set (queue, "max-size-buffers", 3, "max-size-bytes", 0,
+        "max-size-time", (guint64) 0, "leaky", 2 /* downstream */, NULL);
+    g_object_set (filter, "caps", branch_caps, NULL);
+
+    gst_bin_add_many (GST_BIN (pipeline), valves[i], queue, effects[i],
+        filter, NULL);
+    gst_element_link_many (tee, valves[i], queue, effects[i], filter, NULL);
+
+    mixer_pads[i] = gst_element_get_request_pad (mixer, "sink_%u");
+    GstPad* srcpad = gst_element_get_static_pad (filter, "src");
+    gst_pad_link (srcpad, mixer_pads[i]);
+    gst_object_unref (srcpad);
+
+    g_object_set (mixer_pads[i], "alpha", i == 0 ? 1.0 : 0.0, NULL);
+  }
+  gst_caps_unref (visual_caps);
+  gst_caps_unref (branch_caps);
+
+  GstPad* mixer_src = gst_element_get_static_pad (mixer, "src");
+  gst_pad_add_probe (mixer_src, GST_PAD_PROBE_TYPE_BUFFER, mixer_frame_cb,
+      NULL, NULL);
+  gst_object_unref (mixer_src);
+
+  gst_element_link_many (mixer, mixer_filter, scope_filter, NULL);
+#else
+  gst_bin_add (GST_BIN (pipeline), effect);
+
+  gst_element_link_many (conv_before, effect, scope_filter, NULL);
+#endif
 
   gst_element_set_state (pipeline, GST_STATE_PLAYING);
 
@@ -397,14 +1972,39 @@ activate(GtkApplication *app, gpointer _data/*gpointer data*/)
                     (GCallback)error_cb,
                     NULL);
   g_signal_connect (G_OBJECT (bus),
-                    "message::application",
-                    (GCallback)application_cb,
+                    "message::element",
+                    (GCallback)element_cb,
+                    NULL);
+  g_signal_connect (G_OBJECT (bus),
+                    "message::qos",
+                    (GCallback)qos_cb,
                     NULL);
 
+  // The bus now only carries GStreamer's own messages; UI commands go
+  // through @ui_ring to the controller thread.
+  cmd_ring_init (&ui_ring);
+  cmd_ring_init (&swap_ring);
+  cmd_waiter_init (&controller_waiter);
+  controller = g_thread_new ("controller", controller_thread, NULL);
+  apply_frame_rate ();
+
+#ifdef SWITCH_STRESS
+  start_switch_stress ();
+#endif
+
   gtk_main();
 
+  // Stop the controller if it hasn't stopped itself already. Not with
+  // CMD_QUIT: gtk_main has returned, so there is no loop left for it to quit.
+  Cmd stop = { .type = CMD_STOP };
+  send_command (&stop);
+  g_thread_join (controller);
+  cmd_waiter_clear (&controller_waiter);
+
   gst_element_set_state (pipeline, GST_STATE_NULL);
   gst_object_unref (pipeline);
+  latency_probe_free (latency);
+  vis_pool_free (vis_pool);
 }
 
 /** This main function sets up the activate callback and then starts the
@@ -412,9 +2012,42 @@ activate(GtkApplication *app, gpointer _data/*gpointer data*/)
  * ready.
  */
 int main(int argc, char **argv) {
+    main_start_us = g_get_monotonic_time();
+#ifdef FAST_STARTUP
+    if (!fast_startup_use()) {
+      g_printerr ("No %s, run fast-startup-setup first. Starting with the "
+          "full registry.\n", FAST_STARTUP_REGISTRY);
+    }
+#endif
     gst_init(&argc, &argv);
+    init_done_us = g_get_monotonic_time();
+#ifdef PROTOSCOPE
+    proto_scope_register();
+    proto_spectrum_register();
+#endif
+#ifdef PROTOTRACE
+    proto_trace_start (PROTOTRACE_FILE);
+#endif
+#ifdef SURFACE_SINK
+    surface_sink = surface_sink_new (800, 600);
+    if (!surface_sink) {
+      g_printerr ("Could not create the appsink of the SurfaceSink\n");
+      return 1;
+    }
+    sink = surface_sink->appsink;
+#else
     sink = gst_element_factory_make ("gtksink", NULL);
+#endif
     GtkApplication *app = gtk_application_new("com.gst.proto", G_APPLICATION_FLAGS_NONE);
     g_signal_connect(app, "activate", G_CALLBACK(activate), NULL);
-    return g_application_run(G_APPLICATION(app), argc, argv);
+    int status = g_application_run(G_APPLICATION(app), argc, argv);
+#ifdef PROTOTRACE
+    proto_trace_dump (PROTOTRACE_FILE);
+#endif
+#ifdef SWITCH_STRESS
+    if (stress_failed) {
+      status = 1;
+    }
+#endif
+    return status;
 }
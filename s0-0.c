@@ -0,0 +1,176 @@
+/*
+clear && gcc -g s0-0.c -o s0-0 `pkg-config --cflags --libs gstreamer-1.0 gstreamer-app-1.0` && ./s0-0
+*/
+
+/* Stretch 0: expose raw audio to a simple external application.
+ *
+ * A test audio source plays to the speaker, and a tee hands the same audio,
+ * as interleaved S16LE, to an appsink that writes it into the shared-memory
+ * ring of shmring.h. External processes map the ring file and read the PCM
+ * in place; see s0-consumer.c. The pipeline never waits for them.
+ *
+ *   audiotestsrc -> tee -> queue -> audioconvert -> audioresample
+ *                      |                             -> autoaudiosink
+ *                      +--> queue -> audioconvert -> appsink -> ring
+ *
+ * Usage: s0-0 [ring file], default SHM_RING_DEFAULT_PATH.
+ */
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+
+#include "shmring.h"
+
+#define SAMPLE_RATE 44100
+#define CHANNELS 2
+#define BYTES_PER_SAMPLE 2
+#define BYTES_PER_FRAME (CHANNELS * BYTES_PER_SAMPLE)
+
+// Slot payload: 1024 frames, about 23 ms. 256 slots keep about 6 seconds, so
+// a reader that stalls briefly doesn't lose anything.
+#define RING_SLOT_SIZE (1024 * BYTES_PER_FRAME)
+#define RING_SLOTS 256
+
+static ShmRing* ring;
+static GMainLoop* main_loop;
+
+static gint slots_written;
+
+/* Called by the appsink, in its streaming thread, for every buffer. Copies the
+ * buffer into as many slots as it takes, straight from its memory into the
+ * mapping.
+ */
+static GstFlowReturn
+new_sample (GstAppSink* sink, gpointer user_data)
+{
+  GstSample* sample = gst_app_sink_pull_sample (sink);
+  if (!sample) {
+    return GST_FLOW_EOS;
+  }
+
+  GstBuffer* buffer = gst_sample_get_buffer (sample);
+  GstClockTime pts = GST_BUFFER_PTS (buffer);
+  gsize size = gst_buffer_get_size (buffer);
+
+  for (gsize offset = 0; offset < size; offset += RING_SLOT_SIZE) {
+    guint8* data = shm_ring_write_begin (ring);
+    gsize n = gst_buffer_extract (buffer, offset, data, RING_SLOT_SIZE);
+
+    GstClockTime slot_pts = pts;
+    if (GST_CLOCK_TIME_IS_VALID (pts)) {
+      slot_pts += gst_util_uint64_scale (offset / BYTES_PER_FRAME, GST_SECOND,
+          SAMPLE_RATE);
+    }
+    shm_ring_write_commit (ring, n, slot_pts);
+    g_atomic_int_inc (&slots_written);
+  }
+
+  gst_sample_unref (sample);
+  return GST_FLOW_OK;
+}
+
+/* Periodically print how much audio went into the ring. */
+static gboolean
+report_tap (gpointer user_data)
+{
+  g_print ("Ring: %d slots written, head %" G_GUINT64_FORMAT "\n",
+      g_atomic_int_get (&slots_written), shm_ring_head (ring));
+  return G_SOURCE_CONTINUE;
+}
+
+/* This function is called when an error message is posted on the bus */
+static void
+error_cb (GstBus* bus, GstMessage* msg, gpointer user_data)
+{
+  GError* err;
+  gchar* debug_info;
+
+  gst_message_parse_error (msg, &err, &debug_info);
+  g_printerr ("Error received from element %s: %s\n",
+      GST_OBJECT_NAME (msg->src), err->message);
+  g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+  g_clear_error (&err);
+  g_free (debug_info);
+
+  g_main_loop_quit (main_loop);
+}
+
+int
+main (int argc, char* argv[])
+{
+  gst_init (&argc, &argv);
+
+  const gchar* path = argc > 1 ? argv[1] : SHM_RING_DEFAULT_PATH;
+  ring = shm_ring_create (path, RING_SLOTS, RING_SLOT_SIZE, SAMPLE_RATE,
+      CHANNELS, BYTES_PER_SAMPLE);
+  if (!ring) {
+    g_printerr ("Could not create %s: %s\n", path, g_strerror (errno));
+    return -1;
+  }
+
+  GstElement* pipeline = gst_pipeline_new ("s0-pipeline");
+  GstElement* src = gst_element_factory_make ("audiotestsrc", NULL);
+  GstElement* tee = gst_element_factory_make ("tee", NULL);
+  GstElement* audio_queue = gst_element_factory_make ("queue", NULL);
+  GstElement* audio_convert = gst_element_factory_make ("audioconvert", NULL);
+  GstElement* audio_resample = gst_element_factory_make ("audioresample", NULL);
+  GstElement* audio_sink = gst_element_factory_make ("autoaudiosink", NULL);
+  GstElement* app_queue = gst_element_factory_make ("queue", NULL);
+  GstElement* app_convert = gst_element_factory_make ("audioconvert", NULL);
+  GstElement* app_sink = gst_element_factory_make ("appsink", NULL);
+
+  if (!pipeline || !src || !tee || !audio_queue || !audio_convert ||
+      !audio_resample || !audio_sink || !app_queue || !app_convert ||
+      !app_sink) {
+    g_printerr ("Not all elements could be created.\n");
+    return -1;
+  }
+
+  g_object_set (src, "is-live", TRUE, NULL);
+
+  // The ring's format. The appsink hands over every buffer as soon as it
+  // arrives (no clock sync), and the callbacks avoid a signal emission per
+  // buffer.
+  GstCaps* caps = gst_caps_new_simple ("audio/x-raw",
+      "format", G_TYPE_STRING, "S16LE",
+      "layout", G_TYPE_STRING, "interleaved",
+      "rate", G_TYPE_INT, SAMPLE_RATE,
+      "channels", G_TYPE_INT, CHANNELS,
+      NULL);
+  g_object_set (app_sink, "caps", caps, "sync", FALSE, NULL);
+  gst_caps_unref (caps);
+
+  GstAppSinkCallbacks callbacks = { .new_sample = new_sample };
+  gst_app_sink_set_callbacks (GST_APP_SINK (app_sink), &callbacks, NULL, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), src, tee, audio_queue, audio_convert,
+      audio_resample, audio_sink, app_queue, app_convert, app_sink, NULL);
+  if (!gst_element_link_many (src, tee, audio_queue, audio_convert,
+          audio_resample, audio_sink, NULL) ||
+      !gst_element_link_many (tee, app_queue, app_convert, app_sink, NULL)) {
+    g_printerr ("Elements could not be linked.\n");
+    gst_object_unref (pipeline);
+    return -1;
+  }
+
+  GstBus* bus = gst_element_get_bus (pipeline);
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect (G_OBJECT (bus), "message::error", (GCallback) error_cb,
+      NULL);
+  gst_object_unref (bus);
+
+  g_timeout_add_seconds (10, report_tap, NULL);
+
+  g_print ("Writing %d Hz, %d channel S16LE audio to %s\n", SAMPLE_RATE,
+      CHANNELS, path);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  main_loop = g_main_loop_new (NULL, FALSE);
+  g_main_loop_run (main_loop);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  gst_object_unref (pipeline);
+  g_main_loop_unref (main_loop);
+  shm_ring_close (ring);
+  return 0;
+}
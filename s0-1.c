@@ -0,0 +1,444 @@
+/*
+clear && gcc -g s0-1.c -o s0-1 `pkg-config --cflags --libs gstreamer-1.0 gstreamer-app-1.0` && ./s0-1
+*/
+
+/* Stretch 0, read and write: raw audio makes a round trip through an external
+ * process before it is visualized.
+ *
+ *   audiotestsrc -> tee -> queue -> audioconvert -> audioresample
+ *                      |                             -> autoaudiosink
+ *                      +--> queue -> audioconvert -> appsink -> ring
+ *
+ *   return ring -> appsrc -> audioconvert -> wavescope -> videoconvert
+ *               -> autovideosink
+ *
+ * Each appsink buffer goes into the ring of shmring.h, as in s0-0.c. The
+ * external process (s0-echo.c) writes it, unchanged, into a return ring of
+ * its own, and a thread here pushes what comes back into the appsrc with the
+ * original timestamps.
+ *
+ * When no external process is attached (there is no return ring, or its
+ * writer has gone quiet), the appsink hands its buffers straight to the
+ * appsrc instead. At most MAX_IN_FLIGHT buffers are out at once; beyond that
+ * the oldest is given up on. The time from a buffer leaving the appsink to
+ * coming back into the appsrc is printed every second.
+ *
+ * Usage: s0-1 [ring file [return ring file]], default SHM_RING_DEFAULT_PATH
+ * and SHM_RING_RETURN_PATH.
+ */
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <stdlib.h>
+
+#include "shmring.h"
+
+#define SAMPLE_RATE 44100
+#define CHANNELS 2
+#define BYTES_PER_SAMPLE 2
+#define BYTES_PER_FRAME (CHANNELS * BYTES_PER_SAMPLE)
+
+// 256 frames per buffer, about 5.8 ms. One slot holds one buffer.
+#define SAMPLES_PER_BUFFER 256
+#define RING_SLOT_SIZE (SAMPLES_PER_BUFFER * BYTES_PER_FRAME)
+#define RING_SLOTS 64
+
+// Buffers out at the external process at once. Must be a power of two.
+#define MAX_IN_FLIGHT 4
+
+// What the appsrc may queue.
+#define APP_SRC_MAX_BYTES ((guint64) MAX_IN_FLIGHT * RING_SLOT_SIZE)
+
+// How often the return thread looks at the return ring.
+#define POLL_US 100
+
+// The external process counts as gone when its return ring has been quiet
+// for this long, and is looked for again this often.
+#define DETACH_US (50 * 1000)
+#define ATTACH_CHECK_US (500 * 1000)
+
+// The latency goal per buffer.
+#define LATENCY_GOAL_US 1000
+
+// A buffer sent to the external process and not yet back.
+typedef struct _InFlight
+{
+  GstClockTime pts;
+  GstClockTime duration;
+  gint64 sent_us;
+} InFlight;
+
+static const gchar* ring_path;
+static const gchar* return_path;
+static ShmRing* ring;
+static GstElement* app_src;
+static GMainLoop* main_loop;
+
+// Whether @app_src drops its oldest buffer by itself when full. Its
+// "leaky-type" property is new in GStreamer 1.20; before that, push_locked
+// drops instead.
+static gboolean app_src_leaks;
+
+// Round trip state, shared by the appsink streaming thread and the return
+// thread and protected by @lock. Everything pushed into @app_src is pushed
+// with @lock held, so buffers go in in order.
+static GMutex lock;
+static gboolean attached;
+static InFlight in_flight[MAX_IN_FLIGHT];
+static guint in_flight_head;
+static guint in_flight_tail;
+static GstClockTime last_pushed_pts = GST_CLOCK_TIME_NONE;
+
+// Per-second statistics, protected by @lock.
+static gint64 latency_us[1024];
+static gint n_latency;
+static gint passthrough;
+static gint given_up;
+static gint overflowed;
+
+static gboolean running = TRUE;
+
+/* Push @buffer into @app_src, taking it over. Called with @lock held. */
+static void
+push_locked (GstBuffer* buffer)
+{
+  last_pushed_pts = GST_BUFFER_PTS (buffer);
+  if (!app_src_leaks && gst_app_src_get_current_level_bytes (
+          GST_APP_SRC (app_src)) >= APP_SRC_MAX_BYTES) {
+    overflowed++;
+    gst_buffer_unref (buffer);
+    return;
+  }
+  gst_app_src_push_buffer (GST_APP_SRC (app_src), buffer);
+}
+
+/* Forget every buffer that is out. Called with @lock held. */
+static void
+give_up_in_flight_locked (void)
+{
+  given_up += in_flight_head - in_flight_tail;
+  in_flight_tail = in_flight_head;
+}
+
+/* Called by the appsink, in its streaming thread, for every buffer. */
+static GstFlowReturn
+new_sample (GstAppSink* sink, gpointer user_data)
+{
+  GstSample* sample = gst_app_sink_pull_sample (sink);
+  if (!sample) {
+    return GST_FLOW_EOS;
+  }
+  GstBuffer* buffer = gst_sample_get_buffer (sample);
+
+  g_mutex_lock (&lock);
+
+  if (!attached || gst_buffer_get_size (buffer) > RING_SLOT_SIZE) {
+    // Fast path: nobody to send it to, so no copies and no waiting. The
+    // heartbeat tells an external process that starts now that we're here.
+    passthrough++;
+    push_locked (gst_buffer_ref (buffer));
+    shm_ring_heartbeat (ring);
+  } else {
+    if (in_flight_head - in_flight_tail == MAX_IN_FLIGHT) {
+      in_flight_tail++;
+      given_up++;
+    }
+
+    InFlight* f = &in_flight[in_flight_head++ & (MAX_IN_FLIGHT - 1)];
+    f->pts = GST_BUFFER_PTS (buffer);
+    f->duration = GST_BUFFER_DURATION (buffer);
+    f->sent_us = g_get_monotonic_time ();
+
+    gsize n = gst_buffer_extract (buffer, 0, shm_ring_write_begin (ring),
+        RING_SLOT_SIZE);
+    shm_ring_write_commit (ring, n, f->pts);
+  }
+
+  g_mutex_unlock (&lock);
+
+  gst_sample_unref (sample);
+  return GST_FLOW_OK;
+}
+
+/* Match a slot that came back to the buffer it was sent as, and push it into
+ * @app_src. Slots that come back too late, or that were never sent (the
+ * external process may have seen slots from before it was attached), are
+ * dropped. Called with @lock held.
+ */
+static void
+handle_return_locked (const ShmRingSlot* slot, GstBuffer* buffer)
+{
+  while (in_flight_tail != in_flight_head) {
+    InFlight* f = &in_flight[in_flight_tail & (MAX_IN_FLIGHT - 1)];
+
+    if (f->pts > slot->pts) {
+      break;
+    }
+    in_flight_tail++;
+
+    if (f->pts < slot->pts) {
+      // Sent earlier but never came back.
+      given_up++;
+      continue;
+    }
+
+    if (GST_CLOCK_TIME_IS_VALID (last_pushed_pts) &&
+        f->pts <= last_pushed_pts) {
+      break;
+    }
+
+    GST_BUFFER_PTS (buffer) = f->pts;
+    GST_BUFFER_DURATION (buffer) = f->duration;
+    if (n_latency < G_N_ELEMENTS (latency_us)) {
+      latency_us[n_latency++] = g_get_monotonic_time () - f->sent_us;
+    }
+    push_locked (buffer);
+    return;
+  }
+
+  gst_buffer_unref (buffer);
+}
+
+/* The return thread: attaches to the external process's ring, and feeds what
+ * it writes back into @app_src.
+ */
+static gpointer
+return_thread (gpointer user_data)
+{
+  ShmRing* back = NULL;
+  guint64 seq = 0;
+  gint64 next_check = 0;
+
+  while (g_atomic_int_get (&running)) {
+    gint64 now = g_get_monotonic_time ();
+
+    if (!back) {
+      if (now >= next_check) {
+        next_check = now + ATTACH_CHECK_US;
+        back = shm_ring_open (return_path);
+        if (back && shm_ring_writer_idle_us (back) > DETACH_US) {
+          shm_ring_close (back);
+          back = NULL;
+        }
+        if (back) {
+          seq = shm_ring_head (back);
+          g_print ("External process attached\n");
+          g_mutex_lock (&lock);
+          attached = TRUE;
+          g_mutex_unlock (&lock);
+        }
+      }
+      g_usleep (POLL_US);
+      continue;
+    }
+
+    const ShmRingSlot* slot;
+    guint64 stamp;
+    switch (shm_ring_read_begin (back, seq, &slot, &stamp)) {
+      case SHM_RING_READ_OK: {
+        // The returned audio has to be copied out: the appsrc keeps the
+        // buffer after the slot is reused.
+        guint32 size = MIN (slot->size, shm_ring_slot_size (back));
+        GstBuffer* buffer = gst_buffer_new_allocate (NULL, size, NULL);
+        gst_buffer_fill (buffer, 0, slot->data, size);
+        ShmRingSlot copy = *slot;
+
+        if (shm_ring_read_end (back, slot, stamp)) {
+          g_mutex_lock (&lock);
+          handle_return_locked (&copy, buffer);
+          g_mutex_unlock (&lock);
+        } else {
+          gst_buffer_unref (buffer);
+        }
+        seq++;
+        break;
+      }
+
+      case SHM_RING_READ_LAPPED:
+        seq = shm_ring_head (back);
+        break;
+
+      case SHM_RING_READ_EMPTY:
+        if (shm_ring_writer_idle_us (back) > DETACH_US) {
+          g_print ("External process detached, passing audio through\n");
+          g_mutex_lock (&lock);
+          attached = FALSE;
+          give_up_in_flight_locked ();
+          g_mutex_unlock (&lock);
+          shm_ring_close (back);
+          back = NULL;
+          next_check = now + ATTACH_CHECK_US;
+        } else {
+          g_usleep (POLL_US);
+        }
+        break;
+    }
+  }
+
+  if (back) {
+    shm_ring_close (back);
+  }
+  return NULL;
+}
+
+static gint
+compare_int64 (gconstpointer a, gconstpointer b)
+{
+  gint64 x = *(const gint64*) a, y = *(const gint64*) b;
+  return x < y ? -1 : x > y;
+}
+
+/* Once a second, print the round trip latency of the buffers that came back
+ * and how many took the fast path, were given up on or found the appsrc
+ * full.
+ */
+static gboolean
+report_round_trip (gpointer user_data)
+{
+  gint64 sorted[G_N_ELEMENTS (latency_us)];
+
+  g_mutex_lock (&lock);
+  gint n = n_latency;
+  memcpy (sorted, latency_us, n * sizeof sorted[0]);
+  gint pass = passthrough, lost = given_up, full = overflowed;
+  n_latency = passthrough = given_up = overflowed = 0;
+  g_mutex_unlock (&lock);
+
+  if (n) {
+    qsort (sorted, n, sizeof sorted[0], compare_int64);
+    g_print ("Round trip: %d buffers, p50 %.3f ms, p99 %.3f ms, max %.3f ms "
+        "(goal < %.1f ms)", n, sorted[n / 2] / 1e3, sorted[n * 99 / 100] / 1e3,
+        sorted[n - 1] / 1e3, LATENCY_GOAL_US / 1e3);
+  } else {
+    g_print ("Round trip: no buffers");
+  }
+  g_print (", %d passed through, %d given up, %d dropped by a full appsrc\n",
+      pass, lost, full);
+  return G_SOURCE_CONTINUE;
+}
+
+/* This function is called when an error message is posted on the bus */
+static void
+error_cb (GstBus* bus, GstMessage* msg, gpointer user_data)
+{
+  GError* err;
+  gchar* debug_info;
+
+  gst_message_parse_error (msg, &err, &debug_info);
+  g_printerr ("Error received from element %s: %s\n",
+      GST_OBJECT_NAME (msg->src), err->message);
+  g_printerr ("Debugging information: %s\n", debug_info ? debug_info : "none");
+  g_clear_error (&err);
+  g_free (debug_info);
+
+  g_main_loop_quit (main_loop);
+}
+
+int
+main (int argc, char* argv[])
+{
+  gst_init (&argc, &argv);
+
+  ring_path = argc > 1 ? argv[1] : SHM_RING_DEFAULT_PATH;
+  return_path = argc > 2 ? argv[2] : SHM_RING_RETURN_PATH;
+
+  ring = shm_ring_create (ring_path, RING_SLOTS, RING_SLOT_SIZE, SAMPLE_RATE,
+      CHANNELS, BYTES_PER_SAMPLE);
+  if (!ring) {
+    g_printerr ("Could not create %s: %s\n", ring_path, g_strerror (errno));
+    return -1;
+  }
+
+  GstElement* pipeline = gst_pipeline_new ("s0-pipeline");
+  GstElement* src = gst_element_factory_make ("audiotestsrc", NULL);
+  GstElement* tee = gst_element_factory_make ("tee", NULL);
+  GstElement* audio_queue = gst_element_factory_make ("queue", NULL);
+  GstElement* audio_convert = gst_element_factory_make ("audioconvert", NULL);
+  GstElement* audio_resample = gst_element_factory_make ("audioresample", NULL);
+  GstElement* audio_sink = gst_element_factory_make ("autoaudiosink", NULL);
+  GstElement* app_queue = gst_element_factory_make ("queue", NULL);
+  GstElement* app_convert = gst_element_factory_make ("audioconvert", NULL);
+  GstElement* app_sink = gst_element_factory_make ("appsink", NULL);
+  GstElement* visual_convert = gst_element_factory_make ("audioconvert", NULL);
+  GstElement* visual = gst_element_factory_make ("wavescope", NULL);
+  GstElement* video_convert = gst_element_factory_make ("videoconvert", NULL);
+  GstElement* video_sink = gst_element_factory_make ("autovideosink", NULL);
+  app_src = gst_element_factory_make ("appsrc", NULL);
+
+  if (!pipeline || !src || !tee || !audio_queue || !audio_convert ||
+      !audio_resample || !audio_sink || !app_queue || !app_convert ||
+      !app_sink || !app_src || !visual_convert || !visual || !video_convert ||
+      !video_sink) {
+    g_printerr ("Not all elements could be created.\n");
+    return -1;
+  }
+
+  g_object_set (src, "is-live", TRUE, "samplesperbuffer", SAMPLES_PER_BUFFER,
+      NULL);
+
+  // The format of both rings, on both ends of the round trip.
+  GstCaps* caps = gst_caps_new_simple ("audio/x-raw",
+      "format", G_TYPE_STRING, "S16LE",
+      "layout", G_TYPE_STRING, "interleaved",
+      "rate", G_TYPE_INT, SAMPLE_RATE,
+      "channels", G_TYPE_INT, CHANNELS,
+      NULL);
+  g_object_set (app_sink, "caps", caps, "sync", FALSE, NULL);
+
+  // The appsrc never blocks the appsink's streaming thread; anything beyond a
+  // few buffers is dropped rather than queued. With "block" off, "max-bytes"
+  // alone only makes it emit "enough-data" and queue on, so it is
+  // "leaky-type" that drops, or push_locked where that is missing.
+  g_object_set (app_src, "caps", caps, "format", GST_FORMAT_TIME,
+      "is-live", TRUE, "block", FALSE, "max-bytes", APP_SRC_MAX_BYTES, NULL);
+  app_src_leaks = g_object_class_find_property (
+      G_OBJECT_GET_CLASS (app_src), "leaky-type") != NULL;
+  if (app_src_leaks) {
+    g_object_set (app_src, "leaky-type", 2 /* downstream */, NULL);
+  }
+  gst_caps_unref (caps);
+
+  GstAppSinkCallbacks callbacks = { .new_sample = new_sample };
+  gst_app_sink_set_callbacks (GST_APP_SINK (app_sink), &callbacks, NULL, NULL);
+
+  gst_bin_add_many (GST_BIN (pipeline), src, tee, audio_queue, audio_convert,
+      audio_resample, audio_sink, app_queue, app_convert, app_sink, app_src,
+      visual_convert, visual, video_convert, video_sink, NULL);
+  if (!gst_element_link_many (src, tee, audio_queue, audio_convert,
+          audio_resample, audio_sink, NULL) ||
+      !gst_element_link_many (tee, app_queue, app_convert, app_sink, NULL) ||
+      !gst_element_link_many (app_src, visual_convert, visual, video_convert,
+          video_sink, NULL)) {
+    g_printerr ("Elements could not be linked.\n");
+    gst_object_unref (pipeline);
+    return -1;
+  }
+
+  GstBus* bus = gst_element_get_bus (pipeline);
+  gst_bus_add_signal_watch (bus);
+  g_signal_connect (G_OBJECT (bus), "message::error", (GCallback) error_cb,
+      NULL);
+  gst_object_unref (bus);
+
+  g_mutex_init (&lock);
+  GThread* thread = g_thread_new ("return", return_thread, NULL);
+  g_timeout_add_seconds (1, report_round_trip, NULL);
+
+  g_print ("Sending audio to %s, expecting it back on %s\n", ring_path,
+      return_path);
+  gst_element_set_state (pipeline, GST_STATE_PLAYING);
+
+  main_loop = g_main_loop_new (NULL, FALSE);
+  g_main_loop_run (main_loop);
+
+  gst_element_set_state (pipeline, GST_STATE_NULL);
+  g_atomic_int_set (&running, FALSE);
+  g_thread_join (thread);
+  g_mutex_clear (&lock);
+
+  gst_object_unref (pipeline);
+  g_main_loop_unref (main_loop);
+  shm_ring_close (ring);
+  return 0;
+}
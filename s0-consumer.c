@@ -0,0 +1,152 @@
+/*
+clear && gcc -O2 s0-consumer.c -o s0-consumer `pkg-config --cflags --libs glib-2.0` -lm && ./s0-consumer
+*/
+
+/* Reference consumer for the shared-memory audio ring written by s0-0.c.
+ * Start any number of them, before or after s0-0.
+ *
+ * It follows the ring from its head and works on each slot in place: it
+ * finds the peak level of the S16 samples without copying them out. Once a
+ * second it prints what it got:
+ *
+ *   slots/KB  - slots read and validated, and their payload.
+ *   peak      - the loudest sample, in dBFS.
+ *   lapped    - slots the writer overwrote before they were read.
+ *   torn      - slots overwritten while they were being read, so thrown away.
+ *   delay     - time from the writer publishing a slot to it being read,
+ *               mean and max.
+ *
+ * Usage: s0-consumer [ring file], default SHM_RING_DEFAULT_PATH.
+ */
+
+#include <glib.h>
+#include <math.h>
+
+#include "shmring.h"
+
+// How long to sleep when the ring has nothing new. The writer publishes a
+// slot every 23 ms.
+#define POLL_US 1000
+
+// A ring with no new slots for this long is opened again, in case s0-0 was
+// restarted and created a new one.
+#define REOPEN_US (2 * G_USEC_PER_SEC)
+
+typedef struct _Stats
+{
+  gint slots;
+  guint64 bytes;
+  gint peak;
+  guint64 lapped;
+  gint torn;
+  gint64 delay_sum_us;
+  gint64 delay_max_us;
+} Stats;
+
+/* The largest absolute sample value in @n_bytes of S16 samples. */
+static gint
+peak_s16 (const guint8* data, guint32 n_bytes)
+{
+  const gint16* samples = (const gint16*) data;
+  gint peak = 0;
+
+  for (guint32 i = 0; i < n_bytes / 2; ++i) {
+    gint v = ABS ((gint) samples[i]);
+    peak = MAX (peak, v);
+  }
+  return peak;
+}
+
+static void
+print_stats (const Stats* stats)
+{
+  g_print ("%d slots, %" G_GUINT64_FORMAT " KB, peak %.1f dBFS, %"
+      G_GUINT64_FORMAT " lapped, %d torn, delay %.2f ms mean %.2f ms max\n",
+      stats->slots, stats->bytes / 1024,
+      stats->peak ? 20 * log10 (stats->peak / 32768.0) : -INFINITY,
+      stats->lapped, stats->torn,
+      stats->slots ? stats->delay_sum_us / 1e3 / stats->slots : 0,
+      stats->delay_max_us / 1e3);
+}
+
+static ShmRing*
+open_ring (const gchar* path)
+{
+  ShmRing* ring;
+
+  while (!(ring = shm_ring_open (path))) {
+    g_printerr ("Waiting for %s: %s\n", path, g_strerror (errno));
+    g_usleep (G_USEC_PER_SEC);
+  }
+
+  g_print ("Reading %s: %u slots of %u bytes, %u Hz, %u channels\n", path,
+      ring->header->n_slots, ring->header->slot_size, ring->header->rate,
+      ring->header->channels);
+  return ring;
+}
+
+int
+main (int argc, char* argv[])
+{
+  const gchar* path = argc > 1 ? argv[1] : SHM_RING_DEFAULT_PATH;
+  ShmRing* ring = open_ring (path);
+  guint64 seq = shm_ring_head (ring);
+  Stats stats = { 0 };
+  gint64 next_report = g_get_monotonic_time () + G_USEC_PER_SEC;
+  gint64 last_slot = g_get_monotonic_time ();
+
+  for (;;) {
+    const ShmRingSlot* slot;
+    guint64 stamp;
+    gint64 now = g_get_monotonic_time ();
+
+    if (now >= next_report) {
+      print_stats (&stats);
+      stats = (Stats) { 0 };
+      next_report += G_USEC_PER_SEC;
+    }
+
+    switch (shm_ring_read_begin (ring, seq, &slot, &stamp)) {
+      case SHM_RING_READ_OK: {
+        guint32 size = MIN (slot->size, ring->header->slot_size);
+        gint peak = peak_s16 (slot->data, size);
+        gint64 delay = now - slot->published_us;
+
+        if (shm_ring_read_end (ring, slot, stamp)) {
+          stats.slots++;
+          stats.bytes += size;
+          stats.peak = MAX (stats.peak, peak);
+          stats.delay_sum_us += delay;
+          stats.delay_max_us = MAX (stats.delay_max_us, delay);
+        } else {
+          stats.torn++;
+        }
+        seq++;
+        last_slot = now;
+        break;
+      }
+
+      case SHM_RING_READ_LAPPED: {
+        // Skip to the newest slot; everything in between is gone or about to
+        // be.
+        guint64 head = shm_ring_head (ring);
+        stats.lapped += head - seq;
+        seq = head;
+        break;
+      }
+
+      case SHM_RING_READ_EMPTY:
+        if (now - last_slot > REOPEN_US) {
+          shm_ring_close (ring);
+          ring = open_ring (path);
+          seq = shm_ring_head (ring);
+          last_slot = g_get_monotonic_time ();
+        } else {
+          g_usleep (POLL_US);
+        }
+        break;
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,110 @@
+/*
+clear && gcc -O2 s0-echo.c -o s0-echo `pkg-config --cflags --libs glib-2.0` && ./s0-echo
+*/
+
+/* The external process of s0-1.c: reads the audio s0-1 writes into its ring
+ * and writes it back, unchanged and with the same timestamps, into a return
+ * ring that s0-1 feeds into its visualizer. Start and stop it at any time;
+ * s0-1 passes the audio through on its own while it isn't running.
+ *
+ * Usage: s0-echo [ring file [return ring file]], default
+ * SHM_RING_DEFAULT_PATH and SHM_RING_RETURN_PATH.
+ */
+
+#include <glib.h>
+#include <sched.h>
+
+#include "shmring.h"
+
+// Polls on the input ring before giving up the CPU for a while. Spinning
+// keeps the round trip short; the sleep keeps an idle echo cheap.
+#define SPINS 1000
+#define POLL_US 50
+
+// How often to tell s0-1 we are alive while there is nothing to echo.
+#define HEARTBEAT_US (10 * 1000)
+
+static ShmRing*
+open_input (const gchar* path)
+{
+  ShmRing* ring;
+
+  while (!(ring = shm_ring_open (path))) {
+    g_printerr ("Waiting for %s: %s\n", path, g_strerror (errno));
+    g_usleep (G_USEC_PER_SEC);
+  }
+  return ring;
+}
+
+int
+main (int argc, char* argv[])
+{
+  const gchar* path = argc > 1 ? argv[1] : SHM_RING_DEFAULT_PATH;
+  const gchar* return_path = argc > 2 ? argv[2] : SHM_RING_RETURN_PATH;
+
+  ShmRing* in = open_input (path);
+  ShmRing* out = shm_ring_create (return_path, in->header->n_slots,
+      in->header->slot_size, in->header->rate, in->header->channels,
+      in->header->bytes_per_sample);
+  if (!out) {
+    g_printerr ("Could not create %s: %s\n", return_path, g_strerror (errno));
+    return 1;
+  }
+  shm_ring_heartbeat (out);
+  g_print ("Echoing %s to %s\n", path, return_path);
+
+  guint64 seq = shm_ring_head (in);
+  gint idle = 0;
+  gint64 last_beat = g_get_monotonic_time ();
+
+  for (;;) {
+    const ShmRingSlot* slot;
+    guint64 stamp;
+
+    switch (shm_ring_read_begin (in, seq, &slot, &stamp)) {
+      case SHM_RING_READ_OK: {
+        guint32 size = MIN (slot->size, shm_ring_slot_size (out));
+        guint64 pts = slot->pts;
+
+        memcpy (shm_ring_write_begin (out), slot->data, size);
+
+        // Only publish what was read intact; an uncommitted slot is simply
+        // written again next time.
+        if (shm_ring_read_end (in, slot, stamp)) {
+          shm_ring_write_commit (out, size, pts);
+        }
+        seq++;
+        idle = 0;
+        break;
+      }
+
+      case SHM_RING_READ_LAPPED:
+        seq = shm_ring_head (in);
+        break;
+
+      case SHM_RING_READ_EMPTY: {
+        gint64 now = g_get_monotonic_time ();
+        if (now - last_beat > HEARTBEAT_US) {
+          shm_ring_heartbeat (out);
+          last_beat = now;
+        }
+
+        // s0-1 restarted: follow its new ring.
+        if (shm_ring_writer_idle_us (in) > G_USEC_PER_SEC) {
+          shm_ring_close (in);
+          in = open_input (path);
+          seq = shm_ring_head (in);
+        }
+
+        if (++idle < SPINS) {
+          sched_yield ();
+        } else {
+          g_usleep (POLL_US);
+        }
+        break;
+      }
+    }
+  }
+
+  return 0;
+}
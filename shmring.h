@@ -0,0 +1,340 @@
+/* Shared-memory ring of raw audio, for handing PCM from a GStreamer pipeline
+ * to other processes without sockets or copies on the reading side.
+ *
+ * The ring is a file (normally in /dev/shm) that the single writer and any
+ * number of readers map. It holds a fixed number of fixed-size slots. The
+ * writer never waits: it always fills the next slot, overwriting the oldest
+ * one. Every slot carries a seqlock stamp, so a reader that works on a slot
+ * in place can tell afterwards whether the writer overwrote it meanwhile, and
+ * readers never write to the file at all.
+ *
+ * Writer:
+ *
+ *   ShmRing *ring = shm_ring_create (path, 256, 4096, 44100, 2, 2);
+ *   guint8 *data = shm_ring_write_begin (ring);
+ *   ... fill up to shm_ring_slot_size (ring) bytes ...
+ *   shm_ring_write_commit (ring, size, pts);
+ *
+ * Reader, for each @seq from shm_ring_head () on:
+ *
+ *   switch (shm_ring_read_begin (ring, seq, &slot, &stamp)) {
+ *     case SHM_RING_READ_OK:
+ *       ... use slot->data ...
+ *       if (shm_ring_read_end (ring, slot, stamp))
+ *         ... the data used was valid ...
+ *     case SHM_RING_READ_EMPTY: ... nothing new yet ...
+ *     case SHM_RING_READ_LAPPED: ... too slow, skip ahead to the head ...
+ *   }
+ */
+
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+G_BEGIN_DECLS
+
+#define SHM_RING_MAGIC 0x52534750       /* "PGSR" */
+#define SHM_RING_VERSION 2
+
+// Where s0-0.c and s0-1.c put their ring unless told otherwise.
+#define SHM_RING_DEFAULT_PATH "/dev/shm/gstproto-s0.ring"
+
+// Where the external process of s0-1.c writes the audio back.
+#define SHM_RING_RETURN_PATH "/dev/shm/gstproto-s0-return.ring"
+
+typedef struct _ShmRingHeader
+{
+  // Written last when the ring is created.
+  guint32 magic;
+  guint32 version;
+
+  // Number of slots, a power of two, and payload bytes per slot.
+  guint32 n_slots;
+  guint32 slot_size;
+
+  // Format of the payload: interleaved samples.
+  guint32 rate;
+  guint32 channels;
+  guint32 bytes_per_sample;
+  guint32 reserved;
+
+  // Number of slots published so far. Only the writer changes it.
+  guint64 head;
+
+  // g_get_monotonic_time () when the writer last said it is alive, see
+  // shm_ring_heartbeat.
+  gint64 heartbeat_us;
+} ShmRingHeader;
+
+typedef struct _ShmRingSlot
+{
+  // 2n + 1 while slot number n is being written, 2n + 2 once it is
+  // published, 0 before the first use.
+  guint64 stamp;
+
+  // Stream time of the first sample, in nanoseconds.
+  guint64 pts;
+
+  // g_get_monotonic_time () when the slot was published. Comparable across
+  // processes on the same machine.
+  gint64 published_us;
+
+  guint32 size;
+  guint32 reserved;
+
+  guint8 data[];
+} ShmRingSlot;
+
+typedef struct _ShmRing
+{
+  ShmRingHeader *header;
+  guint8 *slots;
+  gsize stride;
+  gsize map_size;
+} ShmRing;
+
+typedef enum
+{
+  // The slot holds the requested sequence number.
+  SHM_RING_READ_OK,
+
+  // The requested slot isn't published yet.
+  SHM_RING_READ_EMPTY,
+
+  // The writer has already reused the slot for a later sequence number.
+  SHM_RING_READ_LAPPED,
+} ShmRingRead;
+
+static inline gsize
+shm_ring_stride (guint32 slot_size)
+{
+  // Whole cache lines, so neighboring slots don't share one.
+  return (sizeof (ShmRingSlot) + slot_size + 63) & ~(gsize) 63;
+}
+
+static inline ShmRingSlot *
+shm_ring_slot (ShmRing * ring, guint64 seq)
+{
+  return (ShmRingSlot *) (ring->slots +
+      (seq & (ring->header->n_slots - 1)) * ring->stride);
+}
+
+static inline ShmRing *
+shm_ring_map (int fd, gsize map_size, int prot)
+{
+  ShmRing *ring;
+  void *map = mmap (NULL, map_size, prot, MAP_SHARED, fd, 0);
+
+  if (map == MAP_FAILED)
+    return NULL;
+
+  ring = g_new0 (ShmRing, 1);
+  ring->header = map;
+  ring->slots = (guint8 *) map + 64;
+  ring->map_size = map_size;
+  return ring;
+}
+
+/* Writer side. Creates the ring file at @path, replacing any earlier one.
+ * Readers that still have the earlier file mapped keep it, but it no longer
+ * changes. @n_slots must be a power of two. Returns NULL with errno set on
+ * failure.
+ */
+static inline ShmRing *
+shm_ring_create (const gchar * path, guint32 n_slots, guint32 slot_size,
+    guint32 rate, guint32 channels, guint32 bytes_per_sample)
+{
+  gsize stride = shm_ring_stride (slot_size);
+  gsize map_size = 64 + stride * n_slots;
+  ShmRing *ring;
+  int fd;
+
+  g_return_val_if_fail (n_slots && (n_slots & (n_slots - 1)) == 0, NULL);
+
+  g_unlink (path);
+  fd = open (path, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if (fd < 0)
+    return NULL;
+  if (ftruncate (fd, map_size) != 0) {
+    int err = errno;
+    close (fd);
+    errno = err;
+    return NULL;
+  }
+
+  ring = shm_ring_map (fd, map_size, PROT_READ | PROT_WRITE);
+  close (fd);
+  if (!ring)
+    return NULL;
+
+  ring->stride = stride;
+  ring->header->version = SHM_RING_VERSION;
+  ring->header->n_slots = n_slots;
+  ring->header->slot_size = slot_size;
+  ring->header->rate = rate;
+  ring->header->channels = channels;
+  ring->header->bytes_per_sample = bytes_per_sample;
+  __atomic_store_n (&ring->header->magic, SHM_RING_MAGIC, __ATOMIC_RELEASE);
+
+  return ring;
+}
+
+/* Reader side. Maps the ring at @path read-only. Returns NULL with errno set
+ * if there is none, or it isn't (yet) a complete ring.
+ */
+static inline ShmRing *
+shm_ring_open (const gchar * path)
+{
+  struct stat st;
+  ShmRing *ring;
+  int fd = open (path, O_RDONLY);
+
+  if (fd < 0)
+    return NULL;
+  if (fstat (fd, &st) != 0 || st.st_size < 64) {
+    close (fd);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  ring = shm_ring_map (fd, st.st_size, PROT_READ);
+  close (fd);
+  if (!ring)
+    return NULL;
+
+  if (__atomic_load_n (&ring->header->magic, __ATOMIC_ACQUIRE) !=
+      SHM_RING_MAGIC || ring->header->version != SHM_RING_VERSION ||
+      64 + shm_ring_stride (ring->header->slot_size) *
+      ring->header->n_slots > ring->map_size) {
+    munmap (ring->header, ring->map_size);
+    g_free (ring);
+    errno = EINVAL;
+    return NULL;
+  }
+
+  ring->stride = shm_ring_stride (ring->header->slot_size);
+  return ring;
+}
+
+static inline void
+shm_ring_close (ShmRing * ring)
+{
+  munmap (ring->header, ring->map_size);
+  g_free (ring);
+}
+
+static inline guint32
+shm_ring_slot_size (ShmRing * ring)
+{
+  return ring->header->slot_size;
+}
+
+/* The sequence number the writer publishes next. */
+static inline guint64
+shm_ring_head (ShmRing * ring)
+{
+  return __atomic_load_n (&ring->header->head, __ATOMIC_ACQUIRE);
+}
+
+/* Writer side. Returns the payload of the next slot, shm_ring_slot_size ()
+ * bytes, to be filled in place and published with shm_ring_write_commit. A
+ * slot that is never committed is simply begun again by the next call.
+ */
+static inline guint8 *
+shm_ring_write_begin (ShmRing * ring)
+{
+  guint64 seq = ring->header->head;
+  ShmRingSlot *slot = shm_ring_slot (ring, seq);
+
+  // Mark the slot as being written before touching the payload, so readers
+  // still on the previous lap can tell.
+  __atomic_store_n (&slot->stamp, 2 * seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  return slot->data;
+}
+
+/* Writer side. Publishes the slot from shm_ring_write_begin with @size bytes
+ * of payload starting at stream time @pts.
+ */
+static inline void
+shm_ring_write_commit (ShmRing * ring, guint32 size, guint64 pts)
+{
+  guint64 seq = ring->header->head;
+  ShmRingSlot *slot = shm_ring_slot (ring, seq);
+
+  g_return_if_fail (size <= ring->header->slot_size);
+
+  slot->size = size;
+  slot->pts = pts;
+  slot->published_us = g_get_monotonic_time ();
+  __atomic_store_n (&slot->stamp, 2 * seq + 2, __ATOMIC_RELEASE);
+  __atomic_store_n (&ring->header->head, seq + 1, __ATOMIC_RELEASE);
+  __atomic_store_n (&ring->header->heartbeat_us, slot->published_us,
+      __ATOMIC_RELAXED);
+}
+
+/* Writer side. Tells readers that the writer is alive even if it has nothing
+ * to publish.
+ */
+static inline void
+shm_ring_heartbeat (ShmRing * ring)
+{
+  __atomic_store_n (&ring->header->heartbeat_us, g_get_monotonic_time (),
+      __ATOMIC_RELAXED);
+}
+
+/* Reader side. Microseconds since the writer last published a slot or called
+ * shm_ring_heartbeat, or G_MAXINT64 if it never did either.
+ */
+static inline gint64
+shm_ring_writer_idle_us (ShmRing * ring)
+{
+  gint64 beat = __atomic_load_n (&ring->header->heartbeat_us,
+      __ATOMIC_RELAXED);
+
+  return beat ? g_get_monotonic_time () - beat : G_MAXINT64;
+}
+
+/* Reader side. Looks up slot number @seq. On SHM_RING_READ_OK, @slot points
+ * into the mapping; it is only known to have been valid once
+ * shm_ring_read_end, with the same @stamp, returns TRUE.
+ */
+static inline ShmRingRead
+shm_ring_read_begin (ShmRing * ring, guint64 seq, const ShmRingSlot ** slot,
+    guint64 * stamp)
+{
+  ShmRingSlot *s = shm_ring_slot (ring, seq);
+  guint64 v = __atomic_load_n (&s->stamp, __ATOMIC_ACQUIRE);
+
+  if (v < 2 * seq + 2)
+    return SHM_RING_READ_EMPTY;
+  if (v > 2 * seq + 2)
+    return SHM_RING_READ_LAPPED;
+
+  *slot = s;
+  *stamp = v;
+  return SHM_RING_READ_OK;
+}
+
+/* Reader side. Returns FALSE if the writer started overwriting @slot since
+ * shm_ring_read_begin, in which case anything read from it must be thrown
+ * away.
+ */
+static inline gboolean
+shm_ring_read_end (ShmRing * ring, const ShmRingSlot * slot, guint64 stamp)
+{
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  return __atomic_load_n (&slot->stamp, __ATOMIC_RELAXED) == stamp;
+}
+
+G_END_DECLS
+
+#endif /* SHMRING_H */
@@ -0,0 +1,251 @@
+/* A video sink that renders into a GtkDrawingArea without the GTK main thread
+ * touching the video frames.
+ *
+ * gtksink hands every frame to the main thread, which wraps it in a Cairo
+ * surface and scales it to the widget in its draw handler. A SurfaceSink
+ * instead owns three Cairo image surfaces of the frame size:
+ *
+ *   back  - being written by the streaming thread, from an appsink callback.
+ *   ready - the newest complete frame.
+ *   front - the frame the widget shows.
+ *
+ * The streaming thread copies each frame into the back surface and swaps it
+ * with the ready one. On every tick of the widget's frame clock, the main
+ * thread swaps the ready surface with the front one if it holds a newer frame
+ * and queues a redraw, and the draw handler paints the front surface 1:1.
+ * The swaps are a single atomic exchange, so neither side ever waits for the
+ * other, and a frame that arrives before the previous one was shown simply
+ * replaces it.
+ *
+ * The appsink only accepts BGRx (Cairo's RGB24) at the size it was given, in
+ * device pixels, so the visualizers render at the size that is shown and
+ * nothing is converted or scaled on the way. surface_sink_set_size changes
+ * that size; the streaming thread resizes the back surface when a frame of
+ * the new size arrives.
+ */
+
+#ifndef SURFACESINK_H
+#define SURFACESINK_H
+
+#include <gtk/gtk.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+#include <string.h>
+
+G_BEGIN_DECLS
+
+// In SurfaceSink.ready: set while the ready surface holds a frame the main
+// thread hasn't taken yet. The low bits are the surface index.
+#define SURFACE_SINK_FRESH 4
+
+typedef struct _SurfaceSink
+{
+  GstElement *appsink;
+  GtkWidget *area;
+
+  // The frame size the appsink asks for.
+  gint width;
+  gint height;
+
+  cairo_surface_t *surfaces[3];
+
+  // Index of the back surface, only used by the streaming thread.
+  gint back;
+
+  // Index of the ready surface, plus SURFACE_SINK_FRESH. Swapped atomically
+  // by both threads.
+  gint ready;
+
+  // Index of the front surface, and whether it holds a frame yet. Only used
+  // by the main thread.
+  gint front;
+  gboolean showing;
+
+  // Frames written by the streaming thread, frames shown, and the main
+  // thread time spent on showing them, in microseconds.
+  gint frames_written;
+  gint frames_shown;
+  gint64 main_us;
+} SurfaceSink;
+
+/* Streaming thread: copy the frame into the back surface and publish it. */
+static inline GstFlowReturn
+surface_sink_new_sample_cb (GstAppSink * appsink, gpointer user_data)
+{
+  SurfaceSink *sink = user_data;
+  GstSample *sample = gst_app_sink_pull_sample (appsink);
+  GstVideoFrame frame;
+  GstVideoInfo info;
+
+  if (!sample)
+    return GST_FLOW_EOS;
+
+  if (gst_video_info_from_caps (&info, gst_sample_get_caps (sample)) &&
+      gst_video_frame_map (&frame, &info, gst_sample_get_buffer (sample),
+          GST_MAP_READ)) {
+    gint width = GST_VIDEO_INFO_WIDTH (&info);
+    gint height = GST_VIDEO_INFO_HEIGHT (&info);
+    cairo_surface_t *surface = sink->surfaces[sink->back];
+    guint8 *dst;
+    gint dst_stride;
+    const guint8 *src = GST_VIDEO_FRAME_PLANE_DATA (&frame, 0);
+    gint src_stride = GST_VIDEO_FRAME_PLANE_STRIDE (&frame, 0);
+
+    // The back surface belongs to this thread alone, so it can be replaced.
+    if (cairo_image_surface_get_width (surface) != width ||
+        cairo_image_surface_get_height (surface) != height) {
+      cairo_surface_destroy (surface);
+      surface = cairo_image_surface_create (CAIRO_FORMAT_RGB24, width, height);
+      sink->surfaces[sink->back] = surface;
+    }
+    dst = cairo_image_surface_get_data (surface);
+    dst_stride = cairo_image_surface_get_stride (surface);
+
+    cairo_surface_flush (surface);
+    for (gint y = 0; y < height; y++)
+      memcpy (dst + y * dst_stride, src + y * src_stride, width * 4);
+    cairo_surface_mark_dirty (surface);
+    gst_video_frame_unmap (&frame);
+
+    sink->back = __atomic_exchange_n (&sink->ready,
+        sink->back | SURFACE_SINK_FRESH, __ATOMIC_ACQ_REL) & 3;
+    g_atomic_int_inc (&sink->frames_written);
+  }
+
+  gst_sample_unref (sample);
+  return GST_FLOW_OK;
+}
+
+/* Main thread, once per frame clock tick: take the newest frame, if any. */
+static inline gboolean
+surface_sink_tick_cb (GtkWidget * widget, GdkFrameClock * clock,
+    gpointer user_data)
+{
+  SurfaceSink *sink = user_data;
+  gint64 start;
+
+  if (!(__atomic_load_n (&sink->ready, __ATOMIC_ACQUIRE) & SURFACE_SINK_FRESH))
+    return G_SOURCE_CONTINUE;
+
+  start = g_get_monotonic_time ();
+
+  sink->front = __atomic_exchange_n (&sink->ready, sink->front,
+      __ATOMIC_ACQ_REL) & 3;
+  sink->showing = TRUE;
+  sink->frames_shown++;
+  gtk_widget_queue_draw (widget);
+
+  sink->main_us += g_get_monotonic_time () - start;
+  return G_SOURCE_CONTINUE;
+}
+
+static inline gboolean
+surface_sink_draw_cb (GtkWidget * widget, cairo_t * cr, gpointer user_data)
+{
+  SurfaceSink *sink = user_data;
+  gint64 start = g_get_monotonic_time ();
+
+  if (!sink->showing) {
+    cairo_set_source_rgb (cr, 0, 0, 0);
+  } else {
+    // One frame pixel per device pixel.
+    gint scale = gtk_widget_get_scale_factor (widget);
+    cairo_scale (cr, 1.0 / scale, 1.0 / scale);
+    cairo_set_source_surface (cr, sink->surfaces[sink->front], 0, 0);
+    cairo_pattern_set_filter (cairo_get_source (cr), CAIRO_FILTER_FAST);
+  }
+  cairo_paint (cr);
+
+  sink->main_us += g_get_monotonic_time () - start;
+  return FALSE;
+}
+
+/* Makes the appsink of @sink take @width x @height frames (in device pixels)
+ * from now on, and asks upstream to renegotiate.
+ */
+static inline void
+surface_sink_set_size (SurfaceSink * sink, gint width, gint height)
+{
+  GstCaps *caps = gst_caps_new_simple ("video/x-raw",
+      "format", G_TYPE_STRING, "BGRx",
+      "width", G_TYPE_INT, width,
+      "height", G_TYPE_INT, height,
+      "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1, NULL);
+  GstPad *pad = gst_element_get_static_pad (sink->appsink, "sink");
+
+  sink->width = width;
+  sink->height = height;
+  g_object_set (sink->appsink, "caps", caps, NULL);
+  gst_caps_unref (caps);
+  gst_pad_push_event (pad, gst_event_new_reconfigure ());
+  gst_object_unref (pad);
+}
+
+/* Makes a sink for @width x @height frames. Its widget comes from
+ * surface_sink_create_widget, once GTK is up. Returns NULL if there is no
+ * appsink.
+ */
+static inline SurfaceSink *
+surface_sink_new (gint width, gint height)
+{
+  GstElement *appsink = gst_element_factory_make ("appsink", NULL);
+  SurfaceSink *sink;
+  GstAppSinkCallbacks callbacks = { NULL };
+
+  if (!appsink)
+    return NULL;
+
+  sink = g_new0 (SurfaceSink, 1);
+  sink->appsink = appsink;
+  for (gint i = 0; i < 3; i++)
+    sink->surfaces[i] = cairo_image_surface_create (CAIRO_FORMAT_RGB24, width,
+        height);
+  sink->back = 0;
+  sink->ready = 1;
+  sink->front = 2;
+
+  surface_sink_set_size (sink, width, height);
+  // Only the newest frame matters; render it at its time, like a video sink.
+  g_object_set (sink->appsink, "max-buffers", 1, "drop", TRUE,
+      "sync", TRUE, "qos", TRUE, NULL);
+  callbacks.new_sample = surface_sink_new_sample_cb;
+  gst_app_sink_set_callbacks (GST_APP_SINK (sink->appsink), &callbacks, sink,
+      NULL);
+
+  return sink;
+}
+
+/* Makes the drawing area that shows the frames, 1:1 in device pixels. Its
+ * size is up to the caller, who keeps the frames at that size with
+ * surface_sink_set_size. Call once, from the main thread.
+ */
+static inline GtkWidget *
+surface_sink_create_widget (SurfaceSink * sink)
+{
+  sink->area = gtk_drawing_area_new ();
+  g_signal_connect (sink->area, "draw", G_CALLBACK (surface_sink_draw_cb),
+      sink);
+  gtk_widget_add_tick_callback (sink->area, surface_sink_tick_cb, sink, NULL);
+  return sink->area;
+}
+
+/* Main thread time per frame shown since the last call, in microseconds, and
+ * the frames written and shown since then.
+ */
+static inline gdouble
+surface_sink_take_stats (SurfaceSink * sink, gint * written, gint * shown)
+{
+  gdouble per_frame = sink->frames_shown ?
+      (gdouble) sink->main_us / sink->frames_shown : 0;
+
+  *written = g_atomic_int_and (&sink->frames_written, 0);
+  *shown = sink->frames_shown;
+  sink->frames_shown = 0;
+  sink->main_us = 0;
+  return per_frame;
+}
+
+G_END_DECLS
+
+#endif /* SURFACESINK_H */
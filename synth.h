@@ -0,0 +1,304 @@
+/* Synthetic audio for test pipelines: the "psychedelic" waveform of
+ * basic-tutorial-8.c, sine, square and white noise, for any number of
+ * interleaved channels, fast enough to feed a pipeline many times faster
+ * than real time.
+ *
+ *   Synth *synth = synth_new (SYNTH_SINE, 44100, 8);
+ *   synth_fill_s16 (synth, samples, n_frames);
+ *   ...
+ *   synth_free (synth);
+ *
+ * The oscillators are two-value linear recurrences, x[n+1] = M x[n] for a 2x2
+ * matrix M. Instead of stepping one sample at a time, SYNTH_LANES samples are
+ * computed side by side: lane k starts at M^(k+1) x[0] and every lane then
+ * steps by M^SYNTH_LANES. The lanes don't depend on each other, so the inner
+ * loops compile to vector instructions at -O3, and there is no division per
+ * sample. Noise runs one xorshift generator per lane for the same reason.
+ *
+ * Channel c plays at c + 1 times the frequency of channel 0 by default, so
+ * the channels tell apart on a scope. Channel 0 of SYNTH_PSYCHEDELIC is the
+ * tutorial's waveform, to within float rounding.
+ */
+
+#ifndef SYNTH_H
+#define SYNTH_H
+
+#include <glib.h>
+#include <math.h>
+#include <string.h>
+
+G_BEGIN_DECLS
+
+#define SYNTH_LANES 8
+
+// Frames generated per channel before interleaving.
+#define SYNTH_BLOCK 512
+
+// SYNTH_PSYCHEDELIC moves its frequency one step every this many frames, as
+// the tutorial does once per 1024-byte chunk.
+#define SYNTH_SWEEP_FRAMES 512
+
+#define SYNTH_DEFAULT_FREQ 440.0
+
+typedef enum
+{
+  SYNTH_PSYCHEDELIC,
+  SYNTH_SINE,
+  SYNTH_SQUARE,
+  SYNTH_NOISE,
+} SynthWave;
+
+typedef struct _SynthChannel
+{
+  // Oscillator state; the output is @a.
+  gfloat a, b;
+
+  // Hz for sine and square, a factor on the swept frequency for psychedelic.
+  gdouble freq;
+
+  guint32 noise[SYNTH_LANES];
+} SynthChannel;
+
+typedef struct _Synth
+{
+  SynthWave wave;
+  guint rate;
+  guint channels;
+
+  // Peak amplitude, 1.0 being full scale. Psychedelic has no fixed peak; at
+  // 1.0 it is as loud as in the tutorial.
+  gfloat gain;
+
+  // The psychedelic frequency sweep.
+  gfloat c, d;
+  gfloat sweep_freq;
+  guint sweep_left;
+
+  SynthChannel *ch;
+  gfloat block[SYNTH_BLOCK];
+} Synth;
+
+static inline Synth *
+synth_new (SynthWave wave, guint rate, guint channels)
+{
+  Synth *synth = g_new0 (Synth, 1);
+
+  synth->wave = wave;
+  synth->rate = rate;
+  synth->channels = channels;
+  synth->gain = wave == SYNTH_PSYCHEDELIC ? 1.0 : 0.5;
+  synth->d = 1;
+
+  synth->ch = g_new0 (SynthChannel, channels);
+  for (guint c = 0; c < channels; c++) {
+    SynthChannel *ch = &synth->ch[c];
+
+    ch->b = 1;
+    ch->freq = wave == SYNTH_PSYCHEDELIC ? c + 1 : SYNTH_DEFAULT_FREQ * (c + 1);
+    for (guint k = 0; k < SYNTH_LANES; k++)
+      ch->noise[k] = 0x9e3779b9u * (c * SYNTH_LANES + k + 1);
+  }
+
+  return synth;
+}
+
+static inline void
+synth_free (Synth * synth)
+{
+  g_free (synth->ch);
+  g_free (synth);
+}
+
+/* Sets the frequency of @channel in Hz (sine and square), or its factor on
+ * the swept frequency (psychedelic).
+ */
+static inline void
+synth_set_frequency (Synth * synth, guint channel, gdouble freq)
+{
+  g_return_if_fail (channel < synth->channels);
+  synth->ch[channel].freq = freq;
+}
+
+/* Writes @n values of the recurrence (a, b) <- M (a, b) into @out, starting
+ * with the first step, and leaves the state after the last one in @a, @b.
+ */
+static inline void
+synth_linear_block (const gdouble m[2][2], gfloat * a, gfloat * b,
+    gfloat scale, gfloat * out, guint n)
+{
+  gdouble p00 = 1, p01 = 0, p10 = 0, p11 = 1;
+  gfloat la[SYNTH_LANES], lb[SYNTH_LANES];
+
+  // Lane k starts at M^(k+1) (a, b); afterwards p is M^SYNTH_LANES.
+  for (guint k = 0; k < SYNTH_LANES; k++) {
+    gdouble t00 = m[0][0] * p00 + m[0][1] * p10;
+    gdouble t01 = m[0][0] * p01 + m[0][1] * p11;
+    p10 = m[1][0] * p00 + m[1][1] * p10;
+    p11 = m[1][0] * p01 + m[1][1] * p11;
+    p00 = t00;
+    p01 = t01;
+    la[k] = p00 * *a + p01 * *b;
+    lb[k] = p10 * *a + p11 * *b;
+  }
+
+  gfloat s00 = p00, s01 = p01, s10 = p10, s11 = p11;
+  guint i = 0;
+
+  for (;;) {
+    if (n - i >= SYNTH_LANES) {
+      for (guint k = 0; k < SYNTH_LANES; k++)
+        out[i + k] = scale * la[k];
+    } else {
+      for (guint k = 0; k < n - i; k++)
+        out[i + k] = scale * la[k];
+    }
+
+    guint last = MIN (SYNTH_LANES, n - i) - 1;
+    i += SYNTH_LANES;
+    if (i >= n) {
+      *a = la[last];
+      *b = lb[last];
+      return;
+    }
+
+    for (guint k = 0; k < SYNTH_LANES; k++) {
+      gfloat na = s00 * la[k] + s01 * lb[k];
+      lb[k] = s10 * la[k] + s11 * lb[k];
+      la[k] = na;
+    }
+  }
+}
+
+/* Writes @n frames of @channel into @out, scaled to full scale 1.0. */
+static inline void
+synth_channel_block (Synth * synth, SynthChannel * ch, gfloat * out, guint n)
+{
+  switch (synth->wave) {
+    case SYNTH_PSYCHEDELIC:{
+      // a += b; b -= a / f
+      gdouble f = synth->sweep_freq * ch->freq;
+      const gdouble m[2][2] = { {1, 1}, {-1 / f, 1 - 1 / f} };
+
+      synth_linear_block (m, &ch->a, &ch->b, synth->gain * 500 / 32768.0,
+          out, n);
+      break;
+    }
+
+    case SYNTH_SINE:
+    case SYNTH_SQUARE:{
+      // (a, b) = (sin, cos) of the phase, rotated by w per sample.
+      gdouble w = 2 * G_PI * ch->freq / synth->rate;
+      const gdouble m[2][2] = { {cos (w), sin (w)}, {-sin (w), cos (w)} };
+      gfloat r;
+
+      synth_linear_block (m, &ch->a, &ch->b, synth->gain, out, n);
+
+      // Keep rounding from growing or shrinking the amplitude over time.
+      r = sqrtf (ch->a * ch->a + ch->b * ch->b);
+      ch->a /= r;
+      ch->b /= r;
+
+      if (synth->wave == SYNTH_SQUARE) {
+        for (guint i = 0; i < n; i++)
+          out[i] = out[i] >= 0 ? synth->gain : -synth->gain;
+      }
+      break;
+    }
+
+    case SYNTH_NOISE:{
+      gfloat scale = synth->gain / 2147483648.0f;
+
+      for (guint i = 0; i < n; i += SYNTH_LANES) {
+        gfloat v[SYNTH_LANES];
+
+        for (guint k = 0; k < SYNTH_LANES; k++) {
+          guint32 x = ch->noise[k];
+          x ^= x << 13;
+          x ^= x >> 17;
+          x ^= x << 5;
+          ch->noise[k] = x;
+          v[k] = (gint32) x * scale;
+        }
+        memcpy (out + i, v, MIN (SYNTH_LANES, n - i) * sizeof (gfloat));
+      }
+      break;
+    }
+  }
+}
+
+/* Generates the next run of at most SYNTH_BLOCK frames for every channel,
+ * handing each channel's block to @store. Returns the number of frames.
+ */
+static inline guint
+synth_next_block (Synth * synth, guint n_frames,
+    void (*store) (gpointer out, const gfloat * block, guint channel,
+        guint channels, guint n), gpointer out)
+{
+  guint n = MIN (n_frames, SYNTH_BLOCK);
+
+  if (synth->wave == SYNTH_PSYCHEDELIC) {
+    if (synth->sweep_left == 0) {
+      synth->c += synth->d;
+      synth->d -= synth->c / 1000;
+      synth->sweep_freq = 1100 + 1000 * synth->d;
+      synth->sweep_left = SYNTH_SWEEP_FRAMES;
+    }
+    n = MIN (n, synth->sweep_left);
+    synth->sweep_left -= n;
+  }
+
+  for (guint c = 0; c < synth->channels; c++) {
+    synth_channel_block (synth, &synth->ch[c], synth->block, n);
+    store (out, synth->block, c, synth->channels, n);
+  }
+  return n;
+}
+
+static inline void
+synth_store_f32 (gpointer out, const gfloat * block, guint channel,
+    guint channels, guint n)
+{
+  gfloat *samples = (gfloat *) out + channel;
+
+  for (guint i = 0; i < n; i++)
+    samples[i * channels] = block[i];
+}
+
+static inline void
+synth_store_s16 (gpointer out, const gfloat * block, guint channel,
+    guint channels, guint n)
+{
+  gint16 *samples = (gint16 *) out + channel;
+
+  for (guint i = 0; i < n; i++)
+    samples[i * channels] = (gint16) CLAMP (block[i] * 32768.0f, -32768.0f,
+        32767.0f);
+}
+
+/* Writes @n_frames frames of interleaved F32 samples into @out. */
+static inline void
+synth_fill_f32 (Synth * synth, gfloat * out, guint n_frames)
+{
+  while (n_frames > 0) {
+    guint n = synth_next_block (synth, n_frames, synth_store_f32, out);
+
+    out += n * synth->channels;
+    n_frames -= n;
+  }
+}
+
+/* Writes @n_frames frames of interleaved S16 samples into @out. */
+static inline void
+synth_fill_s16 (Synth * synth, gint16 * out, guint n_frames)
+{
+  while (n_frames > 0) {
+    guint n = synth_next_block (synth, n_frames, synth_store_s16, out);
+
+    out += n * synth->channels;
+    n_frames -= n;
+  }
+}
+
+G_END_DECLS
+
+#endif /* SYNTH_H */
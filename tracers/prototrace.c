@@ -0,0 +1,480 @@
+/*
+gcc -O2 -c prototrace.c `pkg-config --cflags gstreamer-1.0`
+*/
+
+/* The prototrace tracer.
+ *
+ * It hooks pad pushes. Each thread keeps a stack of the pushes it is inside:
+ * a push into element E starts a frame for E, pushes E makes downstream
+ * nest inside it, and when it returns, E's own time is the frame's length
+ * minus the nested pushes (and reported blocks). Each element has an entry
+ * with its totals, which the hooks update with atomics; the individual
+ * records go into a ring that any number of streaming threads write without
+ * locking, each slot carrying a sequence number so a dump can skip the ones
+ * being overwritten.
+ *
+ * The table of entries is under a lock, but a pad keeps a pointer to its
+ * element's entry in its qdata, so the table is only looked at the first
+ * time a pad pushes or is pushed into. After that a push costs the peer
+ * lookup (the pad's own lock) and a few atomic adds, and no allocations.
+ * Queue levels are sampled from the main context, not from the pushes. A
+ * dump copies the ring and the totals out first, so the streaming threads
+ * never wait on the file. benchmarks/trace-bench.c measures the cost.
+ */
+
+// The tracer API is marked unstable on older GStreamer.
+#define GST_USE_UNSTABLE_API
+
+#include "prototrace.h"
+
+#include <glib-unix.h>
+#include <signal.h>
+#include <stdio.h>
+
+// How often the queue levels are sampled.
+#define PROTO_TRACE_QUEUE_SAMPLE_MS 10
+
+typedef enum
+{
+  PROTO_TRACE_PROC,
+  PROTO_TRACE_QUEUE,
+  PROTO_TRACE_BLOCK,
+} ProtoTraceKind;
+
+static const gchar *const kind_names[] = { "proc", "queue", "block" };
+
+typedef struct _ProtoTraceRecord
+{
+  // Index of the record plus one once written, 0 while being written.
+  guint64 seq;
+  GstClockTime ts;
+  guint32 kind;
+  guint32 element;
+  guint64 count;
+  guint64 ns;
+} ProtoTraceRecord;
+
+// Totals for one element. Never freed, so frames and pads can point at them.
+typedef struct _ProtoTraceElement
+{
+  guint index;
+  gchar *path;
+
+  // The element, if it is a queue, for sampling its level.
+  gboolean is_queue;
+  GWeakRef queue;
+
+  // Updated with atomics.
+  guint64 buffers_in;
+  guint64 buffers_out;
+  guint64 proc_ns;
+  guint64 proc_max_ns;
+} ProtoTraceElement;
+
+// A push the current thread is inside.
+typedef struct _ProtoTraceFrame
+{
+  ProtoTraceElement *element;
+  guint count;
+  GstClockTime start;
+
+  // Time spent in nested pushes and reported blocks.
+  GstClockTime excluded;
+} ProtoTraceFrame;
+
+typedef struct _ProtoTrace
+{
+  GstTracer parent;
+
+  // Protects @elements and @by_object.
+  GMutex lock;
+  GPtrArray *elements;
+  GHashTable *by_object;
+
+  ProtoTraceRecord *ring;
+  guint64 head;
+} ProtoTrace;
+
+typedef struct _ProtoTraceClass
+{
+  GstTracerClass parent_class;
+} ProtoTraceClass;
+
+#define PROTO_TRACE(obj) ((ProtoTrace *) (obj))
+
+GType proto_trace_get_type (void);
+
+G_DEFINE_TYPE (ProtoTrace, proto_trace, GST_TYPE_TRACER);
+
+static ProtoTrace *tracer;
+static gchar *dump_path;
+
+// Pad qdata: the ProtoTraceElement of the pad's element, or @no_element for
+// pads that don't belong to one (the internal pads of ghost pads).
+static GQuark pad_quark;
+static ProtoTraceElement no_element;
+
+// Each thread's stack of ProtoTraceFrame.
+static void
+free_stack (gpointer stack)
+{
+  g_array_unref (stack);
+}
+
+static GPrivate stack_key = G_PRIVATE_INIT (free_stack);
+
+static GArray *
+get_stack (void)
+{
+  GArray *stack = g_private_get (&stack_key);
+
+  if (!stack) {
+    stack = g_array_sized_new (FALSE, FALSE, sizeof (ProtoTraceFrame), 16);
+    g_private_set (&stack_key, stack);
+  }
+  return stack;
+}
+
+static void
+add_record (ProtoTrace * self, GstClockTime ts, ProtoTraceKind kind,
+    ProtoTraceElement * element, guint64 count, guint64 ns)
+{
+  guint64 i = __atomic_fetch_add (&self->head, 1, __ATOMIC_RELAXED);
+  ProtoTraceRecord *record = &self->ring[i & (PROTO_TRACE_RING - 1)];
+
+  __atomic_store_n (&record->seq, 0, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+  record->ts = ts;
+  record->kind = kind;
+  record->element = element->index;
+  record->count = count;
+  record->ns = ns;
+  __atomic_store_n (&record->seq, i + 1, __ATOMIC_RELEASE);
+}
+
+/* The element is being finalized; a new one may get its address. Its totals
+ * stay in the table under its path.
+ */
+static void
+element_gone (gpointer data, GObject * object)
+{
+  ProtoTrace *self = data;
+
+  g_mutex_lock (&self->lock);
+  g_hash_table_remove (self->by_object, object);
+  g_mutex_unlock (&self->lock);
+}
+
+/* The totals of @object, created on first sight. Called with the lock held. */
+static ProtoTraceElement *
+lookup_element_locked (ProtoTrace * self, GstObject * object)
+{
+  ProtoTraceElement *element = g_hash_table_lookup (self->by_object, object);
+
+  if (!element) {
+    element = g_new0 (ProtoTraceElement, 1);
+    element->index = self->elements->len;
+    element->path = gst_object_get_path_string (object);
+    element->is_queue = g_str_equal (G_OBJECT_TYPE_NAME (object), "GstQueue");
+    g_weak_ref_init (&element->queue, element->is_queue ? object : NULL);
+    g_ptr_array_add (self->elements, element);
+    g_hash_table_insert (self->by_object, object, element);
+    g_object_weak_ref (G_OBJECT (object), element_gone, self);
+  }
+  return element;
+}
+
+/* The totals of the element @pad belongs to, or NULL if it belongs to none.
+ * Looked up in the table once per pad, then kept in the pad's qdata.
+ */
+static ProtoTraceElement *
+pad_element (ProtoTrace * self, GstPad * pad)
+{
+  ProtoTraceElement *element = g_object_get_qdata (G_OBJECT (pad),
+      pad_quark);
+
+  if (!element) {
+    GstObject *parent = gst_object_get_parent (GST_OBJECT (pad));
+
+    element = &no_element;
+    if (parent && GST_IS_ELEMENT (parent)) {
+      g_mutex_lock (&self->lock);
+      element = lookup_element_locked (self, parent);
+      g_mutex_unlock (&self->lock);
+    }
+    g_object_set_qdata (G_OBJECT (pad), pad_quark, element);
+    if (parent) {
+      gst_object_unref (parent);
+    }
+  }
+  return element == &no_element ? NULL : element;
+}
+
+static void
+push_pre (ProtoTrace * self, GstClockTime ts, GstPad * pad, guint count)
+{
+  ProtoTraceElement *from = pad_element (self, pad);
+  GstPad *peer = gst_pad_get_peer (pad);
+  ProtoTraceFrame frame = { NULL, count, ts, 0 };
+
+  if (from) {
+    __atomic_fetch_add (&from->buffers_out, count, __ATOMIC_RELAXED);
+  }
+  if (peer) {
+    frame.element = pad_element (self, peer);
+    if (frame.element) {
+      __atomic_fetch_add (&frame.element->buffers_in, count,
+          __ATOMIC_RELAXED);
+    }
+    gst_object_unref (peer);
+  }
+
+  g_array_append_val (get_stack (), frame);
+}
+
+static void
+push_post (ProtoTrace * self, GstClockTime ts)
+{
+  GArray *stack = get_stack ();
+  ProtoTraceFrame frame;
+  GstClockTime total, own;
+  guint64 max;
+
+  // A push that was already under way when tracing started.
+  if (stack->len == 0) {
+    return;
+  }
+
+  frame = g_array_index (stack, ProtoTraceFrame, stack->len - 1);
+  g_array_set_size (stack, stack->len - 1);
+
+  total = ts - frame.start;
+  own = total > frame.excluded ? total - frame.excluded : 0;
+  if (stack->len > 0) {
+    g_array_index (stack, ProtoTraceFrame, stack->len - 1).excluded += total;
+  }
+
+  if (!frame.element) {
+    return;
+  }
+
+  __atomic_fetch_add (&frame.element->proc_ns, own, __ATOMIC_RELAXED);
+  max = __atomic_load_n (&frame.element->proc_max_ns, __ATOMIC_RELAXED);
+  while (own > max && !__atomic_compare_exchange_n (&frame.element->proc_max_ns,
+          &max, own, TRUE, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    // Another thread changed it; @max is its new value.
+  }
+  add_record (self, ts, PROTO_TRACE_PROC, frame.element, frame.count, own);
+}
+
+static void
+pad_push_pre (GObject * self, GstClockTime ts, GstPad * pad,
+    GstBuffer * buffer)
+{
+  push_pre (PROTO_TRACE (self), ts, pad, 1);
+}
+
+static void
+pad_push_list_pre (GObject * self, GstClockTime ts, GstPad * pad,
+    GstBufferList * list)
+{
+  push_pre (PROTO_TRACE (self), ts, pad, gst_buffer_list_length (list));
+}
+
+static void
+pad_push_post (GObject * self, GstClockTime ts, GstPad * pad,
+    GstFlowReturn res)
+{
+  push_post (PROTO_TRACE (self), ts);
+}
+
+void
+proto_trace_block (GstPad * pad, GstClockTime duration)
+{
+  GArray *stack;
+  ProtoTraceElement *element;
+
+  if (!tracer) {
+    return;
+  }
+
+  stack = get_stack ();
+  if (stack->len > 0) {
+    g_array_index (stack, ProtoTraceFrame, stack->len - 1).excluded +=
+        duration;
+  }
+
+  element = pad_element (tracer, pad);
+  if (element) {
+    add_record (tracer, gst_util_get_timestamp (), PROTO_TRACE_BLOCK, element,
+        0, duration);
+  }
+}
+
+typedef struct _ProtoTraceSample
+{
+  ProtoTraceElement *element;
+  GstElement *queue;
+} ProtoTraceSample;
+
+/* Every PROTO_TRACE_QUEUE_SAMPLE_MS, in the default main context: record the
+ * level of every queue that is still around.
+ */
+static gboolean
+sample_queues_cb (gpointer user_data)
+{
+  ProtoTrace *self = user_data;
+  GArray *samples = g_array_new (FALSE, FALSE, sizeof (ProtoTraceSample));
+  GstClockTime ts = gst_util_get_timestamp ();
+
+  g_mutex_lock (&self->lock);
+  for (guint i = 0; i < self->elements->len; i++) {
+    ProtoTraceSample sample = { g_ptr_array_index (self->elements, i), NULL };
+
+    if (sample.element->is_queue) {
+      sample.queue = g_weak_ref_get (&sample.element->queue);
+      if (sample.queue) {
+        g_array_append_val (samples, sample);
+      }
+    }
+  }
+  g_mutex_unlock (&self->lock);
+
+  for (guint i = 0; i < samples->len; i++) {
+    ProtoTraceSample *sample = &g_array_index (samples, ProtoTraceSample, i);
+    guint level_buffers = 0;
+    guint64 level_time = 0;
+
+    g_object_get (sample->queue, "current-level-buffers", &level_buffers,
+        "current-level-time", &level_time, NULL);
+    add_record (self, ts, PROTO_TRACE_QUEUE, sample->element, level_buffers,
+        level_time);
+    gst_object_unref (sample->queue);
+  }
+
+  g_array_unref (samples);
+  return G_SOURCE_CONTINUE;
+}
+
+gboolean
+proto_trace_dump (const gchar * path)
+{
+  FILE *file;
+  ProtoTraceRecord *records;
+  ProtoTraceElement *elements;
+  guint64 head, first;
+  guint n_records = 0, n_elements;
+  GstClockTime now = gst_util_get_timestamp ();
+
+  if (!tracer) {
+    return FALSE;
+  }
+
+  // The ring first: every element a record names is in the table by then.
+  records = g_new (ProtoTraceRecord, PROTO_TRACE_RING);
+  head = __atomic_load_n (&tracer->head, __ATOMIC_ACQUIRE);
+  first = head > PROTO_TRACE_RING ? head - PROTO_TRACE_RING : 0;
+  for (guint64 i = first; i < head; i++) {
+    ProtoTraceRecord *slot = &tracer->ring[i & (PROTO_TRACE_RING - 1)];
+    guint64 seq = __atomic_load_n (&slot->seq, __ATOMIC_ACQUIRE);
+
+    records[n_records] = *slot;
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    // Skip it if it was still being written, or overwritten while copied.
+    if (seq == i + 1 && __atomic_load_n (&slot->seq, __ATOMIC_RELAXED) == seq) {
+      n_records++;
+    }
+  }
+
+  g_mutex_lock (&tracer->lock);
+  n_elements = tracer->elements->len;
+  elements = g_new0 (ProtoTraceElement, n_elements);
+  for (guint i = 0; i < n_elements; i++) {
+    ProtoTraceElement *element = g_ptr_array_index (tracer->elements, i);
+
+    elements[i].path = element->path;
+    elements[i].buffers_in = __atomic_load_n (&element->buffers_in,
+        __ATOMIC_RELAXED);
+    elements[i].buffers_out = __atomic_load_n (&element->buffers_out,
+        __ATOMIC_RELAXED);
+    elements[i].proc_ns = __atomic_load_n (&element->proc_ns,
+        __ATOMIC_RELAXED);
+    elements[i].proc_max_ns = __atomic_load_n (&element->proc_max_ns,
+        __ATOMIC_RELAXED);
+  }
+  g_mutex_unlock (&tracer->lock);
+
+  file = fopen (path, "w");
+  if (file) {
+    fprintf (file, "time_ns,kind,element,count,ns\n");
+    for (guint i = 0; i < n_records; i++) {
+      fprintf (file, "%" G_GUINT64_FORMAT ",%s,%s,%" G_GUINT64_FORMAT ",%"
+          G_GUINT64_FORMAT "\n", records[i].ts, kind_names[records[i].kind],
+          elements[records[i].element].path, records[i].count,
+          records[i].ns);
+    }
+    for (guint i = 0; i < n_elements; i++) {
+      fprintf (file, "%" G_GUINT64_FORMAT ",in,%s,%" G_GUINT64_FORMAT ",%"
+          G_GUINT64_FORMAT "\n", now, elements[i].path,
+          elements[i].buffers_in, elements[i].proc_ns);
+      fprintf (file, "%" G_GUINT64_FORMAT ",out,%s,%" G_GUINT64_FORMAT ",%"
+          G_GUINT64_FORMAT "\n", now, elements[i].path,
+          elements[i].buffers_out, elements[i].proc_max_ns);
+    }
+  }
+
+  g_free (elements);
+  g_free (records);
+  return file && fclose (file) == 0;
+}
+
+static gboolean
+sigusr1_cb (gpointer user_data)
+{
+  if (proto_trace_dump (dump_path)) {
+    g_print ("Trace written to %s\n", dump_path);
+  } else {
+    g_printerr ("Could not write the trace to %s\n", dump_path);
+  }
+  return G_SOURCE_CONTINUE;
+}
+
+gboolean
+proto_trace_start (const gchar * path)
+{
+  if (tracer) {
+    return FALSE;
+  }
+
+  pad_quark = g_quark_from_static_string ("proto-trace-element");
+  tracer = gst_object_ref_sink (g_object_new (proto_trace_get_type (), NULL));
+  dump_path = g_strdup (path);
+  g_unix_signal_add (SIGUSR1, sigusr1_cb, NULL);
+  g_timeout_add (PROTO_TRACE_QUEUE_SAMPLE_MS, sample_queues_cb, tracer);
+  return TRUE;
+}
+
+static void
+proto_trace_class_init (ProtoTraceClass * klass)
+{
+}
+
+static void
+proto_trace_init (ProtoTrace * self)
+{
+  GstTracer *gst_tracer = GST_TRACER (self);
+
+  g_mutex_init (&self->lock);
+  self->elements = g_ptr_array_new ();
+  self->by_object = g_hash_table_new (NULL, NULL);
+  self->ring = g_new0 (ProtoTraceRecord, PROTO_TRACE_RING);
+
+  gst_tracing_register_hook (gst_tracer, "pad-push-pre",
+      G_CALLBACK (pad_push_pre));
+  gst_tracing_register_hook (gst_tracer, "pad-push-post",
+      G_CALLBACK (pad_push_post));
+  gst_tracing_register_hook (gst_tracer, "pad-push-list-pre",
+      G_CALLBACK (pad_push_list_pre));
+  gst_tracing_register_hook (gst_tracer, "pad-push-list-post",
+      G_CALLBACK (pad_push_post));
+}
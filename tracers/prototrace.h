@@ -0,0 +1,65 @@
+/* In-tree tracer for the prototypes. Once started, the prototrace tracer sees
+ * every buffer pushed anywhere in the process and keeps, per element:
+ *
+ *   - buffers in (pushed into it) and out (pushed from it),
+ *   - processing time: the time from a buffer being pushed into the element
+ *     until that push returns, minus the pushes the element made downstream
+ *     meanwhile and any time reported with proto_trace_block,
+ *   - for queues, the fill level (buffers and time), sampled every 10 ms,
+ *
+ * and the probe block durations the application reports. Each processing
+ * time, queue level and block is also stored in a ring of the last
+ * PROTO_TRACE_RING records, which proto_trace_dump (or SIGUSR1) writes out as
+ * CSV with the per-element totals.
+ *
+ * The streaming threads only do atomic updates and, the first time each pad
+ * is seen, a table lookup under a lock. Queue levels are read in the default
+ * GLib main context, away from the pushes.
+ */
+
+#ifndef PROTOTRACE_H
+#define PROTOTRACE_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+// Records kept; a power of two.
+#define PROTO_TRACE_RING 65536
+
+/* Start tracing, and dump to @path whenever the process gets SIGUSR1. Call
+ * once, after gst_init. The signal and the queue sampling are handled in the
+ * default GLib main context, so they happen in whatever thread runs it; with
+ * no one running it there are no queue records.
+ */
+gboolean proto_trace_start (const gchar * path);
+
+/* Write the ring and the per-element totals to @path as CSV:
+ *
+ *   time_ns,kind,element,count,ns
+ *
+ * with one row per record, oldest first,
+ *
+ *   proc  - @count buffers were processed in @ns
+ *   queue - the queue held @count buffers, @ns of data, when sampled
+ *   block - the element's pad was held up by a probe for @ns
+ *
+ * then two rows per element, at the time of the dump,
+ *
+ *   in    - @count buffers pushed into it, @ns processing time in total
+ *   out   - @count buffers pushed out of it, @ns the longest processing time
+ *
+ * Elements are named by their path, e.g. /pipeline/q1. Returns FALSE if the
+ * tracer isn't running or @path can't be written.
+ */
+gboolean proto_trace_dump (const gchar * path);
+
+/* Report that a probe held up @pad for @duration. Call from the thread that
+ * was held up, so the time can be taken out of the processing time of the
+ * element it was pushing to.
+ */
+void proto_trace_block (GstPad * pad, GstClockTime duration);
+
+G_END_DECLS
+
+#endif /* PROTOTRACE_H */
@@ -0,0 +1,231 @@
+/* Pool of visualizer elements. Elements are created on first use, instead of
+ * all at startup, and a bounded number of the ones that were swapped out are
+ * kept warm (in the NULL state, ready to be linked again) so switching back
+ * to a recent visualizer doesn't create it again. The least recently used
+ * warm element is dropped when there are more than @max_warm.
+ *
+ * Elements are made with gst_element_factory_make, or with the function set
+ * with vis_pool_set_make_func, which may return a bin wrapping the named
+ * factory. Properties then go to every element in the bin that has them.
+ *
+ * A pool is not thread-safe: it must only be used from one thread at a time
+ * (in p1-2.c, the controller thread). The counters may be read from any
+ * thread with vis_pool_get_stats.
+ */
+
+#ifndef VISPOOL_H
+#define VISPOOL_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Makes a new (floating) element for factory @name, or returns NULL. */
+typedef GstElement *(*VisPoolMakeFunc) (const gchar * name, gpointer user_data);
+
+typedef struct _VisPoolEntry
+{
+  guint index;
+  GstElement *element;
+} VisPoolEntry;
+
+typedef struct _VisPool
+{
+  // Element factory names, by index.
+  gchar **names;
+  guint n_names;
+
+  // Warm elements, as VisPoolEntry, most recently released first. The pool
+  // holds one reference to each.
+  GQueue warm;
+  guint max_warm;
+
+  // Properties set with vis_pool_set_property, applied to every element
+  // handed out.
+  GstStructure *props;
+
+  // Set with vis_pool_set_make_func; NULL for gst_element_factory_make.
+  VisPoolMakeFunc make;
+  gpointer make_data;
+
+  gint hits;
+  gint misses;
+  gint evictions;
+} VisPool;
+
+/* Creates a pool for the @n_names element factories in @names. The names are
+ * copied.
+ */
+static inline VisPool *
+vis_pool_new (const gchar * const *names, guint n_names, guint max_warm)
+{
+  VisPool *pool = g_new0 (VisPool, 1);
+
+  pool->names = g_new0 (gchar *, n_names + 1);
+  for (guint i = 0; i < n_names; i++)
+    pool->names[i] = g_strdup (names[i]);
+  pool->n_names = n_names;
+
+  g_queue_init (&pool->warm);
+  pool->max_warm = max_warm;
+  pool->props = gst_structure_new_empty ("vis-pool-props");
+
+  return pool;
+}
+
+/* Makes the pool create elements with @make instead of
+ * gst_element_factory_make. Call before the first vis_pool_acquire.
+ */
+static inline void
+vis_pool_set_make_func (VisPool * pool, VisPoolMakeFunc make,
+    gpointer user_data)
+{
+  pool->make = make;
+  pool->make_data = user_data;
+}
+
+static inline void
+vis_pool_set_child_prop (const GValue * item, gpointer user_data)
+{
+  GObject *child = g_value_get_object (item);
+  const GValue *const *prop = user_data;
+  const gchar *name = g_value_get_string (prop[0]);
+
+  if (g_object_class_find_property (G_OBJECT_GET_CLASS (child), name))
+    g_object_set_property (child, name, prop[1]);
+}
+
+/* Sets property @name to @value on @element if it has it, or, if @element is
+ * a bin, on every element inside it that has it.
+ */
+static inline void
+vis_pool_element_set_property (GstElement * element, const gchar * name,
+    const GValue * value)
+{
+  if (GST_IS_BIN (element)) {
+    GValue name_value = G_VALUE_INIT;
+    const GValue *prop[2] = { &name_value, value };
+    GstIterator *it = gst_bin_iterate_recurse (GST_BIN (element));
+
+    g_value_init (&name_value, G_TYPE_STRING);
+    g_value_set_static_string (&name_value, name);
+    while (gst_iterator_foreach (it, vis_pool_set_child_prop, prop) ==
+        GST_ITERATOR_RESYNC)
+      gst_iterator_resync (it);
+    gst_iterator_free (it);
+    g_value_unset (&name_value);
+  } else if (g_object_class_find_property (G_OBJECT_GET_CLASS (element), name)) {
+    g_object_set_property (G_OBJECT (element), name, value);
+  }
+}
+
+static inline gboolean
+vis_pool_apply_prop (GQuark field, const GValue * value, gpointer element)
+{
+  vis_pool_element_set_property (element, g_quark_to_string (field), value);
+  return TRUE;
+}
+
+/* Returns a new reference to an element of factory @index: a warm one if
+ * there is one (a hit), otherwise a newly created one (a miss). The element
+ * is in the NULL state, has no parent, and has every property set with
+ * vis_pool_set_property that it knows. Returns NULL if the element can't be
+ * created.
+ */
+static inline GstElement *
+vis_pool_acquire (VisPool * pool, guint index)
+{
+  GstElement *element = NULL;
+
+  g_return_val_if_fail (index < pool->n_names, NULL);
+
+  for (GList * l = pool->warm.head; l; l = l->next) {
+    VisPoolEntry *entry = l->data;
+
+    if (entry->index == index) {
+      element = entry->element;
+      g_queue_delete_link (&pool->warm, l);
+      g_free (entry);
+      break;
+    }
+  }
+
+  if (element) {
+    g_atomic_int_inc (&pool->hits);
+  } else {
+    element = pool->make ? pool->make (pool->names[index], pool->make_data) :
+        gst_element_factory_make (pool->names[index], NULL);
+    if (!element)
+      return NULL;
+    gst_object_ref_sink (element);
+    g_atomic_int_inc (&pool->misses);
+  }
+
+  gst_structure_foreach (pool->props, vis_pool_apply_prop, element);
+  return element;
+}
+
+/* Takes over the reference to @element, of factory @index, and keeps it
+ * warm. It must no longer be in a bin. It is brought down to NULL, which
+ * resets it for its next use.
+ */
+static inline void
+vis_pool_release (VisPool * pool, guint index, GstElement * element)
+{
+  VisPoolEntry *entry;
+
+  g_return_if_fail (index < pool->n_names);
+  g_return_if_fail (GST_OBJECT_PARENT (element) == NULL);
+
+  gst_element_set_state (element, GST_STATE_NULL);
+
+  entry = g_new (VisPoolEntry, 1);
+  entry->index = index;
+  entry->element = element;
+  g_queue_push_head (&pool->warm, entry);
+
+  while (pool->warm.length > pool->max_warm) {
+    entry = g_queue_pop_tail (&pool->warm);
+    GST_DEBUG ("evicting %" GST_PTR_FORMAT, entry->element);
+    gst_object_unref (entry->element);
+    g_free (entry);
+    g_atomic_int_inc (&pool->evictions);
+  }
+}
+
+/* Remembers property @name, to be set on every element handed out from now
+ * on that has it. Elements already handed out are up to the caller.
+ */
+static inline void
+vis_pool_set_property (VisPool * pool, const gchar * name,
+    const GValue * value)
+{
+  gst_structure_set_value (pool->props, name, value);
+}
+
+static inline void
+vis_pool_get_stats (VisPool * pool, gint * hits, gint * misses,
+    gint * evictions)
+{
+  *hits = g_atomic_int_get (&pool->hits);
+  *misses = g_atomic_int_get (&pool->misses);
+  *evictions = g_atomic_int_get (&pool->evictions);
+}
+
+static inline void
+vis_pool_free (VisPool * pool)
+{
+  VisPoolEntry *entry;
+
+  while ((entry = g_queue_pop_head (&pool->warm))) {
+    gst_object_unref (entry->element);
+    g_free (entry);
+  }
+  gst_structure_free (pool->props);
+  g_strfreev (pool->names);
+  g_free (pool);
+}
+
+G_END_DECLS
+
+#endif /* VISPOOL_H */
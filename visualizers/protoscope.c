@@ -0,0 +1,605 @@
+/*
+gcc -O2 -march=native -c protoscope.c `pkg-config --cflags gstreamer-pbutils-1.0 gstreamer-fft-1.0`
+*/
+
+/* In-tree replacements for the four stock audiovisualizer elements.
+ *
+ * All four styles share one render loop: fade the previous frame, draw the new
+ * audio on top of it, and copy the result into the output frame. The fade and
+ * the additive blending of line runs are done with AVX2, SSE2 or NEON when the
+ * compiler targets them (build with -march=native), with a scalar fallback.
+ * The sample-to-coordinate loops are plain float loops the compiler can
+ * vectorize.
+ *
+ * The elements subclass GstAudioVisualizer, like the stock ones, so sink and
+ * src caps are the same and they fit between conv_before and conv_after.
+ *
+ * The spectra and synae styles read their bins from an upstream protospectrum
+ * (visualizers/protospectrum.c) when there is one, and only run their own
+ * transform when there isn't.
+ */
+
+#include "protoscope.h"
+#include "protospectrum.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <gst/pbutils/gstaudiovisualizer.h>
+#include <gst/fft/gstffts16.h>
+
+#if defined (__SSE2__)
+#include <immintrin.h>
+#elif defined (__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+#define RGB_ORDER "xRGB"
+#else
+#define RGB_ORDER "BGRx"
+#endif
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS (GST_VIDEO_CAPS_MAKE (RGB_ORDER))
+    );
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("audio/x-raw, "
+        "format = (string) " GST_AUDIO_NE (S16) ", "
+        "layout = (string) interleaved, "
+        "rate = (int) [ 8000, 96000 ], "
+        "channels = (int) 2, " "channel-mask = (bitmask) 0x3")
+    );
+
+// Length of the per-channel transform used by the synae style.
+#define SYNAE_FFT_LEN 512
+
+// Turns |X[k]| from gst_fft_s16_fft of a Hamming-windowed frame into linear
+// amplitude, matching the bins of ProtoSpectrumMeta.
+#define S16_FFT_SCALE (2.0f / (0.54f * 32768.0f))
+
+#define DEFAULT_DECAY 10
+
+enum
+{
+  PROP_0,
+  PROP_DECAY
+};
+
+typedef enum
+{
+  STYLE_SPACE,
+  STYLE_SPECTRA,
+  STYLE_SYNAE,
+  STYLE_WAVE
+} ProtoScopeStyle;
+
+typedef struct _ProtoScope
+{
+  GstAudioVisualizer parent;
+
+  guint decay;
+
+  // The previous frame, faded and drawn on in place. @width x @height pixels.
+  guint32 *history;
+  gint width, height;
+
+  // Per-column (or per-sample) coordinate scratch space.
+  gfloat *xs, *ys;
+  gsize scratch_len;
+
+  // Transform state for the spectra and synae styles, used when there is no
+  // upstream protospectrum. @amp holds per-channel linear amplitudes.
+  GstFFTS16 *fft;
+  guint fft_len;
+  gint16 *fft_in;
+  GstFFTS16Complex *freq[2];
+  gfloat *amp[2];
+
+  // Bins from the last ProtoSpectrumMeta seen on the sink pad, or NULL.
+  GBytes *spectrum;
+  guint spectrum_bins;
+  guint spectrum_channels;
+} ProtoScope;
+
+typedef struct _ProtoScopeClass
+{
+  GstAudioVisualizerClass parent_class;
+
+  ProtoScopeStyle style;
+} ProtoScopeClass;
+
+#define PROTO_TYPE_SCOPE (proto_scope_get_type ())
+#define PROTO_SCOPE(obj) ((ProtoScope *) (obj))
+#define PROTO_SCOPE_GET_CLASS(obj) \
+  (G_TYPE_INSTANCE_GET_CLASS ((obj), PROTO_TYPE_SCOPE, ProtoScopeClass))
+
+GType proto_scope_get_type (void);
+
+G_DEFINE_ABSTRACT_TYPE (ProtoScope, proto_scope, GST_TYPE_AUDIO_VISUALIZER);
+
+/* Kernels */
+
+/* Fade every channel of @n pixels by @amount, saturating at 0. */
+static void
+decay_pixels (guint32 * pixels, gsize n, guint8 amount)
+{
+  guint8 *p = (guint8 *) pixels;
+  gsize len = n * 4, i = 0;
+
+#if defined (__AVX2__)
+  const __m256i d8 = _mm256_set1_epi8 ((char) amount);
+  for (; i + 32 <= len; i += 32) {
+    __m256i v = _mm256_loadu_si256 ((const __m256i *) (p + i));
+    _mm256_storeu_si256 ((__m256i *) (p + i), _mm256_subs_epu8 (v, d8));
+  }
+#endif
+#if defined (__SSE2__)
+  const __m128i d4 = _mm_set1_epi8 ((char) amount);
+  for (; i + 16 <= len; i += 16) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (p + i));
+    _mm_storeu_si128 ((__m128i *) (p + i), _mm_subs_epu8 (v, d4));
+  }
+#elif defined (__ARM_NEON)
+  const uint8x16_t dn = vdupq_n_u8 (amount);
+  for (; i + 16 <= len; i += 16) {
+    vst1q_u8 (p + i, vqsubq_u8 (vld1q_u8 (p + i), dn));
+  }
+#endif
+
+  for (; i < len; ++i) {
+    p[i] = p[i] > amount ? p[i] - amount : 0;
+  }
+}
+
+/* Add @color to one pixel, each channel saturating at 255. */
+static inline guint32
+add_saturate (guint32 a, guint32 b)
+{
+  guint32 lo = (a & 0x7f7f7f7f) + (b & 0x7f7f7f7f);
+  guint32 carry = ((a & b) | (lo & (a ^ b))) & 0x80808080;
+  return (lo ^ ((a ^ b) & 0x80808080)) | ((carry >> 7) * 0xff);
+}
+
+/* Add @color to a run of @n pixels, each channel saturating at 255. */
+static void
+blend_span (guint32 * pixels, gsize n, guint32 color)
+{
+  gsize i = 0;
+
+#if defined (__AVX2__)
+  const __m256i c8 = _mm256_set1_epi32 ((int) color);
+  for (; i + 8 <= n; i += 8) {
+    __m256i v = _mm256_loadu_si256 ((const __m256i *) (pixels + i));
+    _mm256_storeu_si256 ((__m256i *) (pixels + i), _mm256_adds_epu8 (v, c8));
+  }
+#endif
+#if defined (__SSE2__)
+  const __m128i c4 = _mm_set1_epi32 ((int) color);
+  for (; i + 4 <= n; i += 4) {
+    __m128i v = _mm_loadu_si128 ((const __m128i *) (pixels + i));
+    _mm_storeu_si128 ((__m128i *) (pixels + i), _mm_adds_epu8 (v, c4));
+  }
+#elif defined (__ARM_NEON)
+  const uint8x16_t cn = vreinterpretq_u8_u32 (vdupq_n_u32 (color));
+  for (; i + 4 <= n; i += 4) {
+    uint8x16_t v = vld1q_u8 ((const uint8_t *) (pixels + i));
+    vst1q_u8 ((uint8_t *) (pixels + i), vqaddq_u8 (v, cn));
+  }
+#endif
+
+  for (; i < n; ++i) {
+    pixels[i] = add_saturate (pixels[i], color);
+  }
+}
+
+/* Draw a line into the history frame. Mostly-horizontal lines are drawn as one
+ * run per row, so the blending goes through blend_span; mostly-vertical lines
+ * touch one pixel per row.
+ */
+static void
+draw_line (ProtoScope * self, gint x0, gint y0, gint x1, gint y1,
+    guint32 color)
+{
+  gint w = self->width, h = self->height;
+
+  x0 = CLAMP (x0, 0, w - 1);
+  x1 = CLAMP (x1, 0, w - 1);
+  y0 = CLAMP (y0, 0, h - 1);
+  y1 = CLAMP (y1, 0, h - 1);
+
+  if (x0 > x1) {
+    gint t = x0; x0 = x1; x1 = t;
+    t = y0; y0 = y1; y1 = t;
+  }
+
+  gint dx = x1 - x0;
+  gint dy = y1 - y0;
+  gint step = dy < 0 ? -1 : 1;
+  gint rows = ABS (dy) + 1;
+
+  if (dx >= ABS (dy)) {
+    // One run per row. (dx + 1) >= rows, so no run is empty.
+    for (gint r = 0; r < rows; ++r) {
+      gint xa = x0 + (dx + 1) * r / rows;
+      gint xb = x0 + (dx + 1) * (r + 1) / rows;
+      blend_span (self->history + (gsize) (y0 + r * step) * w + xa, xb - xa,
+          color);
+    }
+  } else {
+    for (gint r = 0; r < rows; ++r) {
+      gint x = x0 + (dx * r + (rows - 1) / 2) / (rows - 1);
+      guint32 *p = self->history + (gsize) (y0 + r * step) * w + x;
+      *p = add_saturate (*p, color);
+    }
+  }
+}
+
+/* Styles */
+
+static void
+render_wave (ProtoScope * self, const gint16 * adata, guint num_samples)
+{
+  static const guint32 colors[2] = { 0x00ff6040, 0x0040a0ff };
+  gint w = self->width, h = self->height;
+  gfloat mid = (h - 1) / 2.0f;
+  gfloat scale = -mid / 32768.0f;
+
+  for (gint c = 0; c < 2; ++c) {
+    for (gint x = 0; x < w; ++x) {
+      guint s = (guint) ((guint64) x * num_samples / w);
+      self->ys[x] = mid + adata[s * 2 + c] * scale;
+    }
+    for (gint x = 1; x < w; ++x) {
+      draw_line (self, x - 1, (gint) self->ys[x - 1], x, (gint) self->ys[x],
+          colors[c]);
+    }
+  }
+}
+
+static void
+render_space (ProtoScope * self, const gint16 * adata, guint num_samples)
+{
+  gfloat cx = (self->width - 1) / 2.0f, cy = (self->height - 1) / 2.0f;
+  gfloat sx = cx / 32768.0f, sy = -cy / 32768.0f;
+
+  // Left channel is x, right channel is y.
+  for (guint i = 0; i < num_samples; ++i) {
+    self->xs[i] = cx + adata[i * 2] * sx;
+    self->ys[i] = cy + adata[i * 2 + 1] * sy;
+  }
+  for (guint i = 1; i < num_samples; ++i) {
+    draw_line (self, (gint) self->xs[i - 1], (gint) self->ys[i - 1],
+        (gint) self->xs[i], (gint) self->ys[i], 0x0040ff60);
+  }
+}
+
+/* Map a linear amplitude (1.0 is a full-scale sine) to 0..1 over 60 dB. */
+static inline gfloat
+level_db (gfloat amp)
+{
+  return CLAMP ((20.0f * log10f (amp + 1e-9f) + 60.0f) / 60.0f, 0.0f, 1.0f);
+}
+
+/* Get this frame's per-channel amplitudes into @left and @right, and return
+ * the number of bins. They come from the ProtoSpectrumMeta of an upstream
+ * protospectrum when there is one, so nothing is transformed twice; otherwise
+ * from our own transform of @adata (a mono mix when @mono is set).
+ */
+static guint
+get_spectrum (ProtoScope * self, const gint16 * adata, gboolean mono,
+    const gfloat ** left, const gfloat ** right)
+{
+  if (self->spectrum) {
+    const gfloat *bins = g_bytes_get_data (self->spectrum, NULL);
+    *left = bins;
+    *right = self->spectrum_channels > 1 ? bins + self->spectrum_bins : bins;
+    return self->spectrum_bins;
+  }
+
+  guint n_bins = self->fft_len / 2 + 1;
+
+  for (gint c = 0; c < (mono ? 1 : 2); ++c) {
+    for (guint i = 0; i < self->fft_len; ++i) {
+      self->fft_in[i] = mono ? (adata[i * 2] + adata[i * 2 + 1]) / 2
+          : adata[i * 2 + c];
+    }
+    gst_fft_s16_window (self->fft, self->fft_in, GST_FFT_WINDOW_HAMMING);
+    gst_fft_s16_fft (self->fft, self->fft_in, self->freq[c]);
+
+    for (guint k = 0; k < n_bins; ++k) {
+      self->amp[c][k] = hypotf (self->freq[c][k].r, self->freq[c][k].i)
+          * S16_FFT_SCALE;
+    }
+  }
+
+  *left = self->amp[0];
+  *right = mono ? self->amp[0] : self->amp[1];
+  return n_bins;
+}
+
+static void
+render_spectra (ProtoScope * self, const gint16 * adata)
+{
+  gint w = self->width, h = self->height;
+  const gfloat *left, *right;
+  guint n_bins = get_spectrum (self, adata, TRUE, &left, &right);
+
+  // Spread the bins (skipping DC) over the columns.
+  for (gint x = 0; x < w; ++x) {
+    guint k = 1 + (guint) ((guint64) x * (n_bins - 1) / w);
+    self->ys[x] = (h - 1) * level_db ((left[k] + right[k]) / 2);
+  }
+  for (gint x = 0; x < w; ++x) {
+    draw_line (self, x, h - 1, x, h - 1 - (gint) self->ys[x], 0x00ffa040);
+  }
+}
+
+static void
+render_synae (ProtoScope * self, const gint16 * adata)
+{
+  gint w = self->width, h = self->height;
+  const gfloat *left, *right;
+  guint n_bins = get_spectrum (self, adata, FALSE, &left, &right);
+
+  // Each bin is placed left to right by stereo position and bottom to top by
+  // pitch; loudness sets the brightness, pitch sets the color.
+  for (guint i = 1; i < n_bins; ++i) {
+    gfloat l = left[i], r = right[i];
+    gfloat sum = l + r;
+    guint level = (guint) (255 * level_db (sum));
+    if (level == 0) {
+      continue;
+    }
+
+    gint x = (gint) ((w - 3) / 2.0f * (1.0f + (r - l) / sum));
+    gint y = h - 1 - (gint) ((gint64) i * (h - 1) / (n_bins - 1));
+    guint high = level * i / n_bins;
+    guint32 color = ((level - high) << 16) | ((level / 2) << 8) | high;
+
+    blend_span (self->history + (gsize) y * w + x, 3, color);
+  }
+}
+
+/* Buffer probe on our own sink pad. Keeps the spectrum attached by an
+ * upstream protospectrum, if any, for the next render.
+ */
+static GstPadProbeReturn
+spectrum_meta_cb (GstPad * pad, GstPadProbeInfo * info, gpointer user_data)
+{
+  ProtoScope *self = PROTO_SCOPE (user_data);
+  ProtoSpectrumMeta *meta =
+      gst_buffer_get_proto_spectrum_meta (GST_PAD_PROBE_INFO_BUFFER (info));
+
+  g_clear_pointer (&self->spectrum, g_bytes_unref);
+  if (meta && meta->bins) {
+    self->spectrum = g_bytes_ref (meta->bins);
+    self->spectrum_bins = meta->n_bins;
+    self->spectrum_channels = meta->channels;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+/* GstAudioVisualizer vmethods */
+
+static gboolean
+proto_scope_setup (GstAudioVisualizer * base)
+{
+  ProtoScope *self = PROTO_SCOPE (base);
+  ProtoScopeStyle style = PROTO_SCOPE_GET_CLASS (self)->style;
+
+  self->width = GST_VIDEO_INFO_WIDTH (&base->vinfo);
+  self->height = GST_VIDEO_INFO_HEIGHT (&base->vinfo);
+
+  g_free (self->history);
+  self->history = g_new0 (guint32, (gsize) self->width * self->height);
+
+  g_clear_pointer (&self->fft, gst_fft_s16_free);
+  g_clear_pointer (&self->fft_in, g_free);
+  g_clear_pointer (&self->freq[0], g_free);
+  g_clear_pointer (&self->freq[1], g_free);
+  g_clear_pointer (&self->amp[0], g_free);
+  g_clear_pointer (&self->amp[1], g_free);
+  self->fft_len = 0;
+
+  if (style == STYLE_SPECTRA) {
+    // One bin per column, plus DC.
+    self->fft_len = 2 * self->width;
+  } else if (style == STYLE_SYNAE) {
+    self->fft_len = SYNAE_FFT_LEN;
+  }
+
+  if (self->fft_len) {
+    self->fft = gst_fft_s16_new (self->fft_len, FALSE);
+    self->fft_in = g_new0 (gint16, self->fft_len);
+    self->freq[0] = g_new0 (GstFFTS16Complex, self->fft_len / 2 + 1);
+    self->freq[1] = g_new0 (GstFFTS16Complex, self->fft_len / 2 + 1);
+    self->amp[0] = g_new0 (gfloat, self->fft_len / 2 + 1);
+    self->amp[1] = g_new0 (gfloat, self->fft_len / 2 + 1);
+  }
+
+  // The base class hands us at least this many samples per frame.
+  base->req_spf = self->fft_len;
+
+  return TRUE;
+}
+
+static gboolean
+proto_scope_render (GstAudioVisualizer * base, GstBuffer * audio,
+    GstVideoFrame * video)
+{
+  ProtoScope *self = PROTO_SCOPE (base);
+  GstMapInfo amap;
+  gsize n = (gsize) self->width * self->height;
+
+  gst_buffer_map (audio, &amap, GST_MAP_READ);
+  const gint16 *adata = (const gint16 *) amap.data;
+  guint num_samples = amap.size / GST_AUDIO_INFO_BPF (&base->ainfo);
+
+  if (num_samples > self->scratch_len || (gsize) self->width > self->scratch_len) {
+    self->scratch_len = MAX (num_samples, (guint) self->width);
+    self->xs = g_renew (gfloat, self->xs, self->scratch_len);
+    self->ys = g_renew (gfloat, self->ys, self->scratch_len);
+  }
+
+  decay_pixels (self->history, n, (guint8) self->decay);
+
+  switch (PROTO_SCOPE_GET_CLASS (self)->style) {
+    case STYLE_SPACE:
+      render_space (self, adata, num_samples);
+      break;
+    case STYLE_SPECTRA:
+      render_spectra (self, adata);
+      break;
+    case STYLE_SYNAE:
+      render_synae (self, adata);
+      break;
+    case STYLE_WAVE:
+      render_wave (self, adata, num_samples);
+      break;
+  }
+
+  gst_buffer_unmap (audio, &amap);
+
+  // Like the stock scopes, this assumes a packed frame (stride == width * 4).
+  memcpy (GST_VIDEO_FRAME_PLANE_DATA (video, 0), self->history, n * 4);
+
+  return TRUE;
+}
+
+/* GObject */
+
+static void
+proto_scope_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  ProtoScope *self = PROTO_SCOPE (object);
+
+  switch (prop_id) {
+    case PROP_DECAY:
+      self->decay = g_value_get_uint (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+proto_scope_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  ProtoScope *self = PROTO_SCOPE (object);
+
+  switch (prop_id) {
+    case PROP_DECAY:
+      g_value_set_uint (value, self->decay);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+proto_scope_finalize (GObject * object)
+{
+  ProtoScope *self = PROTO_SCOPE (object);
+
+  g_free (self->history);
+  g_free (self->xs);
+  g_free (self->ys);
+  g_clear_pointer (&self->fft, gst_fft_s16_free);
+  g_free (self->fft_in);
+  g_free (self->freq[0]);
+  g_free (self->freq[1]);
+  g_free (self->amp[0]);
+  g_free (self->amp[1]);
+  g_clear_pointer (&self->spectrum, g_bytes_unref);
+
+  G_OBJECT_CLASS (proto_scope_parent_class)->finalize (object);
+}
+
+static void
+proto_scope_class_init (ProtoScopeClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstElementClass *element_class = (GstElementClass *) klass;
+  GstAudioVisualizerClass *scope_class = (GstAudioVisualizerClass *) klass;
+
+  gobject_class->set_property = proto_scope_set_property;
+  gobject_class->get_property = proto_scope_get_property;
+  gobject_class->finalize = proto_scope_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_DECAY,
+      g_param_spec_uint ("decay", "Decay",
+          "How much each color channel fades per frame", 0, 255,
+          DEFAULT_DECAY, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+  gst_element_class_add_static_pad_template (element_class, &sink_template);
+
+  scope_class->setup = GST_DEBUG_FUNCPTR (proto_scope_setup);
+  scope_class->render = GST_DEBUG_FUNCPTR (proto_scope_render);
+}
+
+static void
+proto_scope_init (ProtoScope * self)
+{
+  self->decay = DEFAULT_DECAY;
+
+  // We fade the previous frame ourselves, so the base class only has to clear
+  // the output frame.
+  g_object_set (self, "shader", GST_AUDIO_VISUALIZER_SHADER_NONE, NULL);
+
+  GstPad *sinkpad = gst_element_get_static_pad (GST_ELEMENT (self), "sink");
+  gst_pad_add_probe (sinkpad, GST_PAD_PROBE_TYPE_BUFFER, spectrum_meta_cb,
+      self, NULL);
+  gst_object_unref (sinkpad);
+}
+
+/* One concrete element per style. */
+#define PROTO_SCOPE_STYLE(TypeName, type_name, STYLE, longname, description) \
+  typedef ProtoScope TypeName;                                              \
+  typedef ProtoScopeClass TypeName##Class;                                  \
+  GType type_name##_get_type (void);                                        \
+  G_DEFINE_TYPE (TypeName, type_name, PROTO_TYPE_SCOPE);                    \
+  static void                                                               \
+  type_name##_class_init (TypeName##Class * klass)                          \
+  {                                                                         \
+    klass->style = STYLE;                                                   \
+    gst_element_class_set_static_metadata (GST_ELEMENT_CLASS (klass),       \
+        longname, "Visualization", description, "gstproto");                \
+  }                                                                         \
+  static void                                                               \
+  type_name##_init (TypeName * self)                                        \
+  {                                                                         \
+  }
+
+PROTO_SCOPE_STYLE (ProtoSpaceScope, proto_space_scope, STYLE_SPACE,
+    "Stereo visualizer", "Vectorized stereo (left vs. right) scope")
+PROTO_SCOPE_STYLE (ProtoSpectraScope, proto_spectra_scope, STYLE_SPECTRA,
+    "Frequency spectrum scope", "Vectorized frequency spectrum scope")
+PROTO_SCOPE_STYLE (ProtoSynaeScope, proto_synae_scope, STYLE_SYNAE,
+    "Synaescope", "Vectorized stereo and pitch visualizer")
+PROTO_SCOPE_STYLE (ProtoWaveScope, proto_wave_scope, STYLE_WAVE,
+    "Waveform oscilloscope", "Vectorized waveform oscilloscope")
+
+gboolean
+proto_scope_register (void)
+{
+  return gst_element_register (NULL, "protospacescope", GST_RANK_NONE,
+          proto_space_scope_get_type ())
+      && gst_element_register (NULL, "protospectrascope", GST_RANK_NONE,
+          proto_spectra_scope_get_type ())
+      && gst_element_register (NULL, "protosynaescope", GST_RANK_NONE,
+          proto_synae_scope_get_type ())
+      && gst_element_register (NULL, "protowavescope", GST_RANK_NONE,
+          proto_wave_scope_get_type ());
+}
@@ -0,0 +1,21 @@
+/* In-tree audiovisualizer elements. They render the same four styles as the
+ * stock scopes (spacescope, spectrascope, synaescope, wavescope) with the same
+ * sink and src caps, so they can be used anywhere in @effects.
+ */
+
+#ifndef PROTOSCOPE_H
+#define PROTOSCOPE_H
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Register protospacescope, protospectrascope, protosynaescope and
+ * protowavescope as static elements of the running application. Call it after
+ * gst_init.
+ */
+gboolean proto_scope_register (void);
+
+G_END_DECLS
+
+#endif /* PROTOSCOPE_H */
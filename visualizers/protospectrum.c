@@ -0,0 +1,522 @@
+/*
+gcc -O2 -march=native -c protospectrum.c `pkg-config --cflags gstreamer-base-1.0 gstreamer-audio-1.0 gstreamer-fft-1.0`
+*/
+
+/* The protospectrum element and its FFT plan cache.
+ *
+ * Incoming samples go into a per-channel ring of one window (@size samples).
+ * Every hop (@size * (1 - @overlap) samples) the ring is unrolled through the
+ * window into a linear frame, transformed with a real-input FFT, and turned
+ * into per-bin amplitudes. The window multiply has AVX, SSE and NEON paths.
+ * Plans (transform, window, bin frequencies) are cached per (rate, size), so
+ * caps changes and new instances don't rebuild them.
+ */
+
+#include "protospectrum.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <gst/audio/audio.h>
+#include <gst/base/gstbasetransform.h>
+
+#if defined (__SSE__)
+#include <immintrin.h>
+#elif defined (__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/* Plan cache */
+
+// Plans not in use by any stream. There are only ever a handful, so a list
+// searched by (rate, size) is enough.
+static GMutex plan_lock;
+static GSList *free_plans;
+
+static ProtoFFTPlan *
+plan_new (guint rate, guint size)
+{
+  ProtoFFTPlan *plan = g_new0 (ProtoFFTPlan, 1);
+  gdouble sum = 0;
+
+  plan->rate = rate;
+  plan->size = size;
+  plan->fft = gst_fft_f32_new (size, FALSE);
+  plan->window = g_new (gfloat, size);
+  plan->freqs = g_new (gfloat, size / 2 + 1);
+
+  for (guint i = 0; i < size; ++i) {
+    plan->window[i] = 0.5 - 0.5 * cos (2.0 * G_PI * i / size);
+    sum += plan->window[i];
+  }
+  for (guint k = 0; k <= size / 2; ++k) {
+    plan->freqs[k] = (gfloat) k * rate / size;
+  }
+
+  // A sine of amplitude A lands in its bin with |X| = A * sum / 2.
+  plan->scale = 2.0 / sum;
+
+  return plan;
+}
+
+ProtoFFTPlan *
+proto_fft_plan_acquire (guint rate, guint size)
+{
+  ProtoFFTPlan *plan = NULL;
+
+  g_mutex_lock (&plan_lock);
+  for (GSList * l = free_plans; l; l = l->next) {
+    ProtoFFTPlan *p = l->data;
+    if (p->rate == rate && p->size == size) {
+      plan = p;
+      free_plans = g_slist_delete_link (free_plans, l);
+      break;
+    }
+  }
+  g_mutex_unlock (&plan_lock);
+
+  return plan ? plan : plan_new (rate, size);
+}
+
+void
+proto_fft_plan_release (ProtoFFTPlan * plan)
+{
+  g_mutex_lock (&plan_lock);
+  free_plans = g_slist_prepend (free_plans, plan);
+  g_mutex_unlock (&plan_lock);
+}
+
+/* Meta */
+
+GType
+proto_spectrum_meta_api_get_type (void)
+{
+  static gsize type = 0;
+  static const gchar *tags[] = { NULL };
+
+  if (g_once_init_enter (&type)) {
+    GType _type = gst_meta_api_type_register ("ProtoSpectrumMetaAPI", tags);
+    g_once_init_leave (&type, _type);
+  }
+  return (GType) type;
+}
+
+static gboolean
+proto_spectrum_meta_init (GstMeta * meta, gpointer params, GstBuffer * buffer)
+{
+  ProtoSpectrumMeta *smeta = (ProtoSpectrumMeta *) meta;
+
+  smeta->rate = smeta->size = smeta->channels = smeta->n_bins = 0;
+  smeta->pts = GST_CLOCK_TIME_NONE;
+  smeta->bins = NULL;
+
+  return TRUE;
+}
+
+static void
+proto_spectrum_meta_free (GstMeta * meta, GstBuffer * buffer)
+{
+  ProtoSpectrumMeta *smeta = (ProtoSpectrumMeta *) meta;
+
+  g_clear_pointer (&smeta->bins, g_bytes_unref);
+}
+
+static gboolean
+proto_spectrum_meta_transform (GstBuffer * dest, GstMeta * meta,
+    GstBuffer * buffer, GQuark type, gpointer data)
+{
+  ProtoSpectrumMeta *smeta = (ProtoSpectrumMeta *) meta;
+
+  if (!GST_META_TRANSFORM_IS_COPY (type)) {
+    return FALSE;
+  }
+
+  ProtoSpectrumMeta *dmeta = (ProtoSpectrumMeta *) gst_buffer_add_meta (dest,
+      proto_spectrum_meta_get_info (), NULL);
+  dmeta->rate = smeta->rate;
+  dmeta->size = smeta->size;
+  dmeta->channels = smeta->channels;
+  dmeta->n_bins = smeta->n_bins;
+  dmeta->pts = smeta->pts;
+  dmeta->bins = smeta->bins ? g_bytes_ref (smeta->bins) : NULL;
+
+  return TRUE;
+}
+
+const GstMetaInfo *
+proto_spectrum_meta_get_info (void)
+{
+  static const GstMetaInfo *info = NULL;
+
+  if (g_once_init_enter ((GstMetaInfo **) & info)) {
+    const GstMetaInfo *meta = gst_meta_register (PROTO_SPECTRUM_META_API_TYPE,
+        "ProtoSpectrumMeta", sizeof (ProtoSpectrumMeta),
+        proto_spectrum_meta_init, proto_spectrum_meta_free,
+        proto_spectrum_meta_transform);
+    g_once_init_leave ((GstMetaInfo **) & info, (GstMetaInfo *) meta);
+  }
+  return info;
+}
+
+/* Element */
+
+#define DEFAULT_SIZE 2048
+#define DEFAULT_OVERLAP 0.75
+
+enum
+{
+  PROP_0,
+  PROP_SIZE,
+  PROP_OVERLAP
+};
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE ("src",
+    GST_PAD_SRC,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("audio/x-raw, "
+        "format = (string) { " GST_AUDIO_NE (S16) ", " GST_AUDIO_NE (F32) " }, "
+        "layout = (string) interleaved, "
+        "rate = (int) [ 1, MAX ], " "channels = (int) [ 1, 8 ]")
+    );
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+    GST_PAD_SINK,
+    GST_PAD_ALWAYS,
+    GST_STATIC_CAPS ("audio/x-raw, "
+        "format = (string) { " GST_AUDIO_NE (S16) ", " GST_AUDIO_NE (F32) " }, "
+        "layout = (string) interleaved, "
+        "rate = (int) [ 1, MAX ], " "channels = (int) [ 1, 8 ]")
+    );
+
+typedef struct _ProtoSpectrum
+{
+  GstBaseTransform parent;
+
+  // Properties. New values take effect on the next caps.
+  guint size;
+  gdouble overlap;
+
+  GstAudioInfo info;
+  ProtoFFTPlan *plan;
+  guint hop;
+
+  // One @size ring per channel, all written at @ring_pos.
+  gfloat *ring;
+  guint ring_pos;
+  guint filled;
+  guint since_hop;
+
+  // Scratch for one windowed frame and its transform.
+  gfloat *frame;
+  GstFFTF32Complex *freq;
+
+  // Result of the last analysis.
+  GBytes *latest;
+  GstClockTime latest_pts;
+} ProtoSpectrum;
+
+typedef struct _ProtoSpectrumClass
+{
+  GstBaseTransformClass parent_class;
+} ProtoSpectrumClass;
+
+#define PROTO_SPECTRUM(obj) ((ProtoSpectrum *) (obj))
+
+GType proto_spectrum_get_type (void);
+
+G_DEFINE_TYPE (ProtoSpectrum, proto_spectrum, GST_TYPE_BASE_TRANSFORM);
+
+/* out[i] = in[i] * window[i] for @n samples. */
+static void
+window_multiply (gfloat * out, const gfloat * in, const gfloat * window,
+    guint n)
+{
+  guint i = 0;
+
+#if defined (__AVX__)
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps (out + i, _mm256_mul_ps (_mm256_loadu_ps (in + i),
+            _mm256_loadu_ps (window + i)));
+  }
+#endif
+#if defined (__SSE__)
+  for (; i + 4 <= n; i += 4) {
+    _mm_storeu_ps (out + i, _mm_mul_ps (_mm_loadu_ps (in + i),
+            _mm_loadu_ps (window + i)));
+  }
+#elif defined (__ARM_NEON)
+  for (; i + 4 <= n; i += 4) {
+    vst1q_f32 (out + i, vmulq_f32 (vld1q_f32 (in + i), vld1q_f32 (window + i)));
+  }
+#endif
+
+  for (; i < n; ++i) {
+    out[i] = in[i] * window[i];
+  }
+}
+
+static void
+proto_spectrum_reset (ProtoSpectrum * self)
+{
+  self->ring_pos = self->filled = self->since_hop = 0;
+  g_clear_pointer (&self->latest, g_bytes_unref);
+  self->latest_pts = GST_CLOCK_TIME_NONE;
+  if (self->ring) {
+    memset (self->ring, 0, sizeof (gfloat) * self->size *
+        GST_AUDIO_INFO_CHANNELS (&self->info));
+  }
+}
+
+static void
+proto_spectrum_free_buffers (ProtoSpectrum * self)
+{
+  if (self->plan) {
+    proto_fft_plan_release (self->plan);
+    self->plan = NULL;
+  }
+  g_clear_pointer (&self->ring, g_free);
+  g_clear_pointer (&self->frame, g_free);
+  g_clear_pointer (&self->freq, g_free);
+  g_clear_pointer (&self->latest, g_bytes_unref);
+}
+
+/* Analyze the window that ends at @ring_pos, for every channel. */
+static void
+proto_spectrum_analyze (ProtoSpectrum * self)
+{
+  ProtoFFTPlan *plan = self->plan;
+  guint size = plan->size;
+  guint n_bins = size / 2 + 1;
+  guint channels = GST_AUDIO_INFO_CHANNELS (&self->info);
+  guint head = size - self->ring_pos;
+  gfloat *bins = g_new (gfloat, (gsize) channels * n_bins);
+
+  for (guint c = 0; c < channels; ++c) {
+    const gfloat *ring = self->ring + (gsize) c * size;
+
+    // The oldest sample is at @ring_pos; unroll the ring through the window.
+    window_multiply (self->frame, ring + self->ring_pos, plan->window, head);
+    window_multiply (self->frame + head, ring, plan->window + head,
+        self->ring_pos);
+
+    gst_fft_f32_fft (plan->fft, self->frame, self->freq);
+
+    gfloat *out = bins + (gsize) c * n_bins;
+    for (guint k = 0; k < n_bins; ++k) {
+      out[k] = sqrtf (self->freq[k].r * self->freq[k].r +
+          self->freq[k].i * self->freq[k].i) * plan->scale;
+    }
+  }
+
+  g_clear_pointer (&self->latest, g_bytes_unref);
+  self->latest = g_bytes_new_take (bins, sizeof (gfloat) * channels * n_bins);
+}
+
+static gboolean
+proto_spectrum_set_caps (GstBaseTransform * trans, GstCaps * incaps,
+    GstCaps * outcaps)
+{
+  ProtoSpectrum *self = PROTO_SPECTRUM (trans);
+
+  proto_spectrum_free_buffers (self);
+
+  if (!gst_audio_info_from_caps (&self->info, incaps)) {
+    return FALSE;
+  }
+
+  guint channels = GST_AUDIO_INFO_CHANNELS (&self->info);
+
+  self->plan = proto_fft_plan_acquire (GST_AUDIO_INFO_RATE (&self->info),
+      self->size);
+  self->hop = MAX (1, (guint) (self->size * (1.0 - self->overlap)));
+  self->ring = g_new0 (gfloat, (gsize) channels * self->size);
+  self->frame = g_new (gfloat, self->size);
+  self->freq = g_new (GstFFTF32Complex, self->size / 2 + 1);
+
+  proto_spectrum_reset (self);
+
+  return TRUE;
+}
+
+static GstFlowReturn
+proto_spectrum_transform_ip (GstBaseTransform * trans, GstBuffer * buffer)
+{
+  ProtoSpectrum *self = PROTO_SPECTRUM (trans);
+  guint channels = GST_AUDIO_INFO_CHANNELS (&self->info);
+  guint rate = GST_AUDIO_INFO_RATE (&self->info);
+  gboolean is_float =
+      GST_AUDIO_INFO_FORMAT (&self->info) == GST_AUDIO_FORMAT_F32;
+  guint size = self->size;
+  GstMapInfo map;
+
+  if (!self->plan) {
+    return GST_FLOW_NOT_NEGOTIATED;
+  }
+
+  if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DISCONT)) {
+    proto_spectrum_reset (self);
+  }
+
+  gst_buffer_map (buffer, &map, GST_MAP_READ);
+  guint n = map.size / GST_AUDIO_INFO_BPF (&self->info);
+  guint done = 0;
+
+  while (done < n) {
+    // Copy up to the next hop or the end of the ring, whichever comes first.
+    guint chunk = MIN (n - done, self->hop - self->since_hop);
+    chunk = MIN (chunk, size - self->ring_pos);
+
+    for (guint c = 0; c < channels; ++c) {
+      gfloat *ring = self->ring + (gsize) c * size + self->ring_pos;
+      if (is_float) {
+        const gfloat *in = (const gfloat *) map.data + (gsize) done * channels;
+        for (guint i = 0; i < chunk; ++i) {
+          ring[i] = in[i * channels + c];
+        }
+      } else {
+        const gint16 *in = (const gint16 *) map.data + (gsize) done * channels;
+        for (guint i = 0; i < chunk; ++i) {
+          ring[i] = in[i * channels + c] * (1.0f / 32768.0f);
+        }
+      }
+    }
+
+    done += chunk;
+    self->ring_pos = (self->ring_pos + chunk) % size;
+    self->filled = MIN (self->filled + chunk, size);
+    self->since_hop += chunk;
+
+    if (self->since_hop >= self->hop) {
+      self->since_hop = 0;
+      if (self->filled == size) {
+        proto_spectrum_analyze (self);
+        if (GST_BUFFER_PTS_IS_VALID (buffer)) {
+          self->latest_pts = GST_BUFFER_PTS (buffer) +
+              gst_util_uint64_scale_int (done, GST_SECOND, rate);
+        }
+      }
+    }
+  }
+
+  gst_buffer_unmap (buffer, &map);
+
+  if (self->latest) {
+    ProtoSpectrumMeta *meta = (ProtoSpectrumMeta *) gst_buffer_add_meta (buffer,
+        proto_spectrum_meta_get_info (), NULL);
+    meta->rate = rate;
+    meta->size = size;
+    meta->channels = channels;
+    meta->n_bins = size / 2 + 1;
+    meta->pts = self->latest_pts;
+    meta->bins = g_bytes_ref (self->latest);
+  }
+
+  return GST_FLOW_OK;
+}
+
+static gboolean
+proto_spectrum_stop (GstBaseTransform * trans)
+{
+  proto_spectrum_free_buffers (PROTO_SPECTRUM (trans));
+  return TRUE;
+}
+
+static void
+proto_spectrum_set_property (GObject * object, guint prop_id,
+    const GValue * value, GParamSpec * pspec)
+{
+  ProtoSpectrum *self = PROTO_SPECTRUM (object);
+
+  switch (prop_id) {
+    case PROP_SIZE:
+      // The real-input transform needs an even length.
+      self->size = g_value_get_uint (value) & ~1u;
+      break;
+    case PROP_OVERLAP:
+      self->overlap = g_value_get_double (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+proto_spectrum_get_property (GObject * object, guint prop_id,
+    GValue * value, GParamSpec * pspec)
+{
+  ProtoSpectrum *self = PROTO_SPECTRUM (object);
+
+  switch (prop_id) {
+    case PROP_SIZE:
+      g_value_set_uint (value, self->size);
+      break;
+    case PROP_OVERLAP:
+      g_value_set_double (value, self->overlap);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, prop_id, pspec);
+      break;
+  }
+}
+
+static void
+proto_spectrum_finalize (GObject * object)
+{
+  proto_spectrum_free_buffers (PROTO_SPECTRUM (object));
+
+  G_OBJECT_CLASS (proto_spectrum_parent_class)->finalize (object);
+}
+
+static void
+proto_spectrum_class_init (ProtoSpectrumClass * klass)
+{
+  GObjectClass *gobject_class = (GObjectClass *) klass;
+  GstElementClass *element_class = (GstElementClass *) klass;
+  GstBaseTransformClass *trans_class = (GstBaseTransformClass *) klass;
+
+  gobject_class->set_property = proto_spectrum_set_property;
+  gobject_class->get_property = proto_spectrum_get_property;
+  gobject_class->finalize = proto_spectrum_finalize;
+
+  g_object_class_install_property (gobject_class, PROP_SIZE,
+      g_param_spec_uint ("size", "Size", "Analysis window length in samples",
+          64, 65536, DEFAULT_SIZE,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+  g_object_class_install_property (gobject_class, PROP_OVERLAP,
+      g_param_spec_double ("overlap", "Overlap",
+          "Fraction of each window shared with the next one", 0.0, 0.95,
+          DEFAULT_OVERLAP,
+          G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS |
+          GST_PARAM_MUTABLE_READY));
+
+  gst_element_class_add_static_pad_template (element_class, &src_template);
+  gst_element_class_add_static_pad_template (element_class, &sink_template);
+  gst_element_class_set_static_metadata (element_class, "Spectrum analyzer",
+      "Filter/Analyzer/Audio",
+      "Attaches per-channel magnitude spectra to audio buffers", "gstproto");
+
+  trans_class->set_caps = GST_DEBUG_FUNCPTR (proto_spectrum_set_caps);
+  trans_class->transform_ip = GST_DEBUG_FUNCPTR (proto_spectrum_transform_ip);
+  trans_class->stop = GST_DEBUG_FUNCPTR (proto_spectrum_stop);
+}
+
+static void
+proto_spectrum_init (ProtoSpectrum * self)
+{
+  self->size = DEFAULT_SIZE;
+  self->overlap = DEFAULT_OVERLAP;
+  self->latest_pts = GST_CLOCK_TIME_NONE;
+
+  // The audio goes through untouched, but the buffer has to be writable to
+  // take the meta, so run in place instead of in passthrough.
+  gst_base_transform_set_in_place (GST_BASE_TRANSFORM (self), TRUE);
+}
+
+gboolean
+proto_spectrum_register (void)
+{
+  return gst_element_register (NULL, "protospectrum", GST_RANK_NONE,
+      proto_spectrum_get_type ());
+}
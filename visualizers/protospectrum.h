@@ -0,0 +1,78 @@
+/* In-tree spectrum analysis stage. The protospectrum element passes audio
+ * through untouched and attaches the latest magnitude spectrum of every
+ * channel to each buffer as a ProtoSpectrumMeta, so visualizers and external
+ * consumers (e.g. behind an appsink) can read the bins without running their
+ * own transform.
+ */
+
+#ifndef PROTOSPECTRUM_H
+#define PROTOSPECTRUM_H
+
+#include <gst/gst.h>
+#include <gst/fft/gstfftf32.h>
+
+G_BEGIN_DECLS
+
+/* A cached FFT plan for one (rate, size) pair: a real-input transform, its
+ * Hann window and the bin center frequencies. A plan is used by one stream at
+ * a time; proto_fft_plan_release hands it back to the cache for reuse.
+ */
+typedef struct _ProtoFFTPlan
+{
+  guint rate;
+  guint size;
+
+  GstFFTF32 *fft;
+
+  // @size window coefficients.
+  gfloat *window;
+
+  // @size / 2 + 1 bin center frequencies, in Hz.
+  gfloat *freqs;
+
+  // Turns |X[k]| of a windowed frame into linear amplitude (1.0 is a
+  // full-scale sine).
+  gfloat scale;
+} ProtoFFTPlan;
+
+ProtoFFTPlan *proto_fft_plan_acquire (guint rate, guint size);
+void proto_fft_plan_release (ProtoFFTPlan * plan);
+
+/* The spectrum of the most recent analysis window that ended at or before the
+ * end of the buffer it is attached to.
+ */
+typedef struct _ProtoSpectrumMeta
+{
+  GstMeta meta;
+
+  guint rate;
+  guint size;
+  guint channels;
+
+  // @size / 2 + 1.
+  guint n_bins;
+
+  // Timestamp of the end of the analysis window.
+  GstClockTime pts;
+
+  // @channels * @n_bins gfloat linear amplitudes, one channel after another.
+  // Shared, read-only; take a reference to keep it.
+  GBytes *bins;
+} ProtoSpectrumMeta;
+
+GType proto_spectrum_meta_api_get_type (void);
+const GstMetaInfo *proto_spectrum_meta_get_info (void);
+
+#define PROTO_SPECTRUM_META_API_TYPE (proto_spectrum_meta_api_get_type ())
+
+#define gst_buffer_get_proto_spectrum_meta(b) \
+  ((ProtoSpectrumMeta *) gst_buffer_get_meta ((b), PROTO_SPECTRUM_META_API_TYPE))
+
+/* Register protospectrum as a static element of the running application. Call
+ * it after gst_init.
+ */
+gboolean proto_spectrum_register (void);
+
+G_END_DECLS
+
+#endif /* PROTOSPECTRUM_H */